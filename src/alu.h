@@ -0,0 +1,91 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <array>
+#include <cstddef>
+
+namespace Emulator {
+
+/**
+ * The 6502's arithmetic and shifts, both as plain functions and as
+ * lookup tables generated from them at compile time.
+ */
+namespace Alu {
+
+/**
+ * Bits 0-7 hold the result and bit 8 the carry out. Additions
+ * also put the overflow in bit 9.
+ */
+using Result = std::uint16_t;
+
+unsigned constexpr carry_bit = CHAR_BIT;
+unsigned constexpr overflow_bit = CHAR_BIT + 1;
+
+constexpr Result add(Byte a, Byte operand, bool carry) noexcept
+{
+        unsigned const sum = a + operand + carry;
+        Byte const result = sum;
+        // Overflow when both operands have the same sign, and
+        // the result has a different one.
+        bool const overflow = (a ^ result) & (operand ^ result) & 1u << sign_bit;
+        return sum | overflow << overflow_bit;
+}
+
+constexpr Result shift_left(Byte operand, bool carry) noexcept
+{
+        return operand << 1 | carry;
+}
+
+constexpr Result shift_right(Byte operand, bool carry) noexcept
+{
+        return operand >> 1 | carry << sign_bit | (operand & 1u) << carry_bit;
+}
+
+constexpr std::size_t add_index(Byte a, Byte operand, bool carry) noexcept
+{
+        return carry << 2 * CHAR_BIT | a << CHAR_BIT | operand;
+}
+
+constexpr std::size_t shift_index(Byte operand, bool carry) noexcept
+{
+        return carry << CHAR_BIT | operand;
+}
+
+using AddTable = std::array<Result, add_index(byte_max, byte_max, true) + 1>;
+using ShiftTable = std::array<Result, shift_index(byte_max, true) + 1>;
+
+constexpr AddTable make_add_table() noexcept
+{
+        AddTable table {};
+        for (std::size_t i = 0; i < table.size(); ++i)
+                table[i] = add(i >> CHAR_BIT, i, i >> 2 * CHAR_BIT);
+        return table;
+}
+
+template <Result (*shift)(Byte operand, bool carry) noexcept>
+constexpr ShiftTable make_shift_table() noexcept
+{
+        ShiftTable table {};
+        for (std::size_t i = 0; i < table.size(); ++i)
+                table[i] = shift(i, i >> CHAR_BIT);
+        return table;
+}
+
+/**
+ * Indexed by add_index. SBC and CMP use it too, since
+ * A - M - (1 - C) == A + ~M + C.
+ */
+inline constexpr AddTable add_table = make_add_table();
+
+/**
+ * Indexed by shift_index.
+ */
+inline constexpr ShiftTable shift_left_table = make_shift_table<shift_left>();
+inline constexpr ShiftTable shift_right_table = make_shift_table<shift_right>();
+
+}
+
+}
+
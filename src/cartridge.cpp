@@ -13,14 +13,23 @@ MemoryMapperNotSupported::MemoryMapperNotSupported(Byte id) noexcept
 {}
 
 Cartridge::Cartridge(std::string const& path)
-        : Cartridge(read_bytes(path))
-{}
+        : mapped_file_(std::make_unique<MappedFile>(path)),
+          data_(mapped_file_->data()),
+          size_(mapped_file_->size())
+{
+        check_data_size();
+        check_header_footprint();
+        check_prg_rom_size();
+}
 
 Cartridge::Cartridge(std::vector<Byte> data)
-        : data_(std::move(data))
+        : owned_data_(std::move(data)),
+          data_(owned_data_.data()),
+          size_(owned_data_.size())
 {
         check_data_size();
         check_header_footprint();
+        check_prg_rom_size();
 }
 
 bool Cartridge::is_prg_rom(Address address) noexcept
@@ -80,26 +89,42 @@ ByteBitset Cartridge::second_control_byte() const noexcept
 }
 
 Byte Cartridge::read_prg_rom_byte(Address address) const
+{
+        return *prg_rom_data(address);
+}
+
+Byte const* Cartridge::prg_rom_data(Address address) const
 {
         if (!is_prg_rom(address))
                 throw InvalidRead(address);
         address = apply_mirroring(address);
-        return data_[header_size + address];
+        return data_ + header_size + address - prg_rom_lower_bank_start;
 }
 
 Address Cartridge::apply_mirroring(Address address) const noexcept
 {
-        if (num_prg_rom_banks() == 1 && address < prg_rom_upper_bank_start)
-                address += prg_rom_bank_size;
+        // A single bank shows up in both halves.
+        if (num_prg_rom_banks() == 1 && address >= prg_rom_upper_bank_start)
+                address -= prg_rom_bank_size;
         return address;
 }
 
 void Cartridge::check_data_size() const
 {
-        if (data_.size() < header_size)
+        if (size_ < header_size)
                 throw InvalidCartridgeHeader("Cartridge header too small.");
 }
 
+/**
+ * The PRG ROM is read straight from the data, and past the end of a
+ * mapped file there's nothing to read.
+ */
+void Cartridge::check_prg_rom_size() const
+{
+        if (size_ < header_size + std::size_t {num_prg_rom_banks()} * prg_rom_bank_size)
+                throw InvalidCartridge("Cartridge too small for its PRG ROM banks.");
+}
+
 void Cartridge::check_header_footprint() const
 {
         if (data_[0] != 'N' ||
@@ -164,17 +189,31 @@ bool NROM::address_is_readable_impl(Address address) const noexcept
         return is_prg_ram(address) || Cartridge::is_prg_rom(address);
 }
 
+Byte const* NROM::readable_page(Address page_start) noexcept
+{
+        if (Cartridge::is_prg_rom(page_start))
+                return cartridge_.prg_rom_data(page_start);
+        return writable_page(page_start);
+}
+
+Byte* NROM::writable_page(Address page_start) noexcept
+{
+        if (!is_prg_ram(page_start))
+                return nullptr;
+        return prg_ram_.data() + (page_start - prg_ram_start);
+}
+
 // TODO Handling the CHR-RAM?
 
 void NROM::write_byte_impl(Address address, Byte byte)
 {
-        prg_ram_[address] = byte;
+        prg_ram_[address - prg_ram_start] = byte;
 }
 
 Byte NROM::read_byte_impl(Address address)
 {
         if (is_prg_ram(address))
-                return prg_ram_[address];
+                return prg_ram_[address - prg_ram_start];
         return cartridge_.read_prg_rom_byte(address);
 }
 
@@ -35,6 +35,11 @@ public:
         static Address constexpr prg_rom_upper_bank_start = prg_rom_lower_bank_end + 1;
         static Address constexpr prg_rom_upper_bank_end = prg_rom_upper_bank_start + prg_rom_bank_size - 1;
 
+        /**
+         * Maps the file rather than reading it, so the ROM data is
+         * shared by all the cartridges made from the same file, in
+         * this process and others.
+         */
         explicit Cartridge(std::string const& path);
         explicit Cartridge(std::vector<Byte> data);
 
@@ -51,12 +56,24 @@ public:
         ByteBitset second_control_byte() const noexcept;
         Byte read_prg_rom_byte(Address address) const;
 
+        /**
+         * Where the PRG ROM byte at the address is in the cartridge
+         * data, with the banks stored one after the other.
+         */
+        Byte const* prg_rom_data(Address address) const;
+
 private:
-        std::vector<Byte> data_;
+        // Where the data is kept, depending on how it was given.
+        std::vector<Byte> owned_data_;
+        std::unique_ptr<MappedFile> mapped_file_;
+
+        Byte const* data_;
+        std::size_t size_;
 
         Address apply_mirroring(Address address) const noexcept;
         void check_data_size() const;
         void check_header_footprint() const;
+        void check_prg_rom_size() const;
 };
 
 class MemoryMapper : public Memory {
@@ -74,6 +91,9 @@ public:
         explicit NROM(Cartridge const& cartridge);
         static bool is_prg_ram(Address address) noexcept;
 
+        Byte const* readable_page(Address page_start) noexcept override;
+        Byte* writable_page(Address page_start) noexcept override;
+
 protected:
         bool address_is_writable_impl(Address address) const noexcept override;
         bool address_is_readable_impl(Address address) const noexcept override;
@@ -1,11 +1,20 @@
 // vim: set shiftwidth=8 tabstop=8:
 
 #include "cpu.h"
+#include "alu.h"
+#include "opcodes.h"
+#include "recompiled.h"
+#ifdef EMULATOR_JIT
+#include "jit.h"
+#endif
 #include <utility>
 #include <string>
 #include <sstream>
 #include <cassert>
 #include <algorithm>
+#include <exception>
+#include <limits>
+#include <optional>
 
 using namespace std::string_literals;
 
@@ -13,11 +22,173 @@ namespace Emulator {
 
 namespace {
 
-using Instruction = std::function<void()>;
+using Opcodes::opcode_table;
+using Opcodes::AddressingMode;
+using Opcodes::MemoryAccess;
+using Opcodes::max_block_size;
+using Opcodes::is_branch;
+using Opcodes::ends_block;
 
-Address deref_pointer(ReadableMemory& memory, Address address)
+unsigned constexpr interrupt_cycles = 7;
+
+Cycles constexpr no_cycle_limit = std::numeric_limits<Cycles>::max();
+std::size_t constexpr no_instruction_limit = std::numeric_limits<std::size_t>::max();
+
+#ifdef EMULATOR_ALU_TABLES
+
+/**
+ * Looking the results up turns out slower than working them out on
+ * the machines we measured (see tests/benchmarks.cpp), hence the option.
+ */
+
+Alu::Result add(Byte a, Byte operand, bool carry) noexcept
 {
-        return memory.read_pointer(memory.read_pointer(address));
+        return Alu::add_table[Alu::add_index(a, operand, carry)];
+}
+
+Alu::Result shift_left(Byte operand, bool carry) noexcept
+{
+        return Alu::shift_left_table[Alu::shift_index(operand, carry)];
+}
+
+Alu::Result shift_right(Byte operand, bool carry) noexcept
+{
+        return Alu::shift_right_table[Alu::shift_index(operand, carry)];
+}
+
+#else
+
+using Alu::add;
+using Alu::shift_left;
+using Alu::shift_right;
+
+#endif
+
+/**
+ * Code is only cached if it comes from the internal RAM or from
+ * the cartridge's PRG RAM and PRG ROM. Everything in between is I/O, where
+ * even reading the code could have side effects.
+ */
+Address constexpr first_cacheable_cartridge_address = 0x6000;
+
+/**
+ * Not a real opcode. Superinstructions use it to get a label of their
+ * own in the threaded loop, which calls whatever their handler is.
+ */
+Byte constexpr superinstruction_opcode = 0x02;
+
+/**
+ * What a taken branch to another page adds to its base cycles, which
+ * is more than any other instruction adds.
+ */
+unsigned constexpr max_extra_cycles = 2;
+
+bool crosses_page(Address from, Address to) noexcept
+{
+        return high_byte(from) != high_byte(to);
+}
+
+bool is_cacheable(Address address) noexcept
+{
+        return CPU::RAM::address_is_accessible(address) ||
+               address >= first_cacheable_cartridge_address;
+}
+
+/**
+ * The page a byte of code really lives on, with the mirrors
+ * of the internal RAM folded back onto the first 2 KB.
+ */
+Byte code_page(Address address) noexcept
+{
+        if (CPU::RAM::address_is_accessible(address))
+                address %= CPU::RAM::real_size;
+        return high_byte(address);
+}
+
+Address constexpr first_io_address = 0x2000;
+Address constexpr last_io_address = 0x401F;
+Address constexpr ppu_status_address = 0x2002;
+
+/**
+ * Whether an instruction could touch the PPU, APU or joypad registers.
+ * Anything going through a pointer counts, since it could end up anywhere.
+ */
+bool may_access_io(Byte opcode, Address operand) noexcept
+{
+        switch (opcode_table[opcode].mode) {
+                case AddressingMode::indirect:
+                case AddressingMode::indirect_x:
+                case AddressingMode::indirect_y:
+                        return true;
+                case AddressingMode::absolute:
+                case AddressingMode::absolute_x:
+                case AddressingMode::absolute_y:
+                        if (opcode_table[opcode].jumps) // JSR and JMP abs
+                                return false;
+                        break;
+                default:
+                        return false;
+        }
+
+        // Absolute addressing, possibly indexed by up to 255 bytes.
+        unsigned const last_address = operand + byte_max;
+        return operand <= last_io_address && last_address >= first_io_address;
+}
+
+/**
+ * Whether doing the instruction twice in a row reads the same values, as
+ * far as I/O goes. Polling the PPU status register is fine (reading it
+ * again changes nothing), but e.g. the PPU data register and the joypads
+ * move on to the next value with every read.
+ */
+bool reads_repeatably(Byte opcode, Address operand) noexcept
+{
+        bool const is_absolute = opcode_table[opcode].mode == AddressingMode::absolute;
+        return !may_access_io(opcode, operand) ||
+               (is_absolute && operand == ppu_status_address);
+}
+
+#ifdef EMULATOR_JIT
+
+/**
+ * How many times a block gets interpreted before it's worth compiling.
+ */
+unsigned constexpr hot_block_executions = 64;
+
+#endif
+
+/**
+ * How many bytes an instruction pushes onto the stack, and how many
+ * it pulls off it.
+ */
+std::pair<unsigned, unsigned> stack_accesses(Byte opcode) noexcept
+{
+        switch (opcode) {
+                case 0x00: return {3, 0}; // BRK
+                case 0x08: return {1, 0}; // PHP
+                case 0x20: return {2, 0}; // JSR
+                case 0x28: return {0, 1}; // PLP
+                case 0x40: return {0, 3}; // RTI
+                case 0x48: return {1, 0}; // PHA
+                case 0x60: return {0, 2}; // RTS
+                case 0x68: return {0, 1}; // PLA
+                default:   return {0, 0};
+        }
+}
+
+/**
+ * Whether an instruction can change anything besides the registers:
+ * memory, the stack or where the code goes next (apart from branches
+ * and JMP).
+ */
+bool has_side_effects(Byte opcode) noexcept
+{
+        auto const& info = opcode_table[opcode];
+        return info.access == MemoryAccess::write ||
+               info.access == MemoryAccess::read_modify_write ||
+               info.uses_stack ||
+               info.mode == AddressingMode::indirect || // JMP
+               !info.known;
 }
 
 }
@@ -56,297 +227,1201 @@ Address CPU::RAM::apply_mirroring(Address address) const noexcept
         return address % real_size;
 }
 
+Byte* CPU::RAM::data() noexcept
+{
+        return ram_.data();
+}
+
+Byte const* CPU::RAM::readable_page(Address page_start) noexcept
+{
+        return writable_page(page_start);
+}
+
+Byte* CPU::RAM::writable_page(Address page_start) noexcept
+{
+        if (!address_is_accessible(page_start))
+                return nullptr;
+        return ram_.data() + apply_mirroring(page_start);
+}
+
+namespace {
+
+bool is_readable(Memory const& piece, Address address) noexcept
+{
+        return piece.address_is_readable(address);
+}
+
+bool is_writable(Memory const& piece, Address address) noexcept
+{
+        return piece.address_is_writable(address);
+}
+
+}
+
 CPU::AccessibleMemory::AccessibleMemory(Pieces pieces) noexcept
         : pieces_(std::move(pieces))
-{}
+{
+        for (auto const piece : pieces_) {
+                piece->on_remap([this] {
+                        unmap_pages();
+                        remapped();
+                });
+        }
+}
+
+CPU::AccessibleMemory::~AccessibleMemory()
+{
+        for (auto const piece : pieces_)
+                piece->on_remap(nullptr);
+}
+
+Byte* CPU::AccessibleMemory::zero_page_and_stack() noexcept
+{
+        RAM* ram = nullptr;
+        for (unsigned address = 0; address <= zero_page_and_stack_end; ++address) {
+                auto const readable = std::find_if(pieces_.cbegin(), pieces_.cend(),
+                                                   [&](Memory* piece)
+                                                   { return piece->address_is_readable(address); });
+                auto const writable = std::find_if(pieces_.cbegin(), pieces_.cend(),
+                                                   [&](Memory* piece)
+                                                   { return piece->address_is_writable(address); });
+                if (readable == pieces_.cend() || readable != writable)
+                        return nullptr;
+                if (address == 0)
+                        ram = dynamic_cast<RAM*>(*readable);
+                if (!ram || *readable != ram)
+                        return nullptr;
+        }
+        return ram->data();
+}
 
 bool CPU::AccessibleMemory::address_is_writable_impl(Address address) const noexcept
 {
-        return std::any_of(pieces_.cbegin(), pieces_.cend(),
-                           [&](Memory* piece)
-                           { return piece->address_is_writable(address); });
+        return writable_piece(address) < pieces_.size();
 }
 
 bool CPU::AccessibleMemory::address_is_readable_impl(Address address) const noexcept
 {
-        return std::any_of(pieces_.cbegin(), pieces_.cend(),
-                           [&](Memory* piece)
-                           { return piece->address_is_readable(address); });
+        return readable_piece(address) < pieces_.size();
 }
 
 void CPU::AccessibleMemory::write_byte_impl(Address address, Byte byte)
 {
-        find_writable_piece(address).write_byte(address, byte);
+        write(address, byte);
 }
 
 Byte CPU::AccessibleMemory::read_byte_impl(Address address)
 {
-        return find_readable_piece(address).read_byte(address);
+        return read(address);
+}
+
+std::size_t CPU::AccessibleMemory::piece_count() const noexcept
+{
+        return pieces_.size();
+}
+
+std::size_t CPU::AccessibleMemory::readable_piece(Address address) const noexcept
+{
+        auto const& page = read_pages_[address >> page_bits];
+        if (page.mapped && page.piece < pieces_.size())
+                return page.partial && !is_readable(*pieces_[page.piece], address) ? pieces_.size() : page.piece;
+        return search_pieces(address, is_readable);
+}
+
+std::size_t CPU::AccessibleMemory::writable_piece(Address address) const noexcept
+{
+        auto const& page = write_pages_[address >> page_bits];
+        if (page.mapped && page.piece < pieces_.size())
+                return page.partial && !is_writable(*pieces_[page.piece], address) ? pieces_.size() : page.piece;
+        return search_pieces(address, is_writable);
+}
+
+/**
+ * Reads that can't go straight to the bytes end up here: the first read
+ * of a page since the last remap, and reads of I/O and split pages.
+ */
+Byte CPU::AccessibleMemory::read_through_piece(Address address)
+{
+        if (auto const byte = read_piece(address))
+                return open_bus_ = *byte;
+        if (strict_)
+                ++invalid_accesses_.reads;
+        return open_bus_;
+}
+
+Byte CPU::AccessibleMemory::peek_through_piece(Address address)
+{
+        return read_piece(address).value_or(open_bus_);
+}
+
+/**
+ * The byte at the address, or nothing if no piece is there.
+ */
+std::optional<Byte> CPU::AccessibleMemory::read_piece(Address address)
+{
+        auto const& page = readable_page_entry(address);
+        if (page.data)
+                return page.data[address & page_mask];
+        std::size_t const piece = readable_piece(address);
+        if (piece == pieces_.size())
+                return std::nullopt;
+        return pieces_[piece]->read_byte(address);
+}
+
+void CPU::AccessibleMemory::write_through_piece(Address address, Byte byte)
+{
+        auto const& page = writable_page_entry(address);
+        if (page.data) {
+                page.data[address & page_mask] = byte;
+                return;
+        }
+        std::size_t const piece = writable_piece(address);
+        if (piece == pieces_.size()) {
+                if (strict_)
+                        ++invalid_accesses_.writes;
+                return;
+        }
+        pieces_[piece]->write_byte(address, byte);
 }
 
-Memory& CPU::AccessibleMemory::find_writable_piece(Address address)
+void CPU::AccessibleMemory::set_strict(bool strict) noexcept
 {
-        return find_piece([&](Memory* piece)
-                          { return piece->address_is_writable(address); });
+        strict_ = strict;
 }
 
-Memory& CPU::AccessibleMemory::find_readable_piece(Address address)
+Statistics::Accesses const& CPU::AccessibleMemory::invalid_accesses() const noexcept
 {
-        return find_piece([&](Memory* piece)
-                          { return piece->address_is_readable(address); });
+        return invalid_accesses_;
+}
+
+auto CPU::AccessibleMemory::readable_page_entry(Address address) noexcept -> Page<Byte const>&
+{
+        auto& page = read_pages_[address >> page_bits];
+        if (!page.mapped) {
+                Address const page_start = address & ~page_mask;
+                page.piece = page_owner(page_start, is_readable, page.partial);
+                if (page.piece < pieces_.size() && !page.partial)
+                        page.data = pieces_[page.piece]->readable_page(page_start);
+                page.mapped = true;
+        }
+        return page;
+}
+
+auto CPU::AccessibleMemory::writable_page_entry(Address address) noexcept -> Page<Byte>&
+{
+        auto& page = write_pages_[address >> page_bits];
+        if (!page.mapped) {
+                Address const page_start = address & ~page_mask;
+                page.piece = page_owner(page_start, is_writable, page.partial);
+                if (page.piece < pieces_.size() && !page.partial)
+                        page.data = pieces_[page.piece]->writable_page(page_start);
+                page.mapped = true;
+        }
+        return page;
+}
+
+void CPU::AccessibleMemory::unmap_pages() noexcept
+{
+        read_pages_.fill({});
+        write_pages_.fill({});
+}
+
+/**
+ * The piece that all of the page's accessible addresses go to, or the
+ * piece count if they're split between pieces. Partial is set if some
+ * addresses aren't accessible at all, like the gaps in an I/O page.
+ */
+template <class Accessible>
+std::size_t CPU::AccessibleMemory::page_owner(Address page_start, Accessible const& accessible,
+                                              bool& partial) const noexcept
+{
+        std::size_t owner = pieces_.size();
+        partial = false;
+        for (unsigned offset = 0; offset <= page_mask; ++offset) {
+                std::size_t const piece = search_pieces(page_start + offset, accessible);
+                if (piece == pieces_.size())
+                        partial = true;
+                else if (owner == pieces_.size())
+                        owner = piece;
+                else if (piece != owner)
+                        return pieces_.size();
+        }
+        return owner;
 }
 
 struct CPU::Impl {
-        explicit Impl(std::unique_ptr<AccessibleMemory> memory)
-                : memory(std::move(memory))
-        {
+        using Instruction = void (*)(Impl& self, Address operand);
+        using DispatchTable = std::array<Instruction, 256>;
+
+        struct DecodedInstruction {
+                Instruction instruction;
+                Address operand;
+                Byte opcode;
+                Byte cycles;
+                Byte instruction_count = 1; // 2 for superinstructions
+        };
+
+        using Instructions = std::vector<DecodedInstruction>;
+
+        /**
+         * A straight-line run of instructions, ending with the first
+         * instruction that could jump somewhere else. It's small enough
+         * to touch at most two pages of code.
+         */
+        struct Block {
+                Instructions instructions;
+                Instructions superinstructions; // Empty if nothing was fused
+                Byte first_page = 0;
+                Byte last_page = 0;
+                bool could_idle = false;
+                Cycles max_cycles = 0;
+                Recompiled::Function recompiled = nullptr;
+#ifdef EMULATOR_JIT
+                Address address = 0;
+                std::uint64_t serial = 0;
+                unsigned executions = 0;
+                std::unique_ptr<Jit::Code> native;
+#endif
+        };
+
+        struct Superinstruction {
+                Byte first;
+                Byte second;
+                Instruction instruction;
+        };
+
+        Impl(std::unique_ptr<AccessibleMemory> memory, Accuracy accuracy)
+                : accuracy(accuracy),
+                  dispatch_table(dispatch_tables[tier(accuracy)]),
+                  steps(step_tables[tier(accuracy)]),
+                  memory(std::move(memory))
+        {
+                this->memory->on_remap([this] { invalidate_code_cache(); });
+                zero_page_and_stack = this->memory->zero_page_and_stack();
+#ifdef EMULATOR_STATISTICS
+                statistics.accesses.resize(this->memory->piece_count());
+#endif
                 load_interrupt_handler(Interrupt::reset);
         }
 
-        explicit Impl(AccessibleMemory::Pieces memory_pieces)
-                : Impl(std::make_unique<AccessibleMemory>(memory_pieces))
+        Impl(AccessibleMemory::Pieces memory_pieces, Accuracy accuracy)
+                : Impl(std::make_unique<AccessibleMemory>(memory_pieces), accuracy)
         {}
 
-        Address stack_top_address() const noexcept
+        static constexpr std::size_t tier(Accuracy accuracy) noexcept
         {
-                return stack_bottom_address + sp + 1;
+                return static_cast<std::size_t>(accuracy);
         }
 
-        Byte stack_top_byte()
+        /**
+         * The stack wraps around within its page, like on the real thing.
+         */
+        static Address stack_address(Byte offset) noexcept
         {
-                return memory->read_byte(stack_top_address() + 1);
-        }
-
-        Address stack_top_pointer()
-        {
-                return memory->read_pointer(stack_top_address() + 1);
+                return stack_bottom_address + 1 + offset;
         }
 
         void stack_push_byte(Byte byte)
         {
-                memory->write_byte(stack_top_address(), byte);
+                write_low_ram(stack_address(sp), byte);
                 sp -= 1;
         }
 
         void stack_push_pointer(Address pointer)
         {
-                memory->write_pointer(stack_top_address() - 1, pointer);
-                sp -= sizeof(Address);
+                stack_push_byte(high_byte(pointer));
+                stack_push_byte(low_byte(pointer));
         }
 
         Byte stack_pull_byte()
         {
-                Byte const result = stack_top_byte();
                 sp += 1;
-                return result;
+                return read_low_ram(stack_address(sp));
         }
 
-        Address stack_pull_pointer() noexcept
+        Address stack_pull_pointer()
         {
-                Address const result = stack_top_pointer();
-                sp += sizeof(Address);
-                return result;
+                Byte const low = stack_pull_byte();
+                return combine_bytes(low, stack_pull_byte());
+        }
+
+        /**
+         * The zero page and the stack are always in the internal RAM, so
+         * they're accessed straight through its array whenever that can
+         * be found, instead of searching the memory pieces every time.
+         */
+        Byte read_low_ram(Address address)
+        {
+                assert(address <= AccessibleMemory::zero_page_and_stack_end);
+                count_read(address);
+                if (zero_page_and_stack)
+                        return memory->drive_bus(zero_page_and_stack[address]);
+                return memory->read(address);
+        }
+
+        void write_low_ram(Address address, Byte byte)
+        {
+                assert(address <= AccessibleMemory::zero_page_and_stack_end);
+                if (!zero_page_and_stack) {
+                        write_byte(address, byte);
+                        return;
+                }
+                zero_page_and_stack[address] = memory->drive_bus(byte);
+                count_write(address);
+                note_write(address);
+        }
+
+        /**
+         * Pointers on the zero page wrap around within it too.
+         */
+        Address read_zero_page_pointer(Byte address)
+        {
+                Byte const low = read_low_ram(address);
+                return combine_bytes(low, read_low_ram(Byte(address + 1)));
         }
 
         Address interrupt_handler(Interrupt interrupt) noexcept
         {
                 Address const pointer_address = interrupt_handler_address(interrupt);
-                return memory->read_pointer(pointer_address);
+                Byte const low = memory->read(pointer_address);
+                return combine_bytes(low, memory->read(pointer_address + 1));
         }
 
         void load_interrupt_handler(Interrupt interrupt) noexcept
         {
+                Address const pointer_address = interrupt_handler_address(interrupt);
+                count_read(pointer_address);
+                count_read(pointer_address + 1);
                 pc = interrupt_handler(interrupt);
         } 
 
-        template <class Integer>
-        void update_transfer_flags(Integer i) noexcept
+        /**
+         * Every read the program makes goes through here or through
+         * read_low_ram. Decoding code peeks at memory directly, so that
+         * looking ahead doesn't change the open bus.
+         */
+        Byte read_byte(Address address)
         {
-                update_zero_flag(i);
-                update_negative_flag(i);
+                count_read(address);
+                return memory->read(address);
         }
 
-        template <class Operation, class Offset>
-        Instruction zero_page(Operation operation, Offset offset)
+        /**
+         * Every write the CPU makes goes through here, so that cached
+         * code can be thrown away once it's overwritten.
+         */
+        void write_byte(Address address, Byte byte)
         {
-                return [this, operation, offset]
-                {
-                        auto const base_address = memory->read_byte(pc + 1);
-                        Address const address = base_address + offset();
-                        execute_on_memory(operation, address);
-                        pc += 2;
-                };
+                count_write(address);
+                memory->write(address, byte);
+                note_write(address);
         }
 
-        template <class Operation>
-        Instruction zero_page(Operation operation)
+        /**
+         * The counting below is compiled out unless the core is built
+         * with EMULATOR_STATISTICS. Accesses to addresses nothing is
+         * at aren't counted here, but by the memory in strict mode.
+         */
+        void count_read([[maybe_unused]] Address address) noexcept
         {
-                return zero_page(operation, [] { return 0; });
+#ifdef EMULATOR_STATISTICS
+                std::size_t const piece = memory->readable_piece(address);
+                if (piece < statistics.accesses.size())
+                        ++statistics.accesses[piece].reads;
+#endif
         }
 
-        template <class Operation>
-        Instruction zero_page_x(Operation operation)
+        void count_write([[maybe_unused]] Address address) noexcept
         {
-                return zero_page(operation, [this] { return x; });
+#ifdef EMULATOR_STATISTICS
+                std::size_t const piece = memory->writable_piece(address);
+                if (piece < statistics.accesses.size())
+                        ++statistics.accesses[piece].writes;
+#endif
         }
 
-        template <class Operation>
-        Instruction zero_page_y(Operation operation)
+        void count_execution([[maybe_unused]] Byte opcode) noexcept
         {
-                return zero_page(operation, [this] { return y; });
+#ifdef EMULATOR_STATISTICS
+                ++statistics.executions[opcode];
+#endif
         }
 
-        template <class Operation, class Offset>
-        Instruction absolute(Operation operation, Offset offset)
+        void count_taken_branch([[maybe_unused]] Byte opcode) noexcept
         {
-                return [this, operation, offset]
-                {
-                        Address const address =
-                                memory->read_pointer(pc + 1) + offset();
-                        execute_on_memory(operation, address);
-                        pc += 3;
-                };
+#ifdef EMULATOR_STATISTICS
+                ++statistics.branches_taken[opcode];
+#endif
         }
 
-        template <class Operation>
-        Instruction absolute(Operation operation)
+        void note_write(Address address) noexcept
         {
-                return absolute(operation, [] { return 0; });
+                Byte const page = code_page(address);
+                if (code_pages.test(page)) {
+                        written_code_pages.set(page);
+                        events |= code_modified;
+                }
         }
 
-        template <class Operation>
-        Instruction absolute_x(Operation operation)
+        void invalidate_code_cache() noexcept
         {
-                return absolute(operation, [this] { return x; });
+                written_code_pages.set();
+                events |= code_modified;
         }
 
-        template <class Operation>
-        Instruction absolute_y(Operation const& operation)
+        DecodedInstruction decode_instruction(Address address)
         {
-                return absolute(operation, [this] { return y; });
+                Byte const opcode = memory->peek(address);
+                auto const& info = opcode_table[opcode];
+                Address operand = 0;
+                if (info.length >= 2)
+                        operand = memory->peek(address + 1);
+                if (info.length == 3)
+                        operand = combine_bytes(operand, memory->peek(address + 2));
+                return {
+                        .instruction = dispatch_table[opcode],
+                        .operand = operand,
+                        .opcode = opcode,
+                        .cycles = info.cycles
+                };
+        }
+
+        Block decode_block(Address address)
+        {
+                Block block;
+                block.first_page = code_page(address);
+                block.last_page = block.first_page;
+                Address const start = address;
+                Address last_instruction_address = address;
+                while (block.instructions.size() < max_block_size &&
+                       is_cacheable(address)) {
+                        Byte const opcode = memory->peek(address);
+                        Address const last_address = address + opcode_table[opcode].length - 1;
+                        if (!is_cacheable(last_address))
+                                break;
+                        block.instructions.push_back(decode_instruction(address));
+                        block.last_page = code_page(last_address);
+                        last_instruction_address = address;
+                        address = last_address + 1;
+                        block.max_cycles += opcode_table[opcode].cycles + max_extra_cycles;
+                        if (ends_block(opcode))
+                                break;
+                }
+                block.superinstructions = fuse(block.instructions);
+                block.recompiled = find_recompiled(start, Address(address - start));
+                block.could_idle = !block.instructions.empty() &&
+                        jumps_back(block.instructions.back(), last_instruction_address, start) &&
+                        std::none_of(block.instructions.cbegin(), block.instructions.cend(),
+                                     [](DecodedInstruction const& decoded)
+                                     {
+                                             return has_side_effects(decoded.opcode) ||
+                                                    !reads_repeatably(decoded.opcode, decoded.operand);
+                                     });
+                return block;
+        }
+
+        /**
+         * The recompiled code for a block, if there's some that was
+         * compiled from exactly the same bytes.
+         */
+        Recompiled::Function find_recompiled(Address address, std::size_t code_size)
+        {
+                if (!recompiled_library)
+                        return nullptr;
+
+                auto const* const begin = recompiled_library->blocks;
+                auto const* const end = begin + recompiled_library->block_count;
+                auto const i = std::lower_bound(begin, end, address,
+                                                [](Recompiled::Block const& block, Address address)
+                                                { return block.address < address; });
+                if (i == end || i->address != address || i->code_size != code_size)
+                        return nullptr;
+                for (std::size_t offset = 0; offset < code_size; ++offset) {
+                        if (memory->peek(address + offset) != i->code[offset])
+                                return nullptr;
+                }
+                return i->function;
+        }
+
+        /**
+         * Returns the instructions with pairs that have a superinstruction
+         * fused into one, or nothing if there aren't any such pairs.
+         */
+        static Instructions fuse(Instructions const& instructions)
+        {
+                Instructions result;
+                bool fused_any = false;
+                for (std::size_t i = 0; i < instructions.size(); ++i) {
+                        auto const& first = instructions[i];
+                        Instruction const instruction = i + 1 < instructions.size() ?
+                                superinstruction(first.opcode, instructions[i + 1].opcode) :
+                                nullptr;
+                        if (!instruction) {
+                                result.push_back(first);
+                                continue;
+                        }
+
+                        auto const& second = instructions[++i];
+                        result.push_back({
+                                .instruction = instruction,
+                                .operand = combine_bytes(first.operand, second.operand),
+                                .opcode = superinstruction_opcode,
+                                .cycles = Byte(first.cycles + second.cycles),
+                                .instruction_count = 2
+                        });
+                        fused_any = true;
+                }
+                return fused_any ? result : Instructions {};
         }
 
-        template <class Operation>
-        Instruction indirect(Operation operation)
+        static Instruction superinstruction(Byte first, Byte second) noexcept
         {
-                return [this, operation]
-                {
-                        Address const address = deref_pointer(*memory, pc);
-                        execute_on_memory(operation, address);
-                        pc += 3;
-                };
+                for (auto const& superinstruction : superinstructions) {
+                        if (superinstruction.first == first && superinstruction.second == second)
+                                return superinstruction.instruction;
+                }
+                return nullptr;
         }
 
-        template <class Operation>
-        Instruction implied(Operation operation)
+        static bool jumps_back(DecodedInstruction const& decoded,
+                               Address address,
+                               Address target) noexcept
         {
-                return [this, operation]
+                if (decoded.opcode == 0x4C) // JMP
+                        return decoded.operand == target;
+                return is_branch(decoded.opcode) &&
+                       Address(address + 2 + TwosComplement::encode(decoded.operand)) == target;
+        }
+
+        /**
+         * What idle loop detection compares between two runs of the
+         * same block.
+         */
+        struct IdleState {
+                Byte a;
+                Byte x;
+                Byte y;
+                Byte sp;
+                Byte status;
+
+                bool operator==(IdleState const& other) const noexcept
                 {
-                        (this->*operation)();
-                        pc += 1;
-                };
+                        return a == other.a && x == other.x && y == other.y &&
+                               sp == other.sp && status == other.status;
+                }
+        };
+
+        /**
+         * A loop that only reads and branches back to itself, and comes
+         * back around with the registers unchanged, will keep doing the
+         * same thing until something outside the CPU changes memory. That
+         * can only happen between runs (or through a stop request, which
+         * ends the run), so the rest of the run can be skipped a whole
+         * number of iterations at a time. It stops short of the limits, so
+         * the interpreter still takes care of the last iteration and
+         * stops at the same place it would have.
+         */
+        void enter_block(Block const& block, std::size_t& count, Cycles cycle_limit)
+        {
+                if (!block.could_idle) {
+                        idle_block = nullptr;
+                        return;
+                }
+
+                IdleState const state {a, x, y, sp, status()};
+                if (idle_block != &block || !(state == idle_state)) {
+                        idle_block = &block;
+                        idle_state = state;
+                        idle_cycles = cycles;
+                        return;
+                }
+
+                Cycles const iteration_cycles = cycles - idle_cycles;
+                std::size_t const iteration_instructions = block.instructions.size();
+                Cycles const iterations = std::min<Cycles>(
+                        (cycle_limit - cycles - 1) / iteration_cycles,
+                        (count - 1) / iteration_instructions);
+                cycles += iterations * iteration_cycles;
+                count -= iterations * iteration_instructions;
+                idle_cycles = cycles;
+        }
+
+        void drop_written_blocks()
+        {
+                for (auto i = blocks.begin(); i != blocks.end();) {
+                        auto const& block = i->second;
+                        if (written_code_pages.test(block.first_page) ||
+                            written_code_pages.test(block.last_page))
+                                i = blocks.erase(i);
+                        else
+                                ++i;
+                }
+                code_pages &= ~written_code_pages;
+                written_code_pages.reset();
+                events &= ~code_modified;
+                idle_block = nullptr;
         }
 
-        template <class Operation>
-        Instruction accumulator(Operation operation)
+        Block& find_block(Address address)
         {
-                return [this, operation]
-                {
-                        a = (this->*operation)(a);
-                        pc += 1;
+                if (events & code_modified)
+                        drop_written_blocks();
+
+                auto const i = blocks.find(address);
+                if (i != blocks.cend())
+                        return i->second;
+
+                Block block = decode_block(address);
+                if (block.instructions.empty()) {
+                        // Not cacheable, so it's executed straight from memory.
+                        uncached_block.instructions = {decode_instruction(address)};
+                        return uncached_block;
+                }
+                code_pages.set(block.first_page);
+                code_pages.set(block.last_page);
+#ifdef EMULATOR_JIT
+                block.address = address;
+                block.serial = next_block_serial++;
+#endif
+                return blocks.emplace(address, std::move(block)).first->second;
+        }
+
+        /**
+         * Runs recompiled and compiled blocks for as long as it can, then
+         * returns the instructions the interpreter has to run next.
+         * Returns nullptr once execution has to stop.
+         */
+        Instructions const* next_instructions(std::size_t& count, Cycles cycle_limit)
+        {
+                while (!finished(count, cycle_limit)) {
+                        if (events & pending_interrupts) {
+                                take_pending_interrupt();
+                                continue;
+                        }
+#ifdef EMULATOR_JIT
+                        if (jit && jit->has_compiled())
+                                install_compiled_blocks();
+#endif
+
+                        Block& block = find_block(pc);
+                        enter_block(block, count, cycle_limit);
+                        if (!has_native_code(block) || !runs_to_end(block, count, cycle_limit)) {
+#ifdef EMULATOR_JIT
+                                note_execution(block);
+#endif
+                                return &instructions_to_run(block, count, cycle_limit);
+                        }
+
+                        count -= run_native_code(block);
+                        if (step_exception)
+                                std::rethrow_exception(std::exchange(step_exception, nullptr));
+                }
+                return nullptr;
+        }
+
+        static bool has_native_code([[maybe_unused]] Block const& block) noexcept
+        {
+#ifdef EMULATOR_STATISTICS
+                // Native code doesn't count the instructions it runs.
+                return false;
+#else
+#ifdef EMULATOR_JIT
+                if (block.native)
+                        return true;
+#endif
+                return block.recompiled;
+#endif
+        }
+
+        /**
+         * A native block always runs to the end, so it's only used if
+         * that can't overshoot the limits. Returns how many instructions
+         * it executed.
+         */
+        std::size_t run_native_code(Block const& block)
+        {
+                Recompiled::Host const host {
+                        this, &cycles, steps.data(),
+                        {&pc, &a, &x, &y, &carry_result, &zero_result, &overflow_result, &negative_result},
+                        native_buses[tier(accuracy)]
                 };
+                if (block.recompiled)
+                        return block.recompiled(host);
+#ifdef EMULATOR_JIT
+                return block.native->run(host);
+#else
+                assert(false);
+                return 0;
+#endif
+        }
+
+        /**
+         * What native code calls for each instruction. Exceptions can't
+         * unwind through native code, so they're kept for later.
+         */
+        template <Accuracy accuracy, std::size_t opcode>
+        static bool step(void* context, Address operand) noexcept
+        {
+                Impl& self = *static_cast<Impl*>(context);
+                try {
+                        constexpr Instruction instruction = dispatch_tables[tier(accuracy)][opcode];
+                        instruction(self, operand);
+                } catch (...) {
+                        self.step_exception = std::current_exception();
+                        return false;
+                }
+                return !self.leaving_block();
         }
 
-        template <class Operation>
-        Instruction immediate(Operation operation)
+        template <Accuracy accuracy, std::size_t... opcodes>
+        static constexpr std::array<Recompiled::Step, 256> make_steps(std::index_sequence<opcodes...>)
         {
-                return [this, operation]
-                {
-                        auto const operand = memory->read_byte(pc + 1);
-                        (this->*operation)(operand);
-                        pc += 2;
-                };
+                return {&step<accuracy, opcodes>...};
         }
 
-        template <class Branch>
-        Instruction relative(Branch branch)
+        static std::array<std::array<Recompiled::Step, 256>, 2> const step_tables;
+
+        /**
+         * How recompiled code accesses memory, the same way as the
+         * instructions do it in execute_on_memory and execute_on_indexed.
+         */
+        template <class Access>
+        static bool native_access(void* context, Access const& access) noexcept
         {
-                return [this, branch]
-                {
-                        if ((this->*branch)()) {
-                                auto const displacement = memory->read_byte(pc + 1);
-                                pc += TwosComplement::encode(displacement);
+                Impl& self = *static_cast<Impl*>(context);
+                try {
+                        access(self);
+                } catch (...) {
+                        self.step_exception = std::current_exception();
+                        return false;
+                }
+                return !self.leaving_block();
+        }
+
+        static bool native_read_zero_page(void* context, Byte address, Byte& byte) noexcept
+        {
+                return native_access(context, [&](Impl& self) { byte = self.read_low_ram(address); });
+        }
+
+        static bool native_write_zero_page(void* context, Byte address, Byte byte) noexcept
+        {
+                return native_access(context, [&](Impl& self) { self.write_low_ram(address, byte); });
+        }
+
+        template <Accuracy accuracy>
+        static bool native_read_absolute(void* context, Address base, Byte index, Byte& byte) noexcept
+        {
+                return native_access(context, [&](Impl& self) {
+                        Address const address = self.fetched_absolute(base) + index;
+                        bool const crossed = crosses_page(base, address);
+                        self.cycles += crossed;
+                        if constexpr (accuracy == Accuracy::bus) {
+                                if (crossed)
+                                        self.dummy_read(combine_bytes(low_byte(address), high_byte(base)));
                         }
-                        pc += 2;
-                };
+                        byte = self.read_byte(address);
+                });
         }
 
-        template <class Operation>
-        Instruction indirect_x(Operation operation) // Indexed indirect
+        static bool native_write_absolute(void* context, Address address, Byte byte) noexcept
         {
-                return [this, operation]
-                {
-                        Address const zero_page_address = memory->read_byte(pc + 1);
-                        Address const pointer =
-                                memory->read_pointer(zero_page_address + x);
-                        execute_on_memory(operation, pointer);
-                        pc += 2;
-                };
+                return native_access(context, [&](Impl& self) {
+                        self.write_byte(self.fetched_absolute(address), byte);
+                });
         }
 
-        template <class Operation>
-        Instruction indirect_y(Operation operation) // Indirect indexed
+        template <Accuracy accuracy>
+        static bool native_write_indexed(void* context, Address base, Byte index, Byte byte) noexcept
         {
-                return [this, operation]
-                {
-                        auto const zero_page_address = memory->read_byte(pc + 1);
-                        Address const pointer =
-                                memory->read_pointer(zero_page_address) + y;
-                        execute_on_memory(operation, pointer);
-                        pc += 2;
+                return native_access(context, [&](Impl& self) {
+                        Address const address = self.fetched_absolute(base) + index;
+                        if constexpr (accuracy == Accuracy::bus)
+                                self.dummy_read(combine_bytes(low_byte(address), high_byte(base)));
+                        self.write_byte(address, byte);
+                });
+        }
+
+        template <Accuracy accuracy>
+        static constexpr Recompiled::Bus make_native_bus() noexcept
+        {
+                return {
+                        &native_read_zero_page,
+                        &native_write_zero_page,
+                        &native_read_absolute<accuracy>,
+                        &native_write_absolute,
+                        &native_write_indexed<accuracy>
                 };
         }
 
+        static std::array<Recompiled::Bus, 2> const native_buses;
+
+#ifdef EMULATOR_JIT
+
+        void note_execution(Block& block)
+        {
+                if (&block == &uncached_block || block.recompiled ||
+                    ++block.executions != hot_block_executions)
+                        return;
+
+                // I/O is left to the interpreter's steps.
+                std::vector<Jit::Instruction> instructions;
+                Address address = block.address;
+                for (auto const& decoded : block.instructions) {
+                        instructions.push_back({
+                                .address = address,
+                                .opcode = decoded.opcode,
+                                .operand = decoded.operand,
+                                .cycles = decoded.cycles,
+                                .step = steps[decoded.opcode],
+                                .interpret = may_access_io(decoded.opcode, decoded.operand)
+                        });
+                        address += opcode_table[decoded.opcode].length;
+                }
+                if (!jit)
+                        jit = std::make_unique<Jit>();
+                jit->compile_later(block.address, block.serial, std::move(instructions));
+        }
+
+        /**
+         * Compiled code is only used if its block hasn't been
+         * thrown away and decoded again in the meantime.
+         */
+        void install_compiled_blocks()
+        {
+                for (auto& compiled : jit->take_compiled()) {
+                        auto const i = blocks.find(compiled.address);
+                        if (i != blocks.end() && i->second.serial == compiled.serial)
+                                i->second.native = std::move(compiled.code);
+                }
+        }
+
+#endif
+
+        /**
+         * Whether the CPU can't have to stop anywhere in the block.
+         * Compiled code and superinstructions skip some instruction
+         * boundaries, so they're only used when that holds.
+         */
+        bool runs_to_end(Block const& block, std::size_t count, Cycles cycle_limit) const noexcept
+        {
+                return count >= block.instructions.size() &&
+                       cycle_limit - cycles > block.max_cycles;
+        }
+
+        Instructions const& instructions_to_run(Block const& block,
+                                                std::size_t count,
+                                                Cycles cycle_limit) const noexcept
+        {
+                if (block.superinstructions.empty() || !runs_to_end(block, count, cycle_limit))
+                        return block.instructions;
+                return block.superinstructions;
+        }
+
+        bool finished(std::size_t count, Cycles cycle_limit) const noexcept
+        {
+                return count == 0 || cycles >= cycle_limit || (events & stop_requested);
+        }
+
+        /**
+         * Whether the rest of the current block has to be skipped,
+         * because it was overwritten, because the CPU has to stop or
+         * because an interrupt has to be taken.
+         */
+        bool leaving_block() const noexcept
+        {
+                return events;
+        }
+
+        void stop(StopReason reason) noexcept
+        {
+                if (events & stop_requested)
+                        return;
+                events |= stop_requested;
+                stop_reason = reason;
+        }
+
+        StopReason take_stop_reason() noexcept
+        {
+                if (!(events & stop_requested))
+                        return StopReason::cycle_budget;
+                events &= ~stop_requested;
+                return stop_reason;
+        }
+
+        /**
+         * NMI goes pending when its line goes from released to asserted.
+         * IRQ is pending for as long as its line is asserted and I is
+         * clear, so it has to be checked again whenever either changes.
+         * Setting I doesn't bother: take_pending_interrupt checks I anyway.
+         */
+        void set_interrupt_line(Interrupt interrupt, InterruptSource source, bool asserted) noexcept
+        {
+                assert(interrupt != Interrupt::reset);
+                Byte& sources = interrupt == Interrupt::nmi ? nmi_sources : irq_sources;
+                Byte const was_asserted = sources;
+                sources = set_bit(sources, static_cast<unsigned>(source), asserted);
+                if (interrupt == Interrupt::nmi && !was_asserted && sources) {
+                        events |= nmi_pending;
+                        if (stops_at_interrupts)
+                                stop(StopReason::nmi);
+                }
+                update_irq_pending();
+        }
+
+        void update_irq_pending() noexcept
+        {
+                if (irq_sources && !stored_flags.test(interrupt_disable_flag)) {
+                        if (stops_at_interrupts && !(events & irq_pending))
+                                stop(StopReason::irq);
+                        events |= irq_pending;
+                } else {
+                        events &= ~irq_pending;
+                }
+        }
+
+        void take_pending_interrupt()
+        {
+                if (events & nmi_pending) {
+                        events &= ~nmi_pending;
+                        take_interrupt(Interrupt::nmi);
+                } else {
+                        events &= ~irq_pending;
+                        if (!stored_flags.test(interrupt_disable_flag))
+                                take_interrupt(Interrupt::irq);
+                }
+                idle_block = nullptr;
+        }
+
+        void take_interrupt(Interrupt interrupt)
+        {
+                note_call(interrupt_handler(interrupt));
+                stack_push_pointer(pc);
+                stack_push_byte(status());
+                stored_flags.set(interrupt_disable_flag);
+                load_interrupt_handler(interrupt);
+                cycles += interrupt_cycles;
+        }
+
+        template <class Integer>
+        void update_transfer_flags(Integer i) noexcept
+        {
+                zero_result = i;
+                negative_result = i;
+        }
+
+        /**
+         * Does what an opcode does with its operand. Only the operation
+         * comes from the dispatch table: the addressing mode, the
+         * length and the page crossing penalty come from the opcode
+         * table.
+         */
+        template <Accuracy accuracy, Byte opcode, auto operation>
+        static void instruction(Impl& self, Address operand)
+        {
+                constexpr Opcodes::OpcodeInfo info = opcode_table[opcode];
+                using Mode = AddressingMode;
+                self.count_execution(opcode);
+                if constexpr (info.mode == Mode::relative) {
+                        self.pc += info.length;
+                        if ((self.*operation)()) {
+                                self.count_taken_branch(opcode);
+                                Address const target =
+                                        self.pc + TwosComplement::encode(operand);
+                                self.cycles += 1 + crosses_page(self.pc, target);
+                                self.pc = target;
+                        }
+                } else if constexpr (info.jumps) {
+                        // JMP, JSR and friends take care of the
+                        // program counter on their own.
+                        if constexpr (info.mode == Mode::implied)
+                                (self.*operation)();
+                        else
+                                (self.*operation)(operand);
+                } else {
+                        if constexpr (info.mode == Mode::implied)
+                                (self.*operation)();
+                        else if constexpr (info.mode == Mode::accumulator)
+                                self.a = (self.*operation)(self.a);
+                        else if constexpr (info.mode == Mode::immediate)
+                                (self.*operation)(operand);
+                        else if constexpr (info.mode == Mode::zero_page)
+                                self.execute_on_low_ram(operation, Byte(operand));
+                        else if constexpr (info.mode == Mode::zero_page_x)
+                                self.execute_on_low_ram(operation, Byte(operand + self.x)); // Wraps around
+                        else if constexpr (info.mode == Mode::zero_page_y)
+                                self.execute_on_low_ram(operation, Byte(operand + self.y));
+                        else if constexpr (info.mode == Mode::absolute)
+                                self.execute_on_memory<accuracy>(operation, self.fetched_absolute(operand));
+                        else if constexpr (info.mode == Mode::absolute_x)
+                                self.execute_on_indexed<accuracy, info.page_cross_penalty>(
+                                        operation, self.fetched_absolute(operand), self.x);
+                        else if constexpr (info.mode == Mode::absolute_y)
+                                self.execute_on_indexed<accuracy, info.page_cross_penalty>(
+                                        operation, self.fetched_absolute(operand), self.y);
+                        else if constexpr (info.mode == Mode::indirect_x) // Indexed indirect
+                                self.execute_on_memory<accuracy>(operation, self.read_zero_page_pointer(operand + self.x));
+                        else if constexpr (info.mode == Mode::indirect_y) // Indirect indexed
+                                self.execute_on_indexed<accuracy, info.page_cross_penalty>(
+                                        operation, self.read_zero_page_pointer(operand), self.y);
+                        else
+                                static_assert(opcode != opcode, "Addressing mode without a handler");
+                        self.pc += info.length;
+                }
+        }
+
+        template <Accuracy accuracy, bool page_cross_penalty, class Operation>
+        void execute_on_indexed(Operation operation, Address base_address, Byte offset)
+        {
+                Address const address = base_address + offset;
+                bool const crossed = crosses_page(base_address, address);
+                if constexpr (page_cross_penalty)
+                        cycles += crossed;
+                if constexpr (accuracy == Accuracy::bus) {
+                        // The real CPU adds the index to the low byte
+                        // first, and reads from there while it fixes up
+                        // the high byte. Reads that stay on the page
+                        // skip that, everything else always does it.
+                        if (crossed || !page_cross_penalty)
+                                dummy_read(combine_bytes(low_byte(address), high_byte(base_address)));
+                }
+                execute_on_memory<accuracy>(operation, address);
+        }
+
+        /**
+         * The high byte of an absolute address is the last code byte
+         * the CPU fetches, so it's what's left on the bus when the
+         * address turns out to have nothing at it.
+         */
+        Address fetched_absolute(Address operand) noexcept
+        {
+                memory->drive_bus(high_byte(operand));
+                return operand;
+        }
+
+        void dummy_read(Address address)
+        {
+                read_byte(address);
+        }
+
+        /**
+         * Runs two instructions in one go. The first one never touches
+         * memory, so nothing can happen in between that would need the
+         * CPU to stop there. The second one is a branch, so neither
+         * differs between the accuracy tiers.
+         */
+        template <Byte first, Byte second>
+        static void fused(Impl& self, Address operands)
+        {
+                constexpr Instruction first_instruction = dispatch_tables[tier(Accuracy::fast)][first];
+                constexpr Instruction second_instruction = dispatch_tables[tier(Accuracy::fast)][second];
+                first_instruction(self, low_byte(operands));
+                second_instruction(self, high_byte(operands));
+        }
+
+        template <Byte first, Byte second>
+        static constexpr Superinstruction make_superinstruction()
+        {
+                return {first, second, &fused<first, second>};
+        }
+
+        static void unknown_opcode(Impl& self, Address)
+        {
+                throw UnknownOpcode(self.memory->peek(self.pc));
+        }
+
+        template <Accuracy>
         void execute_on_memory(Byte (Impl::*operation)(),
                                Address address)
         {
-                memory->write_byte(address, (this->*operation)());
+                write_byte(address, (this->*operation)());
         }
 
+        template <Accuracy>
         void execute_on_memory(void (Impl::*operation)(Byte operand),
                                Address address)
         {
-                auto const operand = memory->read_byte(address);
+                auto const operand = read_byte(address);
                 (this->*operation)(operand);
         }
 
+        template <Accuracy accuracy>
         void execute_on_memory(Byte (Impl::*operation)(Byte operand),
                                Address address)
         {
-                auto const operand = memory->read_byte(address);
-                memory->write_byte(address, (this->*operation)(operand));
+                auto const operand = read_byte(address);
+                if constexpr (accuracy == Accuracy::bus)
+                        write_byte(address, operand); // While the ALU works on it
+                write_byte(address, (this->*operation)(operand));
         }
 
-        void update_zero_flag(int result) noexcept
+        void execute_on_low_ram(Byte (Impl::*operation)(),
+                                Address address)
         {
-                p.set(zero_flag, result == 0);
+                write_low_ram(address, (this->*operation)());
         }
 
-        void update_overflow_flag(int signed_result) noexcept
+        void execute_on_low_ram(void (Impl::*operation)(Byte operand),
+                                Address address)
         {
-                p.set(overflow_flag,
-                      signed_result < signed_byte_min ||
-                      signed_result > signed_byte_max);
+                auto const operand = read_low_ram(address);
+                (this->*operation)(operand);
         }
 
-        void update_negative_flag(unsigned result) noexcept
+        void execute_on_low_ram(Byte (Impl::*operation)(Byte operand),
+                                Address address)
         {
-                p.set(negative_flag, get_bit(result, sign_bit));
-        } 
+                auto const operand = read_low_ram(address);
+                write_low_ram(address, (this->*operation)(operand));
+        }
+
+        bool carry() const noexcept
+        {
+                return carry_result >> Alu::carry_bit & 1;
+        }
+
+        bool zero() const noexcept
+        {
+                return zero_result == 0;
+        }
+
+        bool overflow() const noexcept
+        {
+                return overflow_result >> sign_bit & 1;
+        }
+
+        bool negative() const noexcept
+        {
+                return negative_result >> sign_bit & 1;
+        }
+
+        /**
+         * The status register as the program sees it, with
+         * the lazy flags worked out.
+         */
+        Byte status() const noexcept
+        {
+                ByteBitset result = stored_flags;
+                result.set(carry_flag, carry());
+                result.set(zero_flag, zero());
+                result.set(overflow_flag, overflow());
+                result.set(negative_flag, negative());
+                return result.to_ulong();
+        }
+
+        void set_status(Byte status) noexcept
+        {
+                ByteBitset const bits = status;
+                stored_flags = status & ~lazy_flags_mask;
+                carry_result = bits.test(carry_flag) << Alu::carry_bit;
+                zero_result = !bits.test(zero_flag);
+                overflow_result = bits.test(overflow_flag) << sign_bit;
+                negative_result = bits.test(negative_flag) << sign_bit;
+                update_irq_pending();
+        }
 
         bool bcs() const noexcept
         {
-                return p.test(carry_flag);
+                return carry();
         }
 
         bool bcc() const noexcept
@@ -356,7 +1431,7 @@ struct CPU::Impl {
 
         bool beq() const noexcept
         {
-                return p.test(zero_flag);
+                return zero();
         }
 
         bool bne() const noexcept
@@ -366,7 +1441,7 @@ struct CPU::Impl {
 
         bool bmi() const noexcept
         {
-                return p.test(negative_flag);
+                return negative();
         }
 
         bool bpl() const noexcept
@@ -376,7 +1451,7 @@ struct CPU::Impl {
 
         bool bvs() const noexcept
         {
-                return p.test(overflow_flag);
+                return overflow();
         }
 
         bool bvc() const noexcept
@@ -392,24 +1467,16 @@ struct CPU::Impl {
 
         void adc(Byte operand) noexcept
         {
-                int const signed_result = TwosComplement::encode(a) +
-                                          TwosComplement::encode(operand) +
-                                          p.test(carry_flag);
-                auto const result = TwosComplement::decode(signed_result);
-                p.set(carry_flag, a > result);
-                update_overflow_flag(signed_result);
+                Alu::Result const result = add(a, operand, carry());
+                carry_result = result;
+                overflow_result = result >> (Alu::overflow_bit - sign_bit);
                 transfer(a, result);
         }
 
         void sbc(Byte operand) noexcept
         {
-                int const signed_result = TwosComplement::encode(a) -
-                                          TwosComplement::encode(operand) -
-                                          !p.test(carry_flag);
-                Byte const result = TwosComplement::decode(signed_result);
-                p.set(carry_flag, operand <= a);
-                update_overflow_flag(signed_result);
-                transfer(a, result);
+                // A - M - (1 - C) == A + ~M + C
+                adc(~operand);
         }
 
         void bitwise_and(Byte operand) noexcept
@@ -417,42 +1484,52 @@ struct CPU::Impl {
                 transfer(a, a & operand);
         }
 
-        Byte asl(Byte operand) noexcept
+        Byte shift_result(Alu::Result result) noexcept
         {
-                Byte const result = operand << 1;
-                p.set(carry_flag, get_bit(operand, sign_bit));
-                update_transfer_flags(result);
+                carry_result = result;
+                update_transfer_flags(Byte(result));
                 return result;
         }
 
+        Byte asl(Byte operand) noexcept
+        {
+                return shift_result(shift_left(operand, false));
+        }
+
         void bit(Byte operand) noexcept
         {
-                ByteBitset const operand_bits = operand;
-                p.set(negative_flag, operand_bits.test(negative_flag));
-                p.set(overflow_flag, operand_bits.test(overflow_flag));
-                update_zero_flag(a & operand);
+                negative_result = operand;
+                overflow_result = operand << 1;
+                zero_result = a & operand;
         }
 
         void clc() noexcept
         {
-                p.set(carry_flag, false);
+                carry_result = 0;
+        }
+
+        void cld() noexcept
+        {
+                stored_flags.set(decimal_flag, false);
         }
 
         void cli() noexcept
         {
-                p.set(interrupt_disable_flag, false);
+                stored_flags.set(interrupt_disable_flag, false);
+                update_irq_pending();
         }
 
         void clv() noexcept
         {
-                p.set(overflow_flag, false);
+                overflow_result = 0;
         }
 
         void compare(Byte reg, Byte operand) noexcept
         {
-                int const result = reg - operand;
-                p.set(carry_flag, result >= 0);
-                update_transfer_flags(result);
+                // Like SBC with no borrow, but without touching A or V.
+                Alu::Result const result = add(reg, ~operand, true);
+                carry_result = result;
+                update_transfer_flags(Byte(result));
         }
 
         void cmp(Byte operand) noexcept
@@ -509,20 +1586,26 @@ struct CPU::Impl {
                 y = inc(y);
         }
 
-        void absolute_jmp() noexcept
+        void absolute_jmp(Address target) noexcept
         {
-                pc = memory->read_pointer(pc + 1);
+                pc = target;
         }
 
-        void indirect_jmp() noexcept
+        /**
+         * Like on the real thing, a pointer at the end of a page gets
+         * its high byte from the start of the same page.
+         */
+        void indirect_jmp(Address pointer)
         {
-                pc = deref_pointer(*memory, pc + 1);
+                Address const high_address = combine_bytes(low_byte(pointer) + 1, high_byte(pointer));
+                pc = combine_bytes(read_byte(pointer), read_byte(high_address));
         }
 
-        void absolute_jsr() noexcept
+        void absolute_jsr(Address target)
         {
+                note_call(target);
                 stack_push_pointer(pc + 2);
-                pc = memory->read_pointer(pc + 1);
+                pc = target;
         }
 
         void lda(Byte operand) noexcept
@@ -542,10 +1625,7 @@ struct CPU::Impl {
 
         Byte lsr(Byte operand) noexcept
         {
-                Byte const result = operand >> 1;
-                p.set(carry_flag, get_bit(operand, 0));
-                update_transfer_flags(result);
-                return result;
+                return shift_result(shift_right(operand, false));
         }
 
         void nop() noexcept
@@ -563,7 +1643,7 @@ struct CPU::Impl {
 
         void php() noexcept
         {
-                stack_push_byte(p.to_ulong());
+                stack_push_byte(status());
         }
 
         void pla() noexcept
@@ -573,73 +1653,73 @@ struct CPU::Impl {
 
         void plp() noexcept
         {
-                p = stack_pull_byte();
-                p.set(unused_flag);
+                set_status(stack_pull_byte());
+                stored_flags.set(break_flag, false);
+                stored_flags.set(unused_flag);
         }
 
         Byte rol(Byte operand) noexcept
         {
-                Byte const result =
-                [&] {
-                        ByteBitset bits(operand);
-                        bits <<= 1;
-                        bits.set(0, p.test(carry_flag));
-                        return bits.to_ulong();
-                }();
-
-                p.set(carry_flag, get_bit(operand, sign_bit));
-                update_transfer_flags(result);
-                return result;
+                return shift_result(shift_left(operand, carry()));
         }
 
         Byte ror(Byte operand) noexcept
         {
-                Byte const result =
-                [&] {
-                        ByteBitset bits(operand);
-                        bits >>= 1;
-                        bits.set(sign_bit, p.test(carry_flag));
-                        return bits.to_ulong();
-                }();
-
-                p.set(carry_flag, get_bit(operand, 0));
-                update_transfer_flags(result);
-                return result;
+                return shift_result(shift_right(operand, carry()));
         }
 
+        /**
+         * Unlike an IRQ, BRK isn't masked by I.
+         */
         void implied_brk()
         {
-                if (p.test(interrupt_disable_flag))
-                        return;
-
+                note_call(interrupt_handler(Interrupt::irq));
                 stack_push_pointer(pc + 2);
-                p.set(break_flag);
-                stack_push_byte(p.to_ulong());
-                p.set(break_flag, false);
-                p.set(interrupt_disable_flag);
+                stack_push_byte(status() | 1 << break_flag);
+                stored_flags.set(interrupt_disable_flag);
                 load_interrupt_handler(Interrupt::irq);
         }
 
-        void rti() noexcept
+        void implied_rti()
         {
-                p = stack_pull_byte();
-                p.set(break_flag, false);
+                set_status(stack_pull_byte());
+                stored_flags.set(break_flag, false);
+                stored_flags.set(unused_flag);
                 pc = stack_pull_pointer();
+                note_return();
         }
 
-        void implied_rts() noexcept
+        void implied_rts()
         {
                 pc = stack_pull_pointer() + 1;
+                note_return();
+        }
+
+        void note_call(Address target)
+        {
+                if (call_observer)
+                        call_observer->called(target, sp);
+        }
+
+        void note_return()
+        {
+                if (call_observer)
+                        call_observer->returned(sp);
         }
 
         void sec() noexcept
         {
-                p.set(carry_flag);
+                carry_result = 1 << Alu::carry_bit;
+        }
+
+        void sed() noexcept
+        {
+                stored_flags.set(decimal_flag);
         }
 
         void sei() noexcept
         {
-                p.set(interrupt_disable_flag);
+                stored_flags.set(interrupt_disable_flag);
         }
 
         Byte sta() noexcept
@@ -677,9 +1757,12 @@ struct CPU::Impl {
                 transfer(a, x);
         }
 
+        /**
+         * The only transfer that leaves the flags alone.
+         */
         void txs() noexcept
         {
-                transfer(sp, x);
+                sp = x;
         }
 
         void tya() noexcept
@@ -687,182 +1770,521 @@ struct CPU::Impl {
                 transfer(a, y);
         }
 
-        Instruction translate_opcode(Byte opcode)
-        {
-                auto const mem_f = [&](auto const& f)
-                {
-                        return [this, f](auto&&... params)
-                        {
-                                return (this->*f)(
-                                        std::forward<decltype(params)>(params)...);
-                        };
+        template <Accuracy accuracy>
+        static constexpr DispatchTable make_dispatch_table()
+        {
+                DispatchTable table {};
+                for (auto& instruction : table)
+                        instruction = &unknown_opcode;
+
+                table[0x00] = &instruction<accuracy, 0x00, &Impl::implied_brk>;
+                table[0x01] = &instruction<accuracy, 0x01, &Impl::ora>;
+                table[0x05] = &instruction<accuracy, 0x05, &Impl::ora>;
+                table[0x06] = &instruction<accuracy, 0x06, &Impl::asl>;
+                table[0x08] = &instruction<accuracy, 0x08, &Impl::php>;
+                table[0x09] = &instruction<accuracy, 0x09, &Impl::ora>;
+                table[0x0A] = &instruction<accuracy, 0x0A, &Impl::asl>;
+                table[0x0D] = &instruction<accuracy, 0x0D, &Impl::ora>;
+                table[0x0E] = &instruction<accuracy, 0x0E, &Impl::asl>;
+                table[0x10] = &instruction<accuracy, 0x10, &Impl::bpl>;
+                table[0x11] = &instruction<accuracy, 0x11, &Impl::ora>;
+                table[0x15] = &instruction<accuracy, 0x15, &Impl::ora>;
+                table[0x16] = &instruction<accuracy, 0x16, &Impl::asl>;
+                table[0x18] = &instruction<accuracy, 0x18, &Impl::clc>;
+                table[0x19] = &instruction<accuracy, 0x19, &Impl::ora>;
+                table[0x1D] = &instruction<accuracy, 0x1D, &Impl::ora>;
+                table[0x1E] = &instruction<accuracy, 0x1E, &Impl::asl>;
+                table[0x20] = &instruction<accuracy, 0x20, &Impl::absolute_jsr>;
+                table[0x21] = &instruction<accuracy, 0x21, &Impl::bitwise_and>;
+                table[0x24] = &instruction<accuracy, 0x24, &Impl::bit>;
+                table[0x25] = &instruction<accuracy, 0x25, &Impl::bitwise_and>;
+                table[0x26] = &instruction<accuracy, 0x26, &Impl::rol>;
+                table[0x28] = &instruction<accuracy, 0x28, &Impl::plp>;
+                table[0x29] = &instruction<accuracy, 0x29, &Impl::bitwise_and>;
+                table[0x2A] = &instruction<accuracy, 0x2A, &Impl::rol>;
+                table[0x2C] = &instruction<accuracy, 0x2C, &Impl::bit>;
+                table[0x2D] = &instruction<accuracy, 0x2D, &Impl::bitwise_and>;
+                table[0x2E] = &instruction<accuracy, 0x2E, &Impl::rol>;
+                table[0x30] = &instruction<accuracy, 0x30, &Impl::bmi>;
+                table[0x31] = &instruction<accuracy, 0x31, &Impl::bitwise_and>;
+                table[0x35] = &instruction<accuracy, 0x35, &Impl::bitwise_and>;
+                table[0x36] = &instruction<accuracy, 0x36, &Impl::rol>;
+                table[0x38] = &instruction<accuracy, 0x38, &Impl::sec>;
+                table[0x39] = &instruction<accuracy, 0x39, &Impl::bitwise_and>;
+                table[0x3D] = &instruction<accuracy, 0x3D, &Impl::bitwise_and>;
+                table[0x3E] = &instruction<accuracy, 0x3E, &Impl::rol>;
+                table[0x40] = &instruction<accuracy, 0x40, &Impl::implied_rti>;
+                table[0x41] = &instruction<accuracy, 0x41, &Impl::eor>;
+                table[0x45] = &instruction<accuracy, 0x45, &Impl::eor>;
+                table[0x46] = &instruction<accuracy, 0x46, &Impl::lsr>;
+                table[0x48] = &instruction<accuracy, 0x48, &Impl::pha>;
+                table[0x49] = &instruction<accuracy, 0x49, &Impl::eor>;
+                table[0x4A] = &instruction<accuracy, 0x4A, &Impl::lsr>;
+                table[0x4C] = &instruction<accuracy, 0x4C, &Impl::absolute_jmp>;
+                table[0x4D] = &instruction<accuracy, 0x4D, &Impl::eor>;
+                table[0x4E] = &instruction<accuracy, 0x4E, &Impl::lsr>;
+                table[0x50] = &instruction<accuracy, 0x50, &Impl::bvc>;
+                table[0x51] = &instruction<accuracy, 0x51, &Impl::eor>;
+                table[0x55] = &instruction<accuracy, 0x55, &Impl::eor>;
+                table[0x56] = &instruction<accuracy, 0x56, &Impl::lsr>;
+                table[0x58] = &instruction<accuracy, 0x58, &Impl::cli>;
+                table[0x59] = &instruction<accuracy, 0x59, &Impl::eor>;
+                table[0x5D] = &instruction<accuracy, 0x5D, &Impl::eor>;
+                table[0x5E] = &instruction<accuracy, 0x5E, &Impl::lsr>;
+                table[0x60] = &instruction<accuracy, 0x60, &Impl::implied_rts>;
+                table[0x61] = &instruction<accuracy, 0x61, &Impl::adc>;
+                table[0x65] = &instruction<accuracy, 0x65, &Impl::adc>;
+                table[0x66] = &instruction<accuracy, 0x66, &Impl::ror>;
+                table[0x68] = &instruction<accuracy, 0x68, &Impl::pla>;
+                table[0x69] = &instruction<accuracy, 0x69, &Impl::adc>;
+                table[0x6A] = &instruction<accuracy, 0x6A, &Impl::ror>;
+                table[0x6C] = &instruction<accuracy, 0x6C, &Impl::indirect_jmp>;
+                table[0x6D] = &instruction<accuracy, 0x6D, &Impl::adc>;
+                table[0x6E] = &instruction<accuracy, 0x6E, &Impl::ror>;
+                table[0x70] = &instruction<accuracy, 0x70, &Impl::bvs>;
+                table[0x71] = &instruction<accuracy, 0x71, &Impl::adc>;
+                table[0x75] = &instruction<accuracy, 0x75, &Impl::adc>;
+                table[0x76] = &instruction<accuracy, 0x76, &Impl::ror>;
+                table[0x78] = &instruction<accuracy, 0x78, &Impl::sei>;
+                table[0x79] = &instruction<accuracy, 0x79, &Impl::adc>;
+                table[0x7D] = &instruction<accuracy, 0x7D, &Impl::adc>;
+                table[0x7E] = &instruction<accuracy, 0x7E, &Impl::ror>;
+                table[0x81] = &instruction<accuracy, 0x81, &Impl::sta>;
+                table[0x84] = &instruction<accuracy, 0x84, &Impl::sty>;
+                table[0x85] = &instruction<accuracy, 0x85, &Impl::sta>;
+                table[0x86] = &instruction<accuracy, 0x86, &Impl::stx>;
+                table[0x88] = &instruction<accuracy, 0x88, &Impl::dey>;
+                table[0x8A] = &instruction<accuracy, 0x8A, &Impl::txa>;
+                table[0x8C] = &instruction<accuracy, 0x8C, &Impl::sty>;
+                table[0x8D] = &instruction<accuracy, 0x8D, &Impl::sta>;
+                table[0x8E] = &instruction<accuracy, 0x8E, &Impl::stx>;
+                table[0x90] = &instruction<accuracy, 0x90, &Impl::bcc>;
+                table[0x91] = &instruction<accuracy, 0x91, &Impl::sta>;
+                table[0x94] = &instruction<accuracy, 0x94, &Impl::sty>;
+                table[0x95] = &instruction<accuracy, 0x95, &Impl::sta>;
+                table[0x96] = &instruction<accuracy, 0x96, &Impl::stx>;
+                table[0x98] = &instruction<accuracy, 0x98, &Impl::tya>;
+                table[0x99] = &instruction<accuracy, 0x99, &Impl::sta>;
+                table[0x9A] = &instruction<accuracy, 0x9A, &Impl::txs>;
+                table[0x9D] = &instruction<accuracy, 0x9D, &Impl::sta>;
+                table[0xA0] = &instruction<accuracy, 0xA0, &Impl::ldy>;
+                table[0xA1] = &instruction<accuracy, 0xA1, &Impl::lda>;
+                table[0xA2] = &instruction<accuracy, 0xA2, &Impl::ldx>;
+                table[0xA4] = &instruction<accuracy, 0xA4, &Impl::ldy>;
+                table[0xA5] = &instruction<accuracy, 0xA5, &Impl::lda>;
+                table[0xA6] = &instruction<accuracy, 0xA6, &Impl::ldx>;
+                table[0xA8] = &instruction<accuracy, 0xA8, &Impl::tay>;
+                table[0xA9] = &instruction<accuracy, 0xA9, &Impl::lda>;
+                table[0xAA] = &instruction<accuracy, 0xAA, &Impl::tax>;
+                table[0xAC] = &instruction<accuracy, 0xAC, &Impl::ldy>;
+                table[0xAD] = &instruction<accuracy, 0xAD, &Impl::lda>;
+                table[0xAE] = &instruction<accuracy, 0xAE, &Impl::ldx>;
+                table[0xB0] = &instruction<accuracy, 0xB0, &Impl::bcs>;
+                table[0xB1] = &instruction<accuracy, 0xB1, &Impl::lda>;
+                table[0xB4] = &instruction<accuracy, 0xB4, &Impl::ldy>;
+                table[0xB5] = &instruction<accuracy, 0xB5, &Impl::lda>;
+                table[0xB6] = &instruction<accuracy, 0xB6, &Impl::ldx>;
+                table[0xB8] = &instruction<accuracy, 0xB8, &Impl::clv>;
+                table[0xB9] = &instruction<accuracy, 0xB9, &Impl::lda>;
+                table[0xBA] = &instruction<accuracy, 0xBA, &Impl::tsx>;
+                table[0xBC] = &instruction<accuracy, 0xBC, &Impl::ldy>;
+                table[0xBD] = &instruction<accuracy, 0xBD, &Impl::lda>;
+                table[0xBE] = &instruction<accuracy, 0xBE, &Impl::ldx>;
+                table[0xC0] = &instruction<accuracy, 0xC0, &Impl::cpy>;
+                table[0xC1] = &instruction<accuracy, 0xC1, &Impl::cmp>;
+                table[0xC4] = &instruction<accuracy, 0xC4, &Impl::cpy>;
+                table[0xC5] = &instruction<accuracy, 0xC5, &Impl::cmp>;
+                table[0xC6] = &instruction<accuracy, 0xC6, &Impl::dec>;
+                table[0xC8] = &instruction<accuracy, 0xC8, &Impl::iny>;
+                table[0xC9] = &instruction<accuracy, 0xC9, &Impl::cmp>;
+                table[0xCA] = &instruction<accuracy, 0xCA, &Impl::dex>;
+                table[0xCC] = &instruction<accuracy, 0xCC, &Impl::cpy>;
+                table[0xCD] = &instruction<accuracy, 0xCD, &Impl::cmp>;
+                table[0xCE] = &instruction<accuracy, 0xCE, &Impl::dec>;
+                table[0xD0] = &instruction<accuracy, 0xD0, &Impl::bne>;
+                table[0xD1] = &instruction<accuracy, 0xD1, &Impl::cmp>;
+                table[0xD5] = &instruction<accuracy, 0xD5, &Impl::cmp>;
+                table[0xD6] = &instruction<accuracy, 0xD6, &Impl::dec>;
+                table[0xD8] = &instruction<accuracy, 0xD8, &Impl::cld>;
+                table[0xD9] = &instruction<accuracy, 0xD9, &Impl::cmp>;
+                table[0xDD] = &instruction<accuracy, 0xDD, &Impl::cmp>;
+                table[0xDE] = &instruction<accuracy, 0xDE, &Impl::dec>;
+                table[0xE0] = &instruction<accuracy, 0xE0, &Impl::cpx>;
+                table[0xE1] = &instruction<accuracy, 0xE1, &Impl::sbc>;
+                table[0xE4] = &instruction<accuracy, 0xE4, &Impl::cpx>;
+                table[0xE5] = &instruction<accuracy, 0xE5, &Impl::sbc>;
+                table[0xE6] = &instruction<accuracy, 0xE6, &Impl::inc>;
+                table[0xE8] = &instruction<accuracy, 0xE8, &Impl::inx>;
+                table[0xE9] = &instruction<accuracy, 0xE9, &Impl::sbc>;
+                table[0xEA] = &instruction<accuracy, 0xEA, &Impl::nop>;
+                table[0xEC] = &instruction<accuracy, 0xEC, &Impl::cpx>;
+                table[0xED] = &instruction<accuracy, 0xED, &Impl::sbc>;
+                table[0xEE] = &instruction<accuracy, 0xEE, &Impl::inc>;
+                table[0xF0] = &instruction<accuracy, 0xF0, &Impl::beq>;
+                table[0xF1] = &instruction<accuracy, 0xF1, &Impl::sbc>;
+                table[0xF5] = &instruction<accuracy, 0xF5, &Impl::sbc>;
+                table[0xF6] = &instruction<accuracy, 0xF6, &Impl::inc>;
+                table[0xF8] = &instruction<accuracy, 0xF8, &Impl::sed>;
+                table[0xF9] = &instruction<accuracy, 0xF9, &Impl::sbc>;
+                table[0xFD] = &instruction<accuracy, 0xFD, &Impl::sbc>;
+                table[0xFE] = &instruction<accuracy, 0xFE, &Impl::inc>;
+
+                return table;
+        }
+
+        static std::array<DispatchTable, 2> const dispatch_tables; // By tier
+        static std::array<Superinstruction, 7> const superinstructions;
+
+        Cycles execute(std::size_t count, Cycles cycle_limit);
+        Cycles execute_stepping(std::size_t count, Cycles cycle_limit);
+
+        /**
+         * Tracing and debugging need every instruction on its own. That's
+         * decided once per run, so the other run loops don't check for it.
+         */
+        bool needs_stepping() const noexcept
+        {
+                return trace || (debugger && !debugger->empty());
+        }
+
+        /**
+         * Whether the debugger wants the CPU to stop before the
+         * instruction at pc.
+         */
+        bool stops_for_debugger(DecodedInstruction const& decoded)
+        {
+                using Access = Debugger::Access;
+                Debugger::Registers const registers {pc, a, x, y, status(), sp};
+                if (debugger->breaks_at(registers))
+                        return true;
+                if (!debugger->has_watchpoints())
+                        return false;
+
+                auto const watches = [&](Address address, Access access) {
+                        return debugger->watches(address, access, registers);
                 };
+                auto const access = opcode_table[decoded.opcode].access;
+                if (auto const address = operand_address(decoded)) {
+                        bool const reads = access == MemoryAccess::read ||
+                                           access == MemoryAccess::read_modify_write;
+                        bool const writes = access == MemoryAccess::write ||
+                                            access == MemoryAccess::read_modify_write;
+                        if ((reads && watches(*address, Access::read)) ||
+                            (writes && watches(*address, Access::write)))
+                                return true;
+                }
 
-                switch (opcode) {
-                        case 0x00: return mem_f(&Impl::implied_brk);
-                        case 0x01: return indirect_x(&Impl::ora);
-                        case 0x05: return zero_page(&Impl::ora);
-                        case 0x06: return zero_page(&Impl::asl);
-                        case 0x08: return implied(&Impl::php);
-                        case 0x09: return immediate(&Impl::ora);
-                        case 0x0A: return accumulator(&Impl::asl);
-                        case 0x0D: return absolute(&Impl::ora);
-                        case 0x0E: return absolute(&Impl::asl);
-                        case 0x10: return relative(&Impl::bpl);
-                        case 0x11: return indirect_y(&Impl::ora);
-                        case 0x15: return zero_page_x(&Impl::ora);
-                        case 0x16: return zero_page_x(&Impl::asl);
-                        case 0x18: return implied(&Impl::clc);
-                        case 0x19: return absolute_y(&Impl::ora);
-                        case 0x1D: return absolute_x(&Impl::ora);
-                        case 0x1E: return absolute_x(&Impl::asl);
-                        case 0x20: return mem_f(&Impl::absolute_jsr);
-                        case 0x21: return indirect_x(&Impl::bitwise_and);
-                        case 0x24: return zero_page(&Impl::bit);
-                        case 0x25: return zero_page(&Impl::bitwise_and);
-                        case 0x26: return zero_page(&Impl::rol);
-                        case 0x28: return implied(&Impl::plp);
-                        case 0x29: return immediate(&Impl::bitwise_and);
-                        case 0x2A: return accumulator(&Impl::rol);
-                        case 0x2C: return absolute(&Impl::bit);
-                        case 0x2D: return absolute(&Impl::bitwise_and);
-                        case 0x2E: return absolute(&Impl::rol);
-                        case 0x30: return relative(&Impl::bmi);
-                        case 0x31: return indirect_y(&Impl::bitwise_and);
-                        case 0x35: return zero_page_x(&Impl::bitwise_and);
-                        case 0x36: return zero_page_x(&Impl::rol);
-                        case 0x38: return implied(&Impl::sec);
-                        case 0x39: return absolute_y(&Impl::bitwise_and);
-                        case 0x3D: return absolute_x(&Impl::bitwise_and);
-                        case 0x3E: return absolute_x(&Impl::rol);
-                        case 0x40: return implied(&Impl::rti);
-                        case 0x41: return indirect_x(&Impl::eor);
-                        case 0x45: return zero_page(&Impl::eor);
-                        case 0x46: return zero_page(&Impl::lsr);
-                        case 0x48: return implied(&Impl::pha);
-                        case 0x49: return immediate(&Impl::eor);
-                        case 0x4A: return accumulator(&Impl::lsr);
-                        case 0x4C: return mem_f(&Impl::absolute_jmp);
-                        case 0x4D: return absolute(&Impl::eor);
-                        case 0x4E: return absolute(&Impl::lsr);
-                        case 0x50: return relative(&Impl::bvc);
-                        case 0x51: return indirect_y(&Impl::eor);
-                        case 0x55: return zero_page_x(&Impl::eor);
-                        case 0x56: return zero_page_x(&Impl::lsr);
-                        case 0x58: return implied(&Impl::cli);
-                        case 0x59: return absolute_y(&Impl::eor);
-                        case 0x5D: return absolute_x(&Impl::eor);
-                        case 0x5E: return absolute_x(&Impl::lsr);
-                        case 0x60: return mem_f(&Impl::implied_rts);
-                        case 0x61: return indirect_x(&Impl::adc);
-                        case 0x65: return zero_page(&Impl::adc);
-                        case 0x66: return zero_page(&Impl::ror);
-                        case 0x68: return implied(&Impl::pla);
-                        case 0x69: return immediate(&Impl::adc);
-                        case 0x6A: return accumulator(&Impl::ror);
-                        case 0x6C: return mem_f(&Impl::indirect_jmp);
-                        case 0x6D: return absolute(&Impl::adc);
-                        case 0x6E: return absolute(&Impl::ror);
-                        case 0x70: return relative(&Impl::bvs);
-                        case 0x71: return indirect_y(&Impl::adc);
-                        case 0x75: return zero_page_x(&Impl::adc);
-                        case 0x76: return zero_page_x(&Impl::ror);
-                        case 0x78: return implied(&Impl::sei);
-                        case 0x79: return absolute_y(&Impl::adc);
-                        case 0x7D: return absolute_x(&Impl::adc);
-                        case 0x7E: return absolute_x(&Impl::ror);
-                        case 0x81: return indirect_x(&Impl::sta);
-                        case 0x84: return zero_page(&Impl::sty);
-                        case 0x85: return zero_page(&Impl::sta);
-                        case 0x86: return zero_page(&Impl::stx);
-                        case 0x88: return implied(&Impl::dey);
-                        case 0x8A: return implied(&Impl::txa);
-                        case 0x8C: return absolute(&Impl::sty);
-                        case 0x8D: return absolute(&Impl::sta);
-                        case 0x8E: return absolute(&Impl::stx);
-                        case 0x90: return relative(&Impl::bcc);
-                        case 0x91: return indirect_y(&Impl::sta);
-                        case 0x94: return zero_page_x(&Impl::sty);
-                        case 0x95: return zero_page_x(&Impl::sta);
-                        case 0x96: return zero_page_y(&Impl::stx);
-                        case 0x98: return implied(&Impl::tya);
-                        case 0x99: return absolute_y(&Impl::sta);
-                        case 0x9A: return implied(&Impl::txs);
-                        case 0x9D: return absolute_x(&Impl::sta);
-                        case 0xA0: return immediate(&Impl::ldy);
-                        case 0xA1: return indirect_x(&Impl::lda);
-                        case 0xA2: return immediate(&Impl::ldx);
-                        case 0xA4: return zero_page(&Impl::ldy);
-                        case 0xA5: return zero_page(&Impl::lda);
-                        case 0xA6: return zero_page(&Impl::ldx);
-                        case 0xA8: return implied(&Impl::tay);
-                        case 0xA9: return immediate(&Impl::lda);
-                        case 0xAA: return implied(&Impl::tax);
-                        case 0xAC: return absolute(&Impl::ldy);
-                        case 0xAD: return absolute(&Impl::lda);
-                        case 0xAE: return absolute(&Impl::ldx);
-                        case 0xB0: return relative(&Impl::bcs);
-                        case 0xB1: return indirect_y(&Impl::lda);
-                        case 0xB4: return zero_page_x(&Impl::ldy);
-                        case 0xB5: return zero_page_x(&Impl::lda);
-                        case 0xB6: return zero_page_y(&Impl::ldx);
-                        case 0xB8: return implied(&Impl::clv);
-                        case 0xB9: return absolute_y(&Impl::lda);
-                        case 0xBA: return implied(&Impl::tsx);
-                        case 0xBC: return absolute_x(&Impl::ldy);
-                        case 0xBD: return absolute_x(&Impl::lda);
-                        case 0xBE: return absolute_y(&Impl::ldx);
-                        case 0xC0: return immediate(&Impl::cpy);
-                        case 0xC1: return indirect_x(&Impl::cmp);
-                        case 0xC4: return zero_page(&Impl::cpy);
-                        case 0xC5: return zero_page(&Impl::cmp);
-                        case 0xC6: return zero_page(&Impl::dec);
-                        case 0xC8: return implied(&Impl::iny);
-                        case 0xC9: return immediate(&Impl::cmp);
-                        case 0xCA: return implied(&Impl::dex);
-                        case 0xCC: return absolute(&Impl::cpy);
-                        case 0xCD: return absolute(&Impl::cmp);
-                        case 0xCE: return absolute(&Impl::dec);
-                        case 0xD0: return relative(&Impl::bne);
-                        case 0xD1: return indirect_y(&Impl::cmp);
-                        case 0xD5: return zero_page_x(&Impl::cmp);
-                        case 0xD6: return zero_page_x(&Impl::dec);
-                        case 0xD9: return absolute_y(&Impl::cmp);
-                        case 0xDD: return absolute_x(&Impl::cmp);
-                        case 0xDE: return absolute_x(&Impl::dec);
-                        case 0xE0: return immediate(&Impl::cpx);
-                        case 0xE1: return indirect_x(&Impl::sbc);
-                        case 0xE4: return zero_page(&Impl::cpx);
-                        case 0xE5: return zero_page(&Impl::sbc);
-                        case 0xE6: return zero_page(&Impl::inc);
-                        case 0xE8: return implied(&Impl::inx);
-                        case 0xE9: return immediate(&Impl::sbc);
-                        case 0xEA: return implied(&Impl::nop);
-                        case 0xEC: return absolute(&Impl::cpx);
-                        case 0xED: return absolute(&Impl::sbc);
-                        case 0xEE: return absolute(&Impl::inc);
-                        case 0xF0: return relative(&Impl::beq);
-                        case 0xF1: return indirect_y(&Impl::sbc);
-                        case 0xF5: return zero_page_x(&Impl::sbc);
-                        case 0xF6: return zero_page_x(&Impl::inc);
-                        case 0xF9: return absolute_y(&Impl::sbc);
-                        case 0xFD: return absolute_x(&Impl::sbc);
-                        case 0xFE: return absolute_x(&Impl::inc);
-                        default: throw UnknownOpcode(opcode);
+                auto const [pushes, pulls] = stack_accesses(decoded.opcode);
+                for (unsigned i = 0; i < pushes; ++i) {
+                        if (watches(stack_address(sp - i), Access::write))
+                                return true;
+                }
+                for (unsigned i = 1; i <= pulls; ++i) {
+                        if (watches(stack_address(sp + i), Access::read))
+                                return true;
+                }
+                return false;
+        }
+
+        /**
+         * Where the operand of an instruction is in memory, worked out
+         * without accessing anything but the zero page.
+         */
+        std::optional<Address> operand_address(DecodedInstruction const& decoded)
+        {
+                Address const operand = decoded.operand;
+                switch (opcode_table[decoded.opcode].mode) {
+                        case AddressingMode::zero_page:   return Byte(operand);
+                        case AddressingMode::zero_page_x: return Byte(operand + x);
+                        case AddressingMode::zero_page_y: return Byte(operand + y);
+                        case AddressingMode::absolute:    return operand;
+                        case AddressingMode::absolute_x:  return Address(operand + x);
+                        case AddressingMode::absolute_y:  return Address(operand + y);
+                        case AddressingMode::indirect_x:  return peek_zero_page_pointer(operand + x);
+                        case AddressingMode::indirect_y:  return Address(peek_zero_page_pointer(operand) + y);
+                        default:                          return std::nullopt;
                 }
         }
 
+        /**
+         * Like read_zero_page_pointer, but the program isn't the one
+         * reading it, so it doesn't count.
+         */
+        Address peek_zero_page_pointer(Byte address)
+        {
+                auto const peek = [this](Byte at) {
+                        return zero_page_and_stack ? zero_page_and_stack[at] : memory->peek(at);
+                };
+                Byte const low = peek(address);
+                return combine_bytes(low, peek(address + 1));
+        }
+#ifdef EMULATOR_THREADED_DISPATCH
+        template <Accuracy accuracy>
+        Cycles execute_threaded(std::size_t count, Cycles cycle_limit);
+#endif
+
+        Accuracy const accuracy;
+        DispatchTable const& dispatch_table;
+        std::array<Recompiled::Step, 256> const& steps;
         std::unique_ptr<AccessibleMemory> memory;
+        Byte* zero_page_and_stack = nullptr;
         Address pc = 0;
         Byte sp = byte_max;
         Byte a = 0;
         Byte x = 0;
         Byte y = 0;
-        ByteBitset p = 0x20;
+
+        /**
+         * Most flag updates get overwritten before anything looks at
+         * them, so C, Z, V and N aren't stored as flags. Instead the
+         * core keeps the values they come from, and works them out
+         * when a branch, PHP, BRK, an interrupt or CPU::p() needs them.
+         */
+        static Byte constexpr lazy_flags_mask = 1 << carry_flag | 1 << zero_flag |
+                                                1 << overflow_flag | 1 << negative_flag;
+        ByteBitset stored_flags = 1 << unused_flag; // The other flags
+        unsigned carry_result = 0;                   // C is bit 8
+        Byte zero_result = 1;                        // Z is set when it's 0
+        Byte overflow_result = 0;                    // V is bit 7
+        Byte negative_result = 0;                    // N is bit 7
+        Cycles cycles = 0;
+
+        std::unordered_map<Address, Block> blocks;
+        Block uncached_block;
+        std::bitset<256> code_pages;
+        std::bitset<256> written_code_pages;
+
+        /**
+         * Everything that makes the CPU leave the current block, in one
+         * integer so that the run loops only check one thing after each
+         * instruction.
+         */
+        enum Event : unsigned {
+                code_modified = 1 << 0,
+                stop_requested = 1 << 1,
+                nmi_pending = 1 << 2,
+                irq_pending = 1 << 3,
+                pending_interrupts = nmi_pending | irq_pending
+        };
+
+        unsigned events = 0;
+        StopReason stop_reason = StopReason::cycle_budget;
+        bool stops_at_interrupts = false;
+        Byte nmi_sources = 0; // Bit n is set while InterruptSource n asserts the line
+        Byte irq_sources = 0;
+
+        Block const* idle_block = nullptr;
+        IdleState idle_state {};
+        Cycles idle_cycles = 0;
+
+        Recompiled::Library const* recompiled_library = nullptr;
+        CallObserver* call_observer = nullptr;
+        TraceBuffer* trace = nullptr;
+        Debugger* debugger = nullptr;
+        std::optional<Address> resume_pc; // Where the debugger last stopped the CPU
+        std::exception_ptr step_exception;
+
+#ifdef EMULATOR_STATISTICS
+        Statistics statistics;
+#endif
+
+#ifdef EMULATOR_JIT
+        std::uint64_t next_block_serial = 0;
+        /**
+         * Started along with its thread once the first block gets hot,
+         * and kept across resets. Block serials carry on across them
+         * too, so code compiled for a block from before a reset can't
+         * be taken for one from after it.
+         */
+        std::unique_ptr<Jit> jit;
+#endif
+};
+
+constexpr std::array<CPU::Impl::DispatchTable, 2> CPU::Impl::dispatch_tables {
+        CPU::Impl::make_dispatch_table<CPU::Accuracy::fast>(),
+        CPU::Impl::make_dispatch_table<CPU::Accuracy::bus>()
+};
+
+/**
+ * The most frequent pairs in a profile of the ROMs in roms/, leaving
+ * out the idle loops (which get skipped anyway).
+ */
+constexpr std::array<CPU::Impl::Superinstruction, 7> CPU::Impl::superinstructions {
+        make_superinstruction<0xC9, 0xD0>(), // CMP #imm, BNE
+        make_superinstruction<0xC9, 0xF0>(), // CMP #imm, BEQ
+        make_superinstruction<0xE0, 0xD0>(), // CPX #imm, BNE
+        make_superinstruction<0xC0, 0xD0>(), // CPY #imm, BNE
+        make_superinstruction<0x29, 0xF0>(), // AND #imm, BEQ
+        make_superinstruction<0xCA, 0xD0>(), // DEX, BNE
+        make_superinstruction<0x88, 0xD0>()  // DEY, BNE
+};
+
+constexpr std::array<std::array<Recompiled::Step, 256>, 2> CPU::Impl::step_tables {
+        CPU::Impl::make_steps<CPU::Accuracy::fast>(std::make_index_sequence<256>()),
+        CPU::Impl::make_steps<CPU::Accuracy::bus>(std::make_index_sequence<256>())
+};
+
+constexpr std::array<Recompiled::Bus, 2> CPU::Impl::native_buses {
+        CPU::Impl::make_native_bus<CPU::Accuracy::fast>(),
+        CPU::Impl::make_native_bus<CPU::Accuracy::bus>()
 };
 
-CPU::CPU(AccessibleMemory::Pieces pieces)
-        : impl_(std::make_unique<Impl>(std::move(pieces)))
+#ifdef EMULATOR_THREADED_DISPATCH
+
+/**
+ * Threaded code: every opcode gets a label of its own, which calls the
+ * handler from the dispatch table (resolved and inlined at compile time)
+ * and then jumps straight to the label of the next decoded instruction. Each jump is a
+ * separate indirect branch, so the branch predictor can learn which opcode
+ * usually follows which, instead of guessing at a single central switch.
+ * Needs the labels-as-values extension of GCC and Clang.
+ */
+
+#define EMULATOR_OPCODE_ROW(X, high) \
+        X(high##0) X(high##1) X(high##2) X(high##3) \
+        X(high##4) X(high##5) X(high##6) X(high##7) \
+        X(high##8) X(high##9) X(high##A) X(high##B) \
+        X(high##C) X(high##D) X(high##E) X(high##F)
+
+#define EMULATOR_FOR_EACH_OPCODE(X) \
+        EMULATOR_OPCODE_ROW(X, 0) EMULATOR_OPCODE_ROW(X, 1) \
+        EMULATOR_OPCODE_ROW(X, 2) EMULATOR_OPCODE_ROW(X, 3) \
+        EMULATOR_OPCODE_ROW(X, 4) EMULATOR_OPCODE_ROW(X, 5) \
+        EMULATOR_OPCODE_ROW(X, 6) EMULATOR_OPCODE_ROW(X, 7) \
+        EMULATOR_OPCODE_ROW(X, 8) EMULATOR_OPCODE_ROW(X, 9) \
+        EMULATOR_OPCODE_ROW(X, A) EMULATOR_OPCODE_ROW(X, B) \
+        EMULATOR_OPCODE_ROW(X, C) EMULATOR_OPCODE_ROW(X, D) \
+        EMULATOR_OPCODE_ROW(X, E) EMULATOR_OPCODE_ROW(X, F)
+
+#define EMULATOR_OPCODE_LABEL_ADDRESS(opcode) &&opcode_##opcode,
+
+#define EMULATOR_OPCODE_LABEL(opcode) \
+        opcode_##opcode: \
+        { \
+                constexpr Instruction instruction = dispatch_tables[tier(accuracy)][0x##opcode]; \
+                if constexpr (instruction == &unknown_opcode) \
+                        current->instruction(*this, current->operand); \
+                else \
+                        instruction(*this, current->operand); \
+                EMULATOR_DISPATCH(); \
+        }
+
+#define EMULATOR_DISPATCH() \
+        do { \
+                if (next == end || leaving_block()) { \
+                        Instructions const* const instructions = \
+                                next_instructions(count, cycle_limit); \
+                        if (!instructions) \
+                                return cycles - start; \
+                        next = instructions->data(); \
+                        end = next + instructions->size(); \
+                } else if (count == 0 || cycles >= cycle_limit) { \
+                        return cycles - start; \
+                } \
+                current = next++; \
+                count -= current->instruction_count; \
+                cycles += current->cycles; \
+                goto *labels[current->opcode]; \
+        } while (false)
+
+Cycles CPU::Impl::execute(std::size_t count, Cycles cycle_limit)
+{
+        if (needs_stepping())
+                return execute_stepping(count, cycle_limit);
+        if (accuracy == Accuracy::bus)
+                return execute_threaded<Accuracy::bus>(count, cycle_limit);
+        return execute_threaded<Accuracy::fast>(count, cycle_limit);
+}
+
+template <CPU::Accuracy accuracy>
+Cycles CPU::Impl::execute_threaded(std::size_t count, Cycles cycle_limit)
+{
+        static void* const labels[] = {
+                EMULATOR_FOR_EACH_OPCODE(EMULATOR_OPCODE_LABEL_ADDRESS)
+        };
+
+        Cycles const start = cycles;
+        idle_block = nullptr; // Memory could have changed since the last time
+        DecodedInstruction const* current = nullptr;
+        DecodedInstruction const* next = nullptr;
+        DecodedInstruction const* end = nullptr;
+
+        EMULATOR_DISPATCH();
+        EMULATOR_FOR_EACH_OPCODE(EMULATOR_OPCODE_LABEL)
+}
+
+#undef EMULATOR_DISPATCH
+#undef EMULATOR_OPCODE_LABEL
+#undef EMULATOR_OPCODE_LABEL_ADDRESS
+#undef EMULATOR_FOR_EACH_OPCODE
+#undef EMULATOR_OPCODE_ROW
+
+#else
+
+Cycles CPU::Impl::execute(std::size_t count, Cycles cycle_limit)
+{
+        if (needs_stepping())
+                return execute_stepping(count, cycle_limit);
+        Cycles const start = cycles;
+        idle_block = nullptr; // Memory could have changed since the last time
+        while (Instructions const* const instructions = next_instructions(count, cycle_limit)) {
+                for (auto const& decoded : *instructions) {
+                        cycles += decoded.cycles;
+                        decoded.instruction(*this, decoded.operand);
+                        count -= decoded.instruction_count;
+                        if (count == 0 || cycles >= cycle_limit || leaving_block())
+                                break;
+                }
+        }
+        return cycles - start;
+}
+
+#endif
+
+/**
+ * Only runs the plain decoded instructions, so that every instruction
+ * gets recorded and checked on its own.
+ */
+Cycles CPU::Impl::execute_stepping(std::size_t count, Cycles cycle_limit)
+{
+        Cycles const start = cycles;
+        bool const debugging = debugger && !debugger->empty();
+        idle_block = nullptr;
+        while (!finished(count, cycle_limit)) {
+                if (events & pending_interrupts) {
+                        take_pending_interrupt();
+                        continue;
+                }
+
+                for (auto const& decoded : find_block(pc).instructions) {
+                        if (debugging) {
+                                bool const resuming = resume_pc == pc;
+                                resume_pc.reset();
+                                if (!resuming && stops_for_debugger(decoded)) {
+                                        resume_pc = pc;
+                                        stop(StopReason::breakpoint);
+                                        break;
+                                }
+                        }
+                        if (trace) {
+                                trace->record({
+                                        cycles, pc,
+                                        {decoded.opcode, low_byte(decoded.operand), high_byte(decoded.operand)},
+                                        a, x, y, status(), sp
+                                });
+                        }
+                        cycles += decoded.cycles;
+                        decoded.instruction(*this, decoded.operand);
+                        count -= 1;
+                        if (count == 0 || cycles >= cycle_limit || leaving_block())
+                                break;
+                }
+        }
+        return cycles - start;
+}
+
+CPU::CPU(AccessibleMemory::Pieces pieces, Accuracy accuracy)
+        : impl_(std::make_unique<Impl>(std::move(pieces), accuracy))
 {}
 
 CPU::~CPU() = default;
@@ -906,30 +2328,123 @@ Byte CPU::y() const noexcept
 
 Byte CPU::p() const noexcept
 {
-        return impl_->p.to_ulong();
+        return impl_->status();
+}
+
+Cycles CPU::cycles() const noexcept
+{
+        return impl_->cycles;
+}
+
+unsigned CPU::execute_instruction()
+{
+        return impl_->execute(1, no_cycle_limit);
+}
+
+Cycles CPU::execute_instructions(std::size_t count)
+{
+        return impl_->execute(count, no_cycle_limit);
+}
+
+CPU::RunResult CPU::run(Cycles cycle_budget)
+{
+        Cycles const cycle_limit = cycle_budget < no_cycle_limit - impl_->cycles ?
+                                   impl_->cycles + cycle_budget :
+                                   no_cycle_limit;
+        Cycles const cycles = impl_->execute(no_instruction_limit, cycle_limit);
+        return {cycles, impl_->take_stop_reason()};
+}
+
+void CPU::stop(StopReason reason) noexcept
+{
+        assert(reason != StopReason::cycle_budget);
+        impl_->stop(reason);
+}
+
+void CPU::invalidate_code_cache() noexcept
+{
+        impl_->invalidate_code_cache();
 }
 
-void CPU::execute_instruction()
+void CPU::use_recompiled_code(Recompiled::Library const& library)
 {
-        auto const opcode = impl_->memory->read_byte(impl_->pc);
-        auto const instruction = impl_->translate_opcode(opcode);
-        instruction();
+        impl_->recompiled_library = &library;
+        impl_->invalidate_code_cache();
+}
+
+void CPU::observe_calls(CallObserver* observer) noexcept
+{
+        impl_->call_observer = observer;
+}
+
+void CPU::trace_to(TraceBuffer* buffer) noexcept
+{
+        impl_->trace = buffer;
+}
+
+void CPU::debug_with(Debugger* debugger) noexcept
+{
+        impl_->debugger = debugger;
+}
+
+Statistics const* CPU::statistics() const noexcept
+{
+#ifdef EMULATOR_STATISTICS
+        return &impl_->statistics;
+#else
+        return nullptr;
+#endif
+}
+
+void CPU::set_strict(bool strict) noexcept
+{
+        impl_->memory->set_strict(strict);
+}
+
+Statistics::Accesses const& CPU::invalid_accesses() const noexcept
+{
+        return impl_->memory->invalid_accesses();
 }
 
 void CPU::hardware_interrupt(Interrupt interrupt)
 {
         if (interrupt == Interrupt::reset) {
-                impl_ = std::make_unique<Impl>(std::move(impl_->memory));
+                auto old = std::move(impl_);
+                impl_ = std::make_unique<Impl>(std::move(old->memory), old->accuracy);
+                impl_->cycles = old->cycles + interrupt_cycles;
+                impl_->recompiled_library = old->recompiled_library;
+                impl_->call_observer = old->call_observer;
+                impl_->trace = old->trace;
+                impl_->debugger = old->debugger;
+#ifdef EMULATOR_STATISTICS
+                impl_->statistics = std::move(old->statistics);
+#endif
+#ifdef EMULATOR_JIT
+                impl_->next_block_serial = old->next_block_serial;
+                impl_->jit = std::move(old->jit);
+#endif
+                impl_->stops_at_interrupts = old->stops_at_interrupts;
+                impl_->nmi_sources = old->nmi_sources;
+                impl_->irq_sources = old->irq_sources;
+                impl_->update_irq_pending();
                 return;
         }
 
-        if (interrupt == Interrupt::irq && impl_->p.test(interrupt_disable_flag))
+        if (interrupt == Interrupt::irq &&
+            impl_->stored_flags.test(interrupt_disable_flag))
                 return;
 
-        impl_->stack_push_pointer(impl_->pc);
-        impl_->stack_push_byte(impl_->p.to_ulong());
-        impl_->p.set(interrupt_disable_flag);
-        impl_->load_interrupt_handler(interrupt);
+        impl_->take_interrupt(interrupt);
+}
+
+void CPU::set_interrupt_line(Interrupt interrupt, InterruptSource source, bool asserted) noexcept
+{
+        impl_->set_interrupt_line(interrupt, source, asserted);
+}
+
+void CPU::stop_at_interrupts(bool stop) noexcept
+{
+        impl_->stops_at_interrupts = stop;
 }
 
 bool CPU::address_is_readable_impl(Address address) const noexcept
@@ -3,6 +3,9 @@
 #pragma once
 
 #include "utils.h"
+#include "statistics.h"
+#include "trace.h"
+#include "debugger.h"
 #include <cassert>
 #include <array>
 #include <utility>
@@ -10,10 +13,17 @@
 #include <unordered_map>
 #include <functional>
 #include <variant>
+#include <optional>
 #include <stdexcept>
 
 namespace Emulator {
 
+namespace Recompiled {
+
+struct Library;
+
+}
+
 class UnknownOpcode : public std::runtime_error {
 public:
         explicit UnknownOpcode(Byte opcode) noexcept;
@@ -29,6 +39,16 @@ public:
 
                 static bool address_is_accessible(Address addres) noexcept;
 
+                /**
+                 * The backing array, which the CPU reads and writes the
+                 * zero page and the stack through directly, bypassing
+                 * read_byte and write_byte.
+                 */
+                Byte* data() noexcept;
+
+                Byte const* readable_page(Address page_start) noexcept override;
+                Byte* writable_page(Address page_start) noexcept override;
+
         protected:
                 bool address_is_writable_impl(Address address) const noexcept override;
                 bool address_is_readable_impl(Address address) const noexcept override;
@@ -41,10 +61,96 @@ public:
                 std::array<Byte, real_size> ram_ {0};
         };
 
+        /**
+         * The CPU's view of memory, put together from pieces. Accesses
+         * go through a table with an entry for each 256-byte page: pages
+         * of plain memory are accessed straight through the bytes their
+         * piece exposes, pages that are all in one piece go to that piece,
+         * and only pages split between pieces need searching. Entries are
+         * filled in on the first access to their page, and thrown away
+         * whenever a piece gets remapped.
+         *
+         * As on the real hardware, reads of addresses that no piece is
+         * at see the open bus, i.e. the last byte read or written, and
+         * writes to them go nowhere. Only read_byte and write_byte, for
+         * tools, throw InvalidRead and InvalidWrite for them.
+         */
         class AccessibleMemory : public Memory {
         public:
                 using Pieces = std::vector<Memory*>;
                 explicit AccessibleMemory(Pieces pieces) noexcept;
+                ~AccessibleMemory();
+
+                static Address constexpr zero_page_and_stack_end = 0x01FF;
+
+                /**
+                 * The array of the RAM piece that the zero page and
+                 * the stack are in, or nullptr if they aren't all in
+                 * one CPU::RAM.
+                 */
+                Byte* zero_page_and_stack() noexcept;
+
+                std::size_t piece_count() const noexcept;
+
+                /**
+                 * The index of the piece that reads from (or writes to)
+                 * the address go to.
+                 */
+                std::size_t readable_piece(Address address) const noexcept;
+                std::size_t writable_piece(Address address) const noexcept;
+
+                /**
+                 * What the CPU reads and writes through, inlined as far
+                 * as the page table goes. These go to the open bus
+                 * rather than throw.
+                 */
+                Byte read(Address address)
+                {
+                        Byte const* const data = read_pages_[address >> page_bits].data;
+                        if (data)
+                                return open_bus_ = data[address & page_mask];
+                        return read_through_piece(address);
+                }
+
+                /**
+                 * Reads without putting the byte on the bus, for
+                 * looking at code ahead of the CPU.
+                 */
+                Byte peek(Address address)
+                {
+                        Byte const* const data = read_pages_[address >> page_bits].data;
+                        if (data)
+                                return data[address & page_mask];
+                        return peek_through_piece(address);
+                }
+
+                /**
+                 * Puts a byte the CPU got without going through read
+                 * and write on the bus: the last code byte it fetched,
+                 * or a byte of the zero page or the stack.
+                 */
+                Byte drive_bus(Byte byte) noexcept
+                {
+                        return open_bus_ = byte;
+                }
+
+                void write(Address address, Byte byte)
+                {
+                        open_bus_ = byte;
+                        Byte* const data = write_pages_[address >> page_bits].data;
+                        if (data)
+                                data[address & page_mask] = byte;
+                        else
+                                write_through_piece(address, byte);
+                }
+
+                /**
+                 * In strict mode, reads and writes of addresses that no
+                 * piece is at are counted. That costs nothing on other
+                 * addresses.
+                 */
+                void set_strict(bool strict) noexcept;
+                Statistics::Accesses const& invalid_accesses() const noexcept;
 
         protected:
                 bool address_is_writable_impl(Address address) const noexcept override;
@@ -53,19 +159,57 @@ public:
                 Byte read_byte_impl(Address address) override;
 
         private:
-                Memory& find_writable_piece(Address address);
-                Memory& find_readable_piece(Address address);
+                static unsigned constexpr page_bits = 8;
+                static unsigned constexpr page_count = 0x10000 >> page_bits;
+                static Address constexpr page_mask = (1u << page_bits) - 1;
+
+                template <class Data>
+                struct Page {
+                        /**
+                         * Where the bytes of the page are, if they
+                         * can be accessed directly.
+                         */
+                        Data* data = nullptr;
+                        /**
+                         * The index of the piece the page is in, or
+                         * the piece count if it's split.
+                         */
+                        std::size_t piece = 0;
+                        /**
+                         * Whether some addresses of the page aren't in
+                         * any piece, and go to the open bus.
+                         */
+                        bool partial = false;
+                        bool mapped = false;
+                };
 
-                template <class P>
-                Memory& find_piece(P const& p)
+                Byte read_through_piece(Address address);
+                Byte peek_through_piece(Address address);
+                std::optional<Byte> read_piece(Address address);
+                void write_through_piece(Address address, Byte byte);
+                Page<Byte const>& readable_page_entry(Address address) noexcept;
+                Page<Byte>& writable_page_entry(Address address) noexcept;
+                void unmap_pages() noexcept;
+
+                template <class Accessible>
+                std::size_t page_owner(Address page_start, Accessible const& accessible,
+                                       bool& partial) const noexcept;
+
+                template <class Accessible>
+                std::size_t search_pieces(Address address, Accessible const& accessible) const noexcept
                 {
-                        auto const i = std::find_if(pieces_.cbegin(),
-                                                    pieces_.cend(), p);
-                        assert(i != pieces_.cend());
-                        return **i;
+                        auto const i = std::find_if(pieces_.cbegin(), pieces_.cend(),
+                                                    [&](Memory* piece)
+                                                    { return accessible(*piece, address); });
+                        return i - pieces_.cbegin();
                 }
 
                 Pieces pieces_;
+                std::array<Page<Byte const>, page_count> read_pages_;
+                std::array<Page<Byte>, page_count> write_pages_;
+                Byte open_bus_ = 0;
+                bool strict_ = false;
+                Statistics::Accesses invalid_accesses_;
         };
 
         enum class Interrupt {
@@ -74,15 +218,75 @@ public:
                 reset
         };
 
+        /**
+         * Where an interrupt can come from. Each source asserts and
+         * releases its own line, and the CPU sees a line as asserted
+         * for as long as any source asserts it.
+         */
+        enum class InterruptSource {
+                ppu,
+                apu_frame_counter,
+                mapper
+        };
+
+        enum class StopReason {
+                cycle_budget,
+                nmi,
+                irq,
+                breakpoint
+        };
+
+        /**
+         * How much of the real 6502's bus traffic the CPU reproduces.
+         * Both tiers compute the same results; they differ in what
+         * memory sees. The tier is fixed for each CPU, and picks the
+         * instruction handlers it decodes to, so running costs nothing
+         * extra either way.
+         */
+        enum class Accuracy {
+                /**
+                 * Only the reads and writes an instruction needs.
+                 */
+                fast,
+                /**
+                 * Also the dummy reads of indexed addressing (from the
+                 * address before the page is fixed up) and the first
+                 * write of read-modify-write instructions, which writes
+                 * back the unmodified value. Registers that react to
+                 * every access, like the PPU's and some mappers', see
+                 * what they would on the real thing.
+                 */
+                bus
+        };
+
+        /**
+         * Gets told about subroutine calls and returns, including
+         * interrupts (BRK too) and RTI. sp is the stack pointer from
+         * before the call pushed anything, which is also where it is
+         * after the matching return.
+         */
+        class CallObserver {
+        public:
+                virtual ~CallObserver() = default;
+                virtual void called(Address target, Byte sp) = 0;
+                virtual void returned(Byte sp) = 0;
+        };
+
+        struct RunResult {
+                Cycles cycles;
+                StopReason reason;
+        };
+
         static std::size_t constexpr carry_flag = 0;
         static std::size_t constexpr zero_flag = 1;
         static std::size_t constexpr interrupt_disable_flag = 2;
+        static std::size_t constexpr decimal_flag = 3;
         static std::size_t constexpr break_flag = 4;
         static std::size_t constexpr unused_flag = 5;
         static std::size_t constexpr overflow_flag = 6;
         static std::size_t constexpr negative_flag = 7;  
 
-        explicit CPU(AccessibleMemory::Pieces pieces);
+        explicit CPU(AccessibleMemory::Pieces pieces, Accuracy accuracy = Accuracy::fast);
         CPU(CPU const& other) = delete;
         CPU(CPU&& other) = default;
         CPU& operator=(CPU const& other) = delete;
@@ -99,7 +303,110 @@ public:
         Byte x() const noexcept;
         Byte y() const noexcept;
         Byte p() const noexcept;
-        void execute_instruction();
+        Cycles cycles() const noexcept;
+
+        /**
+         * Returns the number of cycles the instruction took.
+         */
+        unsigned execute_instruction();
+
+        /**
+         * Executes count instructions in one go, without returning to the
+         * caller in between (unless stop() is called). Returns the number
+         * of cycles they took.
+         */
+        Cycles execute_instructions(std::size_t count);
+
+        /**
+         * Executes instructions until at least cycle_budget cycles have
+         * gone by, until stop() is called or, with stop_at_interrupts,
+         * until an NMI edge or an IRQ is latched. The last instruction
+         * can take the CPU a few cycles past the budget.
+         */
+        RunResult run(Cycles cycle_budget);
+
+        /**
+         * Makes the CPU stop at the next instruction boundary, e.g. when
+         * a memory piece sees an interrupt coming. If the CPU isn't
+         * running, the next run() returns straight away.
+         */
+        void stop(StopReason reason) noexcept;
+
+        /**
+         * Decoded code is cached, and the cache is kept up to date with
+         * the CPU's own writes and with bank switches. Anyone else who
+         * overwrites code has to call this.
+         */
+        void invalidate_code_cache() noexcept;
+
+        /**
+         * Runs blocks of a ROM recompiled by nes-recompile instead of
+         * interpreting them, wherever memory holds the same code they
+         * were compiled from. The library has to outlive the CPU.
+         */
+        void use_recompiled_code(Recompiled::Library const& library);
+
+        /**
+         * The observer, if any, has to outlive the CPU or be replaced
+         * with nullptr first.
+         */
+        void observe_calls(CallObserver* observer) noexcept;
+
+        /**
+         * Records every instruction into the buffer from now on, or
+         * stops recording if it's nullptr. Tracing takes effect at the
+         * next run, and traced runs execute one instruction at a time,
+         * without compiled code, superinstructions or idle loop
+         * skipping. Untraced runs don't check for it. The buffer has
+         * to outlive the CPU or be replaced with nullptr first.
+         */
+        void trace_to(TraceBuffer* buffer) noexcept;
+
+        /**
+         * Stops at the debugger's breakpoints and watchpoints from the
+         * next run on. While it has any, runs execute one instruction at
+         * a time like traced runs; otherwise they don't check for it.
+         * The debugger has to outlive the CPU or be replaced with
+         * nullptr first.
+         */
+        void debug_with(Debugger* debugger) noexcept;
+
+        /**
+         * What the CPU has counted since it was made, or nullptr if
+         * the core was built without EMULATOR_STATISTICS. The counts
+         * carry on through resets.
+         */
+        Statistics const* statistics() const noexcept;
+
+        /**
+         * Counts the reads and writes the CPU makes of addresses that
+         * nothing is at, which just see the open bus, from the next one
+         * on. The counts carry on through resets.
+         */
+        void set_strict(bool strict) noexcept;
+        Statistics::Accesses const& invalid_accesses() const noexcept;
+
+        /**
+         * NMI is edge-triggered: asserting it while no other source does
+         * makes one NMI pending. IRQ is level-triggered: it's taken for
+         * as long as it's asserted and I is clear. Pending interrupts are
+         * taken at the next instruction boundary, in the middle of a run
+         * too, and take 7 cycles.
+         */
+        void set_interrupt_line(Interrupt interrupt, InterruptSource source, bool asserted) noexcept;
+
+        /**
+         * Makes run() return StopReason::nmi or StopReason::irq at the
+         * instruction boundary where an interrupt goes pending, before
+         * it's taken, so the host can catch up first. The next run()
+         * takes it. Off by default, when interrupts are just taken.
+         */
+        void stop_at_interrupts(bool stop) noexcept;
+
+        /**
+         * Takes an interrupt right away (an IRQ only if I is clear),
+         * without going through the lines.
+         */
         void hardware_interrupt(Interrupt interrupt);
 
 protected:
@@ -0,0 +1,100 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "debugger.h"
+
+namespace Emulator {
+
+namespace {
+
+bool includes(Debugger::Access access, Debugger::Access part) noexcept
+{
+        return static_cast<unsigned>(access) & static_cast<unsigned>(part);
+}
+
+}
+
+void Debugger::add_breakpoint(Address pc, Condition condition)
+{
+        breakpoint_addresses_.set(pc);
+        breakpoints_.emplace(pc, std::move(condition));
+}
+
+void Debugger::remove_breakpoints(Address pc)
+{
+        breakpoint_addresses_.reset(pc);
+        breakpoints_.erase(pc);
+}
+
+void Debugger::add_watchpoint(Address first, Address last, Access access, Condition condition)
+{
+        watchpoints_.push_back({first, last, access, std::move(condition)});
+        for (unsigned page = high_byte(first); page <= high_byte(last); ++page) {
+                if (includes(access, Access::read))
+                        read_watched_pages_.set(page);
+                if (includes(access, Access::write))
+                        write_watched_pages_.set(page);
+        }
+}
+
+void Debugger::clear() noexcept
+{
+        breakpoint_addresses_.reset();
+        breakpoints_.clear();
+        watchpoints_.clear();
+        read_watched_pages_.reset();
+        write_watched_pages_.reset();
+}
+
+bool Debugger::empty() const noexcept
+{
+        return breakpoints_.empty() && watchpoints_.empty();
+}
+
+std::optional<Debugger::Hit> const& Debugger::last_hit() const noexcept
+{
+        return last_hit_;
+}
+
+bool Debugger::breaks_at(Registers const& registers)
+{
+        if (!breakpoint_addresses_.test(registers.pc))
+                return false;
+
+        auto const [begin, end] = breakpoints_.equal_range(registers.pc);
+        for (auto i = begin; i != end; ++i) {
+                if (holds(i->second, registers)) {
+                        last_hit_ = Hit {Hit::Kind::breakpoint, registers.pc, registers};
+                        return true;
+                }
+        }
+        return false;
+}
+
+bool Debugger::has_watchpoints() const noexcept
+{
+        return !watchpoints_.empty();
+}
+
+bool Debugger::watches(Address address, Access access, Registers const& registers)
+{
+        auto const& pages = access == Access::read ? read_watched_pages_ : write_watched_pages_;
+        if (!pages.test(high_byte(address)))
+                return false;
+
+        for (auto const& watchpoint : watchpoints_) {
+                if (watchpoint.first <= address && address <= watchpoint.last &&
+                    includes(watchpoint.access, access) && holds(watchpoint.condition, registers)) {
+                        auto const kind = access == Access::read ? Hit::Kind::read : Hit::Kind::write;
+                        last_hit_ = Hit {kind, address, registers};
+                        return true;
+                }
+        }
+        return false;
+}
+
+bool Debugger::holds(Condition const& condition, Registers const& registers)
+{
+        return !condition || condition(registers);
+}
+
+}
@@ -0,0 +1,99 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <bitset>
+#include <functional>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace Emulator {
+
+/**
+ * Breakpoints and watchpoints, for CPU::debug_with. The CPU stops
+ * before an instruction at a breakpoint, or before an instruction
+ * that's about to access a watched address, and run() returns
+ * StopReason::breakpoint. Running again carries on from there.
+ *
+ * Watchpoints see the memory an instruction's operand refers to, and
+ * the stack. The pointers of indirect addressing, the dummy accesses
+ * of the bus accuracy tier and interrupts don't count.
+ */
+class Debugger {
+public:
+        struct Registers {
+                Address pc;
+                Byte a;
+                Byte x;
+                Byte y;
+                Byte p;
+                Byte sp;
+        };
+
+        /**
+         * E.g. [](auto const& registers) { return registers.x == 0; }
+         */
+        using Condition = std::function<bool(Registers const& registers)>;
+
+        enum class Access {
+                read = 1 << 0,
+                write = 1 << 1,
+                read_write = read | write
+        };
+
+        struct Hit {
+                enum class Kind {
+                        breakpoint,
+                        read,
+                        write
+                };
+
+                Kind kind;
+                Address address; // The PC for breakpoints
+                Registers registers;
+        };
+
+        void add_breakpoint(Address pc, Condition condition = nullptr);
+        void remove_breakpoints(Address pc);
+        void add_watchpoint(Address first, Address last, Access access, Condition condition = nullptr);
+        void clear() noexcept;
+        bool empty() const noexcept;
+
+        /**
+         * What the CPU stopped for most recently.
+         */
+        std::optional<Hit> const& last_hit() const noexcept;
+
+        /**
+         * What the CPU asks before each instruction. A true answer
+         * gets recorded as the last hit.
+         */
+        bool breaks_at(Registers const& registers);
+        bool has_watchpoints() const noexcept;
+        bool watches(Address address, Access access, Registers const& registers);
+
+private:
+        struct Watchpoint {
+                Address first;
+                Address last;
+                Access access;
+                Condition condition;
+        };
+
+        static bool holds(Condition const& condition, Registers const& registers);
+
+        std::bitset<0x10000> breakpoint_addresses_;
+        std::multimap<Address, Condition> breakpoints_;
+        std::vector<Watchpoint> watchpoints_;
+        /**
+         * Pages with a watchpoint on them, so that most accesses are
+         * ruled out with one lookup.
+         */
+        std::bitset<256> read_watched_pages_;
+        std::bitset<256> write_watched_pages_;
+        std::optional<Hit> last_hit_;
+};
+
+}
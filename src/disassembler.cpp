@@ -0,0 +1,140 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "disassembler.h"
+#include "opcodes.h"
+#include <iomanip>
+#include <sstream>
+
+namespace Emulator {
+
+namespace {
+
+std::size_t constexpr bytes_width = 10;
+
+std::string hex(unsigned value, int width)
+{
+        std::stringstream ss;
+        ss << std::hex << std::uppercase << std::setfill('0') << std::setw(width) << value;
+        return ss.str();
+}
+
+/**
+ * The label at the address, or the address as it's written in the
+ * addressing mode.
+ */
+std::string name(Address address, int width, Labels const* labels)
+{
+        if (labels) {
+                if (auto const label = labels->find(address))
+                        return *label;
+        }
+        return "$" + hex(address, width);
+}
+
+}
+
+std::string Disassembler::Line::text() const
+{
+        std::string bytes_text;
+        for (unsigned i = 0; i < length; ++i)
+                bytes_text += hex(bytes[i], 2) + " ";
+
+        std::stringstream line;
+        line << "$" << hex(address, 4) << ": " << std::left << std::setw(bytes_width) << bytes_text
+             << mnemonic << (operand.empty() ? "" : " ") << operand;
+        return line.str();
+}
+
+Disassembler::Disassembler(ReadableMemory& memory)
+        : memory_(memory)
+{}
+
+Labels& Disassembler::labels() noexcept
+{
+        return labels_;
+}
+
+Disassembler::Line const& Disassembler::disassemble(Address address)
+{
+        auto const bytes = read_bytes(address);
+        auto const i = lines_.find(address);
+        if (i != lines_.end()) {
+                Line& line = i->second;
+                if (line.bytes != bytes)
+                        line = decode(address, bytes, &labels_);
+                return line;
+        }
+        return lines_.emplace(address, decode(address, bytes, &labels_)).first->second;
+}
+
+std::vector<Disassembler::Line> Disassembler::disassemble(Address first, Address last)
+{
+        std::vector<Disassembler::Line> lines;
+        unsigned address = first;
+        while (address <= last) {
+                lines.push_back(disassemble(address));
+                address += lines.back().length;
+        }
+        return lines;
+}
+
+void Disassembler::invalidate() noexcept
+{
+        lines_.clear();
+}
+
+Disassembler::Line Disassembler::decode(Address address, std::array<Byte, 3> const& bytes, Labels const* labels)
+{
+        using Opcodes::AddressingMode;
+        auto const& info = Opcodes::opcode_table[bytes[0]];
+        Byte const low = bytes[1];
+        Address const word = combine_bytes(bytes[1], bytes[2]);
+
+        std::string operand;
+        switch (info.mode) {
+                case AddressingMode::implied:     break;
+                case AddressingMode::accumulator: operand = "A"; break;
+                case AddressingMode::immediate:   operand = "#$" + hex(low, 2); break;
+                case AddressingMode::zero_page:   operand = name(low, 2, labels); break;
+                case AddressingMode::zero_page_x: operand = name(low, 2, labels) + ",X"; break;
+                case AddressingMode::zero_page_y: operand = name(low, 2, labels) + ",Y"; break;
+                case AddressingMode::absolute:    operand = name(word, 4, labels); break;
+                case AddressingMode::absolute_x:  operand = name(word, 4, labels) + ",X"; break;
+                case AddressingMode::absolute_y:  operand = name(word, 4, labels) + ",Y"; break;
+                case AddressingMode::indirect:    operand = "(" + name(word, 4, labels) + ")"; break;
+                case AddressingMode::indirect_x:  operand = "(" + name(low, 2, labels) + ",X)"; break;
+                case AddressingMode::indirect_y:  operand = "(" + name(low, 2, labels) + "),Y"; break;
+                case AddressingMode::relative:
+                        operand = name(address + 2 + TwosComplement::encode(low), 4, labels);
+                        break;
+        }
+
+        Line line {address, bytes, info.length, std::string(info.mnemonic), operand,
+                   std::to_string(info.cycles), ""};
+        for (Byte i = info.length; i < line.bytes.size(); ++i)
+                line.bytes[i] = 0;
+        if (info.page_cross_penalty || Opcodes::is_branch(bytes[0]))
+                line.cycles += "+";
+        if (labels) {
+                if (auto const label = labels->find(address))
+                        line.label = *label;
+        }
+        return line;
+}
+
+/**
+ * Bytes that can't be read show up as 0.
+ */
+std::array<Byte, 3> Disassembler::read_bytes(Address address)
+{
+        std::array<Byte, 3> bytes {};
+        auto const read = [&](Address at) -> Byte {
+                return memory_.address_is_readable(at) ? memory_.read_byte(at) : 0;
+        };
+        bytes[0] = read(address);
+        for (Byte i = 1; i < Opcodes::opcode_table[bytes[0]].length; ++i)
+                bytes[i] = read(address + i);
+        return bytes;
+}
+
+}
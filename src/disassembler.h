@@ -0,0 +1,83 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include "labels.h"
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Emulator {
+
+/**
+ * Turns code back into assembly, e.g. for looking at a ROM, or at
+ * every instruction of a trace. Decoded lines are cached, so going
+ * over the same code again is cheap.
+ */
+class Disassembler {
+public:
+        struct Line {
+                Address address;
+                std::array<Byte, 3> bytes; // The opcode and its operand
+                Byte length;
+                std::string mnemonic;
+                std::string operand; // E.g. "$20F8,X", or "table,X" with a label
+                /**
+                 * E.g. "4", or "4+" if crossing a page or taking a
+                 * branch adds cycles.
+                 */
+                std::string cycles;
+                std::string label; // Empty if there's no label at the address
+
+                /**
+                 * E.g. "$8012: BD F8 20  LDA $20F8,X".
+                 */
+                std::string text() const;
+        };
+
+        /**
+         * Code is read from memory, which should map it the way the CPU
+         * sees it.
+         */
+        explicit Disassembler(ReadableMemory& memory);
+
+        /**
+         * Operands that are the address of a label show the label.
+         * Changing the labels doesn't change lines that are already
+         * cached, so load them first (or call invalidate()).
+         */
+        Labels& labels() noexcept;
+
+        /**
+         * The line is valid until the next call. A cached line is only
+         * used if memory still holds the same bytes, so code that's
+         * been overwritten or banked out gets decoded again.
+         */
+        Line const& disassemble(Address address);
+
+        /**
+         * The instructions one after the other from first, up to the
+         * last one that starts at or before last.
+         */
+        std::vector<Line> disassemble(Address first, Address last);
+
+        void invalidate() noexcept;
+
+        /**
+         * Decodes an instruction whose bytes are already known, without
+         * caching it. Bytes past the instruction's length are ignored.
+         */
+        static Line decode(Address address, std::array<Byte, 3> const& bytes,
+                           Labels const* labels = nullptr);
+
+private:
+        std::array<Byte, 3> read_bytes(Address address);
+
+        ReadableMemory& memory_;
+        Labels labels_;
+        std::unordered_map<Address, Line> lines_;
+};
+
+}
@@ -0,0 +1,49 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "disassembler.h"
+#include "cartridge.h"
+#include <iomanip>
+#include <iostream>
+
+/**
+ * nes-disassemble ROM [LABELS]... lists the PRG ROM of ROM as the CPU
+ * sees it, one instruction after the other, with the cycles each one
+ * takes. Labels come from any files assemblers write that Labels
+ * understands. Data gets disassembled like code, since there's no
+ * telling them apart this way.
+ */
+
+namespace {
+
+std::size_t constexpr text_width = 40;
+
+}
+
+int main(int argc, char** argv)
+{
+        if (argc < 2) {
+                std::cout << "Usage: nes-disassemble ROM [LABELS]...\n";
+                return 1;
+        }
+
+        try {
+                Emulator::Cartridge const cartridge(argv[1]);
+                auto const memory_mapper = Emulator::MemoryMapper::make(cartridge);
+                Emulator::Disassembler disassembler(*memory_mapper);
+                for (int i = 2; i < argc; ++i)
+                        disassembler.labels().load(argv[i]);
+
+                auto const lines = disassembler.disassemble(Emulator::Cartridge::prg_rom_lower_bank_start,
+                                                            Emulator::Cartridge::prg_rom_upper_bank_end);
+                for (auto const& line : lines) {
+                        if (!line.label.empty())
+                                std::cout << line.label << ":\n";
+                        std::cout << "        " << std::left << std::setw(text_width) << line.text()
+                                  << "; " << line.cycles << '\n';
+                }
+        } catch (std::exception const& e) {
+                std::cerr << e.what() << '\n';
+                return 1;
+        }
+        return 0;
+}
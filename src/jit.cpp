@@ -0,0 +1,966 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "jit.h"
+#include "opcodes.h"
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string_view>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef __x86_64__
+#error "The JIT only generates x86-64 code."
+#endif
+
+namespace Emulator {
+
+namespace {
+
+enum Register : unsigned {
+        rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+        r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+enum class Size {
+        byte,
+        dword,
+        qword
+};
+
+enum Condition : Byte {
+        overflow = 0x0,
+        carry = 0x2,
+        no_carry = 0x3,
+        zero = 0x4,
+        not_zero = 0x5
+};
+
+/**
+ * Just enough of an x86-64 assembler for Jit::generate. Jumps go to
+ * labels, which can be placed after the jumps to them.
+ */
+class Assembler {
+public:
+        using Label = std::size_t;
+
+        std::vector<Byte> const& machine_code()
+        {
+                for (auto const& [position, label] : fixups_) {
+                        auto const offset = static_cast<std::int32_t>(
+                                labels_[label] - (position + sizeof(std::int32_t)));
+                        std::memcpy(code_.data() + position, &offset, sizeof(offset));
+                }
+                fixups_.clear();
+                return code_;
+        }
+
+        Label new_label()
+        {
+                labels_.push_back(0);
+                return labels_.size() - 1;
+        }
+
+        void place(Label label)
+        {
+                labels_[label] = code_.size();
+        }
+
+        void push(Register reg)
+        {
+                rex(false, 0, reg, false);
+                emit({Byte(0x50 + (reg & 7))});
+        }
+
+        void pop(Register reg)
+        {
+                rex(false, 0, reg, false);
+                emit({Byte(0x58 + (reg & 7))});
+        }
+
+        void ret()
+        {
+                emit({0xC3});
+        }
+
+        void move(Register destination, std::uint32_t value)
+        {
+                rex(false, 0, destination, false);
+                emit({Byte(0xB8 + (destination & 7))});
+                emit_value(value);
+        }
+
+        void move(Register destination, Register source, Size size = Size::dword)
+        {
+                register_operation({0x89}, size, source, destination);
+        }
+
+        void load(Size size, Register destination, Register base, int displacement)
+        {
+                memory_operation({0x8B}, size, destination, base, displacement);
+        }
+
+        void load_byte(Register destination, Register base, int displacement)
+        {
+                memory_operation({0x0F, 0xB6}, Size::byte, destination, base, displacement); // movzx
+        }
+
+        void store(Size size, Register base, int displacement, Register source)
+        {
+                memory_operation({Byte(size == Size::byte ? 0x88 : 0x89)}, size, source, base, displacement);
+        }
+
+        void store_word(Register base, int displacement, Register source)
+        {
+                emit({0x66});
+                store(Size::dword, base, displacement, source);
+        }
+
+        void store_byte(Register base, int displacement, Byte value)
+        {
+                memory_operation({0xC6}, Size::byte, 0, base, displacement);
+                emit({value});
+        }
+
+        void load_address(Register destination, Register base, int displacement)
+        {
+                memory_operation({0x8D}, Size::qword, destination, base, displacement); // lea
+        }
+
+        /**
+         * The byte-sized ALU operations on two registers.
+         */
+        void add_with_carry(Register destination, Register source) { byte_operation(0x10, destination, source); }
+        void subtract(Register destination, Register source) { byte_operation(0x28, destination, source); }
+        void bitwise_and(Register destination, Register source) { byte_operation(0x20, destination, source); }
+        void bitwise_or(Register destination, Register source) { byte_operation(0x08, destination, source); }
+        void bitwise_xor(Register destination, Register source) { byte_operation(0x30, destination, source); }
+
+        void add_byte(Register destination, Byte value)
+        {
+                register_operation({0x80}, Size::byte, 0, destination);
+                emit({value});
+        }
+
+        void increment_byte(Register reg)
+        {
+                register_operation({0xFE}, Size::byte, 0, reg);
+        }
+
+        void decrement_byte(Register reg)
+        {
+                register_operation({0xFE}, Size::byte, 1, reg);
+        }
+
+        void invert_byte(Register reg)
+        {
+                register_operation({0xF6}, Size::byte, 2, reg);
+        }
+
+        void shift_left_byte(Register reg, Byte count)
+        {
+                register_operation({0xC0}, Size::byte, 4, reg);
+                emit({count});
+        }
+
+        void set_if(Condition condition, Register destination)
+        {
+                register_operation({0x0F, Byte(0x90 + condition)}, Size::byte, 0, destination);
+        }
+
+        void set_if(Condition condition, Register base, int displacement)
+        {
+                memory_operation({0x0F, Byte(0x90 + condition)}, Size::byte, 0, base, displacement);
+        }
+
+        void test_byte(Register base, int displacement, Byte mask)
+        {
+                memory_operation({0xF6}, Size::byte, 0, base, displacement);
+                emit({mask});
+        }
+
+        void compare_byte(Register base, int displacement, Byte value)
+        {
+                memory_operation({0x80}, Size::byte, 7, base, displacement);
+                emit({value});
+        }
+
+        /**
+         * Puts a bit of a 32-bit value in memory into the carry flag.
+         */
+        void test_bit(Register base, int displacement, Byte bit)
+        {
+                memory_operation({0x0F, 0xBA}, Size::dword, 4, base, displacement);
+                emit({bit});
+        }
+
+        void add_to_quadword(Register base, int displacement, std::uint32_t value)
+        {
+                if (value < 0x80) {
+                        memory_operation({0x83}, Size::qword, 0, base, displacement);
+                        emit({Byte(value)});
+                } else {
+                        memory_operation({0x81}, Size::qword, 0, base, displacement);
+                        emit_value(value);
+                }
+        }
+
+        void add_to_stack_pointer(std::int8_t value)
+        {
+                register_operation({0x83}, Size::qword, value < 0 ? 5 : 0, rsp); // sub or add
+                emit({Byte(value < 0 ? -value : value)});
+        }
+
+        void call(Register base, int displacement)
+        {
+                memory_operation({0xFF}, Size::dword, 2, base, displacement);
+        }
+
+        void call(void const* function)
+        {
+                emit({0x48, 0xB8}); // mov rax, function
+                emit_value(reinterpret_cast<std::uint64_t>(function));
+                emit({0xFF, 0xD0}); // call rax
+        }
+
+        void test_return_value()
+        {
+                emit({0x84, 0xC0}); // test al, al
+        }
+
+        void jump_if(Condition condition, Label label)
+        {
+                emit({0x0F, Byte(0x80 + condition)});
+                jump_offset(label);
+        }
+
+        void jump(Label label)
+        {
+                emit({0xE9});
+                jump_offset(label);
+        }
+
+private:
+        void emit(std::initializer_list<Byte> bytes)
+        {
+                code_.insert(code_.end(), bytes);
+        }
+
+        template <class T>
+        void emit_value(T value)
+        {
+                Byte bytes[sizeof(T)];
+                std::memcpy(bytes, &value, sizeof(T));
+                code_.insert(code_.end(), std::begin(bytes), std::end(bytes));
+        }
+
+        /**
+         * Byte operations always get a prefix, so that registers 4 to 7
+         * mean spl to dil rather than ah to bh.
+         */
+        void rex(bool wide, unsigned reg, unsigned rm, bool byte_operation)
+        {
+                Byte const prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | rm >> 3;
+                if (prefix != 0x40 || byte_operation)
+                        emit({prefix});
+        }
+
+        void register_operation(std::initializer_list<Byte> opcode, Size size, unsigned reg, unsigned rm)
+        {
+                rex(size == Size::qword, reg, rm, size == Size::byte);
+                emit(opcode);
+                emit({Byte(0xC0 | (reg & 7) << 3 | (rm & 7))});
+        }
+
+        void memory_operation(std::initializer_list<Byte> opcode, Size size, unsigned reg,
+                              Register base, int displacement)
+        {
+                rex(size == Size::qword, reg, base, size == Size::byte);
+                emit(opcode);
+                Byte const fields = (reg & 7) << 3 | (base & 7);
+                bool const short_displacement = displacement >= -128 && displacement < 128;
+                if (displacement == 0 && (base & 7) != rbp)
+                        emit({fields});
+                else
+                        emit({Byte((short_displacement ? 0x40 : 0x80) | fields)});
+                if ((base & 7) == rsp)
+                        emit({0x24}); // No index
+                if (displacement == 0 && (base & 7) != rbp)
+                        return;
+                if (short_displacement)
+                        emit({Byte(displacement)});
+                else
+                        emit_value(std::int32_t(displacement));
+        }
+
+        void byte_operation(Byte opcode, Register destination, Register source)
+        {
+                register_operation({opcode}, Size::byte, source, destination);
+        }
+
+        void jump_offset(Label label)
+        {
+                fixups_.emplace_back(code_.size(), label);
+                emit_value(std::uint32_t {0});
+        }
+
+        std::vector<Byte> code_;
+        std::vector<std::size_t> labels_;
+        std::vector<std::pair<std::size_t, Label>> fixups_;
+};
+
+/**
+ * Where things are while compiled code runs:
+ * - rbx holds the Host, and rbp its cycle counter.
+ * - r12, r13 and r14 hold A, X and Y, as 32-bit values below 256.
+ * - The stack frame holds the results the flags come from, and the
+ *   byte a read goes to.
+ * Those are all callee-saved, so they survive the calls. Everything in
+ * the CPU itself is up to date around the steps and on the way out.
+ */
+Register constexpr host = rbx;
+Register constexpr cycle_counter = rbp;
+Register constexpr accumulator = r12;
+Register constexpr x_register = r13;
+Register constexpr y_register = r14;
+
+int constexpr carry_slot = 0;     // C is bit 8, so it's bit 0 of byte 1
+int constexpr zero_slot = 4;
+int constexpr negative_slot = 5;
+int constexpr overflow_slot = 6;
+int constexpr operand_slot = 8;
+int constexpr go_on_slot = 9;
+std::int8_t constexpr frame_size = 16;
+
+using Recompiled::Host;
+using Recompiled::Registers;
+using Recompiled::Bus;
+
+int constexpr register_offset(std::size_t offset) noexcept
+{
+        return offsetof(Host, registers) + offset;
+}
+
+int constexpr bus_offset(std::size_t offset) noexcept
+{
+        return offsetof(Host, bus) + offset;
+}
+
+/**
+ * The operations compiled code does itself, on an operand in cl.
+ */
+enum class Operation {
+        load_a, load_x, load_y,
+        add, subtract,
+        bitwise_and, bitwise_or, bitwise_xor,
+        compare_a, compare_x, compare_y,
+        bit,
+        store_a, store_x, store_y,
+        increment_x, increment_y, decrement_x, decrement_y,
+        transfer_a_x, transfer_a_y, transfer_x_a, transfer_y_a,
+        clear_carry, set_carry, clear_overflow,
+        nothing
+};
+
+std::map<std::string_view, Operation> const operations {
+        {"LDA", Operation::load_a},
+        {"LDX", Operation::load_x},
+        {"LDY", Operation::load_y},
+        {"ADC", Operation::add},
+        {"SBC", Operation::subtract},
+        {"AND", Operation::bitwise_and},
+        {"ORA", Operation::bitwise_or},
+        {"EOR", Operation::bitwise_xor},
+        {"CMP", Operation::compare_a},
+        {"CPX", Operation::compare_x},
+        {"CPY", Operation::compare_y},
+        {"BIT", Operation::bit},
+        {"STA", Operation::store_a},
+        {"STX", Operation::store_x},
+        {"STY", Operation::store_y},
+        {"INX", Operation::increment_x},
+        {"INY", Operation::increment_y},
+        {"DEX", Operation::decrement_x},
+        {"DEY", Operation::decrement_y},
+        {"TAX", Operation::transfer_a_x},
+        {"TAY", Operation::transfer_a_y},
+        {"TXA", Operation::transfer_x_a},
+        {"TYA", Operation::transfer_y_a},
+        {"CLC", Operation::clear_carry},
+        {"SEC", Operation::set_carry},
+        {"CLV", Operation::clear_overflow},
+        {"NOP", Operation::nothing}
+};
+
+struct Branch {
+        int slot;
+        Byte mask; // 0 for Z, which is set when the slot is 0
+        bool if_set;
+};
+
+std::map<std::string_view, Branch> const branches {
+        {"BPL", {negative_slot, 0x80, false}},
+        {"BMI", {negative_slot, 0x80, true}},
+        {"BVC", {overflow_slot, 0x80, false}},
+        {"BVS", {overflow_slot, 0x80, true}},
+        {"BCC", {carry_slot + 1, 0x01, false}},
+        {"BCS", {carry_slot + 1, 0x01, true}},
+        {"BNE", {zero_slot, 0x00, false}},
+        {"BEQ", {zero_slot, 0x00, true}}
+};
+
+Byte constexpr jmp_opcode = 0x4C;
+
+class Compiler {
+public:
+        std::vector<Byte> compile(std::vector<Jit::Instruction> const& instructions);
+
+private:
+        struct Exit {
+                Assembler::Label label;
+                std::size_t count;
+                std::optional<Address> pc; // Steps have already set it
+        };
+
+        bool compile_natively(Jit::Instruction const& instruction, std::size_t count, bool last);
+        void compile_step(Jit::Instruction const& instruction, std::size_t count, bool last);
+        void read(Opcodes::OpcodeInfo const& info, Address operand);
+        void write(Opcodes::OpcodeInfo const& info, Register source, Address operand, Address next,
+                   std::size_t count);
+        void operate(Operation operation);
+        void branch(Branch const& branch, Address target, Address next, std::size_t count);
+        void leave(std::size_t count, Address pc);
+        void leave_if_false(std::size_t count, std::optional<Address> pc);
+        void prepare_call();
+        void set_result(Register reg);
+        void load_registers();
+        void store_registers();
+        void flush_cycles();
+
+        Assembler assembler_;
+        Assembler::Label leave_ = assembler_.new_label();
+        Assembler::Label epilogue_ = assembler_.new_label();
+        std::vector<Exit> exits_;
+        std::uint32_t pending_cycles_ = 0;
+};
+
+std::vector<Byte> Compiler::compile(std::vector<Jit::Instruction> const& instructions)
+{
+        assembler_.push(rbx);
+        assembler_.push(rbp);
+        assembler_.push(r12);
+        assembler_.push(r13);
+        assembler_.push(r14);
+        assembler_.add_to_stack_pointer(-frame_size); // Keeps the stack 16-byte aligned
+        assembler_.move(host, rdi, Size::qword);
+        assembler_.load(Size::qword, cycle_counter, host, offsetof(Host, cycles));
+        load_registers();
+
+        // Steps move the program counter on themselves, compiled code
+        // only when it leaves the block.
+        bool pc_is_current = true;
+        for (std::size_t i = 0; i < instructions.size(); ++i) {
+                auto const& instruction = instructions[i];
+                bool const last = i + 1 == instructions.size();
+                pending_cycles_ += instruction.cycles;
+                if (!instruction.interpret && compile_natively(instruction, i + 1, last)) {
+                        pc_is_current = false;
+                        continue;
+                }
+                if (!pc_is_current) {
+                        assembler_.load(Size::qword, rdx, host, register_offset(offsetof(Registers, pc)));
+                        assembler_.move(rsi, instruction.address);
+                        assembler_.store_word(rdx, 0, rsi);
+                }
+                compile_step(instruction, i + 1, last);
+                pc_is_current = true;
+        }
+
+        for (auto const& exit : exits_) {
+                assembler_.place(exit.label);
+                assembler_.move(rax, exit.count);
+                if (exit.pc) {
+                        assembler_.move(rsi, *exit.pc);
+                        assembler_.jump(leave_);
+                } else {
+                        assembler_.jump(epilogue_);
+                }
+        }
+
+        // Expects the count in eax and the program counter in si.
+        assembler_.place(leave_);
+        assembler_.load(Size::qword, rdx, host, register_offset(offsetof(Registers, pc)));
+        assembler_.store_word(rdx, 0, rsi);
+        store_registers();
+        assembler_.place(epilogue_);
+        assembler_.add_to_stack_pointer(frame_size);
+        assembler_.pop(r14);
+        assembler_.pop(r13);
+        assembler_.pop(r12);
+        assembler_.pop(rbp);
+        assembler_.pop(rbx);
+        assembler_.ret();
+        return assembler_.machine_code();
+}
+
+/**
+ * Returns false if the instruction has to be left to its step.
+ */
+bool Compiler::compile_natively(Jit::Instruction const& instruction, std::size_t count, bool last)
+{
+        using Mode = Opcodes::AddressingMode;
+        auto const& info = Opcodes::opcode_table[instruction.opcode];
+        Address const next = instruction.address + info.length;
+
+        if (auto const branch = branches.find(info.mnemonic); branch != branches.end()) {
+                if (!last)
+                        return false;
+                this->branch(branch->second, next + TwosComplement::encode(instruction.operand), next, count);
+                return true;
+        }
+        if (instruction.opcode == jmp_opcode) {
+                leave(count, instruction.operand);
+                return true;
+        }
+
+        auto const operation = operations.find(info.mnemonic);
+        if (operation == operations.end())
+                return false;
+        Operation const op = operation->second;
+        bool const stores = op == Operation::store_a || op == Operation::store_x || op == Operation::store_y;
+        bool const reads = op <= Operation::bit;
+        switch (info.mode) {
+                case Mode::implied:
+                        if (reads || stores)
+                                return false;
+                        operate(op);
+                        break;
+                case Mode::immediate:
+                        if (!reads)
+                                return false;
+                        assembler_.move(rcx, instruction.operand);
+                        operate(op);
+                        break;
+                case Mode::zero_page:
+                case Mode::zero_page_x:
+                case Mode::zero_page_y:
+                case Mode::absolute:
+                case Mode::absolute_x:
+                case Mode::absolute_y:
+                        if (stores) {
+                                Register const source = op == Operation::store_a ? accumulator :
+                                                        op == Operation::store_x ? x_register : y_register;
+                                write(info, source, instruction.operand, next, count);
+                                break;
+                        }
+                        if (!reads)
+                                return false;
+                        if ((info.mode == Mode::absolute_x || info.mode == Mode::absolute_y) &&
+                            !info.page_cross_penalty)
+                                return false;
+                        read(info, instruction.operand);
+                        operate(op);
+                        assembler_.compare_byte(rsp, go_on_slot, 0);
+                        leave_if_false(count, next);
+                        break;
+                default:
+                        return false;
+        }
+
+        if (last) {
+                flush_cycles();
+                leave(count, next);
+        }
+        return true;
+}
+
+void Compiler::compile_step(Jit::Instruction const& instruction, std::size_t count, bool last)
+{
+        store_registers();
+        flush_cycles();
+        assembler_.load(Size::qword, rdi, host, offsetof(Host, context));
+        assembler_.move(rsi, instruction.operand);
+        assembler_.call(reinterpret_cast<void const*>(instruction.step));
+        if (last) {
+                assembler_.move(rax, count);
+                assembler_.jump(epilogue_);
+                return;
+        }
+        assembler_.test_return_value();
+        leave_if_false(count, std::nullopt);
+        load_registers();
+}
+
+/**
+ * Reads the operand into the operand slot, and leaves whether to go on
+ * in the go-on slot. Zero-page addresses wrap around within the page.
+ */
+void Compiler::read(Opcodes::OpcodeInfo const& info, Address operand)
+{
+        using Mode = Opcodes::AddressingMode;
+        prepare_call();
+        if (info.mode == Mode::zero_page_x || info.mode == Mode::zero_page_y) {
+                assembler_.move(rsi, info.mode == Mode::zero_page_x ? x_register : y_register);
+                assembler_.add_byte(rsi, operand);
+        } else {
+                assembler_.move(rsi, operand);
+        }
+        if (info.mode == Mode::zero_page || info.mode == Mode::zero_page_x || info.mode == Mode::zero_page_y) {
+                assembler_.load_address(rdx, rsp, operand_slot);
+                assembler_.call(host, bus_offset(offsetof(Bus, read_zero_page)));
+        } else {
+                if (info.mode == Mode::absolute)
+                        assembler_.move(rdx, std::uint32_t {0});
+                else
+                        assembler_.move(rdx, info.mode == Mode::absolute_x ? x_register : y_register);
+                assembler_.load_address(rcx, rsp, operand_slot);
+                assembler_.call(host, bus_offset(offsetof(Bus, read_absolute)));
+        }
+        assembler_.store(Size::byte, rsp, go_on_slot, rax);
+        assembler_.load_byte(rcx, rsp, operand_slot);
+}
+
+void Compiler::write(Opcodes::OpcodeInfo const& info, Register source, Address operand, Address next,
+                     std::size_t count)
+{
+        using Mode = Opcodes::AddressingMode;
+        prepare_call();
+        switch (info.mode) {
+                case Mode::zero_page_x:
+                case Mode::zero_page_y:
+                        assembler_.move(rsi, info.mode == Mode::zero_page_x ? x_register : y_register);
+                        assembler_.add_byte(rsi, operand);
+                        assembler_.move(rdx, source);
+                        assembler_.call(host, bus_offset(offsetof(Bus, write_zero_page)));
+                        break;
+                case Mode::zero_page:
+                        assembler_.move(rsi, operand);
+                        assembler_.move(rdx, source);
+                        assembler_.call(host, bus_offset(offsetof(Bus, write_zero_page)));
+                        break;
+                case Mode::absolute:
+                        assembler_.move(rsi, operand);
+                        assembler_.move(rdx, source);
+                        assembler_.call(host, bus_offset(offsetof(Bus, write_absolute)));
+                        break;
+                default:
+                        assembler_.move(rsi, operand);
+                        assembler_.move(rdx, info.mode == Mode::absolute_x ? x_register : y_register);
+                        assembler_.move(rcx, source);
+                        assembler_.call(host, bus_offset(offsetof(Bus, write_indexed)));
+                        break;
+        }
+        assembler_.test_return_value();
+        leave_if_false(count, next);
+}
+
+/**
+ * Does what Registers in recompiled.h does, with the operand in cl.
+ * x86's 8-bit ADC sets the carry and overflow flags just like the
+ * 6502's, and SBC is ADC of the inverted operand on both.
+ */
+void Compiler::operate(Operation operation)
+{
+        auto const compare = [this](Register reg) {
+                assembler_.move(rax, reg);
+                assembler_.subtract(rax, rcx);
+                assembler_.set_if(no_carry, rsp, carry_slot + 1);
+                set_result(rax);
+        };
+        auto const transfer = [this](Register destination, Register source) {
+                assembler_.move(destination, source);
+                set_result(destination);
+        };
+
+        switch (operation) {
+                case Operation::load_a: transfer(accumulator, rcx); break;
+                case Operation::load_x: transfer(x_register, rcx); break;
+                case Operation::load_y: transfer(y_register, rcx); break;
+                case Operation::subtract:
+                        assembler_.invert_byte(rcx);
+                        [[fallthrough]];
+                case Operation::add:
+                        assembler_.test_bit(rsp, carry_slot, Alu::carry_bit);
+                        assembler_.add_with_carry(accumulator, rcx);
+                        assembler_.set_if(carry, rsp, carry_slot + 1);
+                        assembler_.set_if(overflow, rax);
+                        assembler_.shift_left_byte(rax, sign_bit);
+                        assembler_.store(Size::byte, rsp, overflow_slot, rax);
+                        set_result(accumulator);
+                        break;
+                case Operation::bitwise_and:
+                        assembler_.bitwise_and(accumulator, rcx);
+                        set_result(accumulator);
+                        break;
+                case Operation::bitwise_or:
+                        assembler_.bitwise_or(accumulator, rcx);
+                        set_result(accumulator);
+                        break;
+                case Operation::bitwise_xor:
+                        assembler_.bitwise_xor(accumulator, rcx);
+                        set_result(accumulator);
+                        break;
+                case Operation::compare_a: compare(accumulator); break;
+                case Operation::compare_x: compare(x_register); break;
+                case Operation::compare_y: compare(y_register); break;
+                case Operation::bit:
+                        assembler_.store(Size::byte, rsp, negative_slot, rcx);
+                        assembler_.move(rax, rcx);
+                        assembler_.shift_left_byte(rax, 1);
+                        assembler_.store(Size::byte, rsp, overflow_slot, rax);
+                        assembler_.move(rax, accumulator);
+                        assembler_.bitwise_and(rax, rcx);
+                        assembler_.store(Size::byte, rsp, zero_slot, rax);
+                        break;
+                case Operation::increment_x:
+                        assembler_.increment_byte(x_register);
+                        set_result(x_register);
+                        break;
+                case Operation::increment_y:
+                        assembler_.increment_byte(y_register);
+                        set_result(y_register);
+                        break;
+                case Operation::decrement_x:
+                        assembler_.decrement_byte(x_register);
+                        set_result(x_register);
+                        break;
+                case Operation::decrement_y:
+                        assembler_.decrement_byte(y_register);
+                        set_result(y_register);
+                        break;
+                case Operation::transfer_a_x: transfer(x_register, accumulator); break;
+                case Operation::transfer_a_y: transfer(y_register, accumulator); break;
+                case Operation::transfer_x_a: transfer(accumulator, x_register); break;
+                case Operation::transfer_y_a: transfer(accumulator, y_register); break;
+                case Operation::clear_carry: assembler_.store_byte(rsp, carry_slot + 1, 0); break;
+                case Operation::set_carry: assembler_.store_byte(rsp, carry_slot + 1, 1); break;
+                case Operation::clear_overflow: assembler_.store_byte(rsp, overflow_slot, 0); break;
+                case Operation::store_a:
+                case Operation::store_x:
+                case Operation::store_y:
+                case Operation::nothing:
+                        break;
+        }
+}
+
+/**
+ * Only a block's last instruction can be a branch.
+ */
+void Compiler::branch(Branch const& branch, Address target, Address next, std::size_t count)
+{
+        flush_cycles();
+        Condition set;
+        if (branch.mask) {
+                assembler_.test_byte(rsp, branch.slot, branch.mask);
+                set = not_zero;
+        } else {
+                assembler_.compare_byte(rsp, branch.slot, 0);
+                set = zero;
+        }
+        Condition const clear = set == zero ? not_zero : zero;
+        Assembler::Label const not_taken = assembler_.new_label();
+        assembler_.jump_if(branch.if_set ? clear : set, not_taken);
+        assembler_.add_to_quadword(cycle_counter, 0, 1 + ((next ^ target) >> CHAR_BIT != 0));
+        leave(count, target);
+        assembler_.place(not_taken);
+        leave(count, next);
+}
+
+void Compiler::leave(std::size_t count, Address pc)
+{
+        flush_cycles();
+        assembler_.move(rax, count);
+        assembler_.move(rsi, pc);
+        assembler_.jump(leave_);
+}
+
+/**
+ * Leaves if the zero flag is set, which is what the bus and the steps
+ * return when the block has to be left.
+ */
+void Compiler::leave_if_false(std::size_t count, std::optional<Address> pc)
+{
+        Assembler::Label const exit = assembler_.new_label();
+        assembler_.jump_if(zero, exit);
+        exits_.push_back({exit, count, pc});
+}
+
+/**
+ * The bus gets the cycles right up to the access.
+ */
+void Compiler::prepare_call()
+{
+        flush_cycles();
+        assembler_.load(Size::qword, rdi, host, offsetof(Host, context));
+}
+
+/**
+ * Z and N both come from the result.
+ */
+void Compiler::set_result(Register reg)
+{
+        assembler_.store(Size::byte, rsp, zero_slot, reg);
+        assembler_.store(Size::byte, rsp, negative_slot, reg);
+}
+
+void Compiler::load_registers()
+{
+        for (auto const& [reg, offset] : {std::pair {accumulator, offsetof(Registers, a)},
+                                         std::pair {x_register, offsetof(Registers, x)},
+                                         std::pair {y_register, offsetof(Registers, y)}}) {
+                assembler_.load(Size::qword, rdx, host, register_offset(offset));
+                assembler_.load_byte(reg, rdx, 0);
+        }
+        assembler_.load(Size::qword, rdx, host, register_offset(offsetof(Registers, carry_result)));
+        assembler_.load(Size::dword, rcx, rdx, 0);
+        assembler_.store(Size::dword, rsp, carry_slot, rcx);
+        for (auto const& [slot, offset] : {std::pair {zero_slot, offsetof(Registers, zero_result)},
+                                          std::pair {negative_slot, offsetof(Registers, negative_result)},
+                                          std::pair {overflow_slot, offsetof(Registers, overflow_result)}}) {
+                assembler_.load(Size::qword, rdx, host, register_offset(offset));
+                assembler_.load_byte(rcx, rdx, 0);
+                assembler_.store(Size::byte, rsp, slot, rcx);
+        }
+}
+
+/**
+ * Leaves eax and esi alone.
+ */
+void Compiler::store_registers()
+{
+        for (auto const& [reg, offset] : {std::pair {accumulator, offsetof(Registers, a)},
+                                         std::pair {x_register, offsetof(Registers, x)},
+                                         std::pair {y_register, offsetof(Registers, y)}}) {
+                assembler_.load(Size::qword, rdx, host, register_offset(offset));
+                assembler_.store(Size::byte, rdx, 0, reg);
+        }
+        assembler_.load(Size::qword, rdx, host, register_offset(offsetof(Registers, carry_result)));
+        assembler_.load(Size::dword, rcx, rsp, carry_slot);
+        assembler_.store(Size::dword, rdx, 0, rcx);
+        for (auto const& [slot, offset] : {std::pair {zero_slot, offsetof(Registers, zero_result)},
+                                          std::pair {negative_slot, offsetof(Registers, negative_result)},
+                                          std::pair {overflow_slot, offsetof(Registers, overflow_result)}}) {
+                assembler_.load(Size::qword, rdx, host, register_offset(offset));
+                assembler_.load_byte(rcx, rsp, slot);
+                assembler_.store(Size::byte, rdx, 0, rcx);
+        }
+}
+
+/**
+ * Cycles are added up as instructions go by, and only written out
+ * before the CPU can see them.
+ */
+void Compiler::flush_cycles()
+{
+        if (pending_cycles_ == 0)
+                return;
+        assembler_.add_to_quadword(cycle_counter, 0, pending_cycles_);
+        pending_cycles_ = 0;
+}
+
+}
+
+CantAllocateCode::CantAllocateCode() noexcept
+        : runtime_error("Can't allocate memory for compiled code.")
+{}
+
+Jit::Code::Code(std::vector<Byte> const& machine_code)
+{
+        auto const page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        size_ = (machine_code.size() + page_size - 1) / page_size * page_size;
+        memory_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory_ == MAP_FAILED)
+                throw CantAllocateCode();
+
+        std::memcpy(memory_, machine_code.data(), machine_code.size());
+        if (mprotect(memory_, size_, PROT_READ | PROT_EXEC) != 0) {
+                munmap(memory_, size_);
+                throw CantAllocateCode();
+        }
+}
+
+Jit::Code::~Code()
+{
+        munmap(memory_, size_);
+}
+
+std::size_t Jit::Code::run(Recompiled::Host const& host) const
+{
+        auto const entry = reinterpret_cast<Entry>(memory_);
+        return entry(&host);
+}
+
+Jit::Jit()
+{
+        worker_ = std::thread(&Jit::work, this);
+}
+
+Jit::~Jit()
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+        }
+        requested_.notify_one();
+        worker_.join();
+}
+
+std::vector<Byte> Jit::generate(std::vector<Instruction> const& instructions)
+{
+        return Compiler().compile(instructions);
+}
+
+void Jit::compile_later(Address address, std::uint64_t serial, std::vector<Instruction> instructions)
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                requests_.push_back({address, serial, std::move(instructions)});
+        }
+        requested_.notify_one();
+}
+
+bool Jit::has_compiled() const noexcept
+{
+        return has_compiled_.load(std::memory_order_acquire);
+}
+
+std::vector<Jit::Compiled> Jit::take_compiled()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        has_compiled_.store(false, std::memory_order_relaxed);
+        return std::exchange(compiled_, {});
+}
+
+void Jit::work()
+{
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+                requested_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+                if (stopping_)
+                        return;
+
+                Request request = std::move(requests_.front());
+                requests_.pop_front();
+
+                lock.unlock();
+                std::unique_ptr<Code> code;
+                try {
+                        code = std::make_unique<Code>(generate(request.instructions));
+                } catch (CantAllocateCode const&) {
+                        // The block just stays interpreted.
+                }
+                lock.lock();
+
+                if (!code)
+                        continue;
+                compiled_.push_back({request.address, request.serial, std::move(code)});
+                has_compiled_.store(true, std::memory_order_release);
+        }
+}
+
+}
+
@@ -0,0 +1,115 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include "recompiled.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Emulator {
+
+class CantAllocateCode : public std::runtime_error {
+public:
+        CantAllocateCode() noexcept;
+};
+
+/**
+ * Turns a block of already decoded 6502 instructions into x86-64 code.
+ * Loads, stores, ALU operations, register transfers and branches are
+ * compiled to what they do, like nes-recompile does: A, X and Y live in
+ * host registers for the length of the block, and memory is reached
+ * through the CPU's bus, the same as recompiled code. Other
+ * instructions, and those left to the interpreter (like I/O), call the
+ * CPU's step for their opcode. Steps and bus accesses return false when
+ * the block has to be left early (e.g. because it overwrote code, or
+ * threw an exception that was stashed away for the caller).
+ *
+ * Compilation happens on a background thread, so the interpreter can
+ * keep running the block until its native code is ready. Blocks whose
+ * code can't be allocated are dropped, and stay interpreted.
+ */
+class Jit {
+public:
+        using Step = Recompiled::Step;
+
+        struct Instruction {
+                Address address;
+                Byte opcode;
+                Address operand;
+                Byte cycles;
+                Step step;
+                bool interpret; // Just call the step
+        };
+
+        /**
+         * A compiled block. It lives in its own mapping, which is
+         * readable and executable but never writable at the same time.
+         */
+        class Code {
+        public:
+                using Entry = std::size_t (*)(Recompiled::Host const* host);
+
+                explicit Code(std::vector<Byte> const& machine_code);
+                Code(Code const&) = delete;
+                Code(Code&&) = delete;
+                Code& operator=(Code const&) = delete;
+                Code& operator=(Code&&) = delete;
+                ~Code();
+
+                /**
+                 * Returns how many instructions were executed.
+                 */
+                std::size_t run(Recompiled::Host const& host) const;
+
+        private:
+                void* memory_;
+                std::size_t size_;
+        };
+
+        struct Compiled {
+                Address address;
+                std::uint64_t serial;
+                std::unique_ptr<Code> code;
+        };
+
+        Jit();
+        Jit(Jit const&) = delete;
+        Jit(Jit&&) = delete;
+        Jit& operator=(Jit const&) = delete;
+        Jit& operator=(Jit&&) = delete;
+        ~Jit();
+
+        static std::vector<Byte> generate(std::vector<Instruction> const& instructions);
+
+        void compile_later(Address address, std::uint64_t serial, std::vector<Instruction> instructions);
+        bool has_compiled() const noexcept;
+        std::vector<Compiled> take_compiled();
+
+private:
+        struct Request {
+                Address address;
+                std::uint64_t serial;
+                std::vector<Instruction> instructions;
+        };
+
+        void work();
+
+        std::mutex mutex_;
+        std::condition_variable requested_;
+        std::deque<Request> requests_;
+        std::vector<Compiled> compiled_;
+        std::atomic<bool> has_compiled_ {false};
+        bool stopping_ = false;
+        std::thread worker_;
+};
+
+}
+
@@ -0,0 +1,132 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "labels.h"
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace Emulator {
+
+namespace {
+
+unsigned constexpr asm6_address_digits = 5;
+std::string::size_type constexpr asm6_source_column = 32;
+
+bool is_hex(std::string const& s) noexcept
+{
+        return !s.empty() && s.find_first_not_of("0123456789ABCDEFabcdef") == std::string::npos;
+}
+
+bool is_label_start(char c) noexcept
+{
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/**
+ * al 00C000 .reset
+ */
+bool parse_vice(std::string const& line, Labels& labels)
+{
+        std::istringstream in(line);
+        std::string command, address, name;
+        if (!(in >> command >> address >> name) || command != "al" || !is_hex(address) ||
+            name.size() < 2 || name[0] != '.')
+                return false;
+        labels.add(std::stoul(address, nullptr, 16), name.substr(1));
+        return true;
+}
+
+/**
+ * sym	id=3,name="reset",addrsize=absolute,scope=0,def=12,ref=5,val=0xC000,seg=1,type=lab
+ */
+bool parse_ca65_debug(std::string const& line, Labels& labels)
+{
+        if (line.compare(0, 4, "sym\t") != 0 || line.find("type=lab") == std::string::npos)
+                return false;
+        auto const name_start = line.find("name=\"");
+        auto const value_start = line.find("val=0x");
+        if (name_start == std::string::npos || value_start == std::string::npos)
+                return false;
+        auto const name_end = line.find('"', name_start + 6);
+        if (name_end == std::string::npos)
+                return false;
+        labels.add(std::stoul(line.substr(value_start + 6), nullptr, 16),
+                   line.substr(name_start + 6, name_end - name_start - 6));
+        return true;
+}
+
+/**
+ * 0C000 78                        reset: sei
+ *
+ * Local labels (starting with @) are left out.
+ */
+bool parse_asm6_listing(std::string const& line, Labels& labels)
+{
+        if (line.size() <= asm6_source_column || !is_hex(line.substr(0, asm6_address_digits)))
+                return false;
+        std::string const source = line.substr(asm6_source_column);
+        if (source.empty() || !is_label_start(source[0]))
+                return false;
+        auto const colon = source.find(':');
+        auto const name_end = source.find_first_of(" \t=");
+        if (colon == std::string::npos || (name_end != std::string::npos && name_end < colon))
+                return false;
+        labels.add(std::stoul(line.substr(0, asm6_address_digits), nullptr, 16), source.substr(0, colon));
+        return true;
+}
+
+}
+
+void Labels::load(std::string const& path)
+{
+        std::ifstream in(path);
+        if (!in)
+                throw CantOpenFile(path);
+        load(in);
+}
+
+void Labels::load(std::istream& in)
+{
+        for (std::string line; std::getline(in, line);) {
+                if (!line.empty() && line.back() == '\r')
+                        line.pop_back();
+                if (!parse_vice(line, *this) && !parse_ca65_debug(line, *this))
+                        parse_asm6_listing(line, *this);
+        }
+}
+
+void Labels::add(Address address, std::string name)
+{
+        labels_.emplace(address, std::move(name));
+}
+
+bool Labels::empty() const noexcept
+{
+        return labels_.empty();
+}
+
+std::string const* Labels::find(Address address) const noexcept
+{
+        auto const i = labels_.find(address);
+        return i == labels_.end() ? nullptr : &i->second;
+}
+
+std::string Labels::describe(Address address) const
+{
+        auto i = labels_.upper_bound(address);
+        if (i != labels_.begin()) {
+                --i;
+                unsigned const offset = address - i->first;
+                if (offset == 0)
+                        return i->second;
+                if (offset < 0x100)
+                        return i->second + "+" + std::to_string(offset);
+        }
+
+        std::ostringstream ss;
+        ss << '$' << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << address;
+        return ss.str();
+}
+
+}
@@ -0,0 +1,46 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <istream>
+#include <map>
+#include <string>
+
+namespace Emulator {
+
+/**
+ * Names for addresses in the guest code, from the files assemblers
+ * write next to a ROM.
+ */
+class Labels {
+public:
+        /**
+         * Understands ca65 debug files (ld65 --dbgfile), VICE label
+         * files (ld65 -Ln) and asm6 listings (asm6 -l), and skips lines
+         * it doesn't recognize, so files of all kinds can be loaded
+         * one after the other. The first label loaded for an address
+         * is the one that's kept.
+         */
+        void load(std::string const& path);
+        void load(std::istream& in);
+
+        void add(Address address, std::string name);
+        bool empty() const noexcept;
+
+        /**
+         * The label at the address, or nullptr.
+         */
+        std::string const* find(Address address) const noexcept;
+
+        /**
+         * E.g. "reset", "loop+2", or "$C012" if there's no label at
+         * most a page before the address.
+         */
+        std::string describe(Address address) const;
+
+private:
+        std::map<Address, std::string> labels_;
+};
+
+}
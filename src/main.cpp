@@ -6,8 +6,17 @@
 #include "ppu.h"
 #include "joypad.h"
 #include "rendering.h"
+#include "recompiled.h"
+#include "labels.h"
+#include "profiler.h"
+#include "debugger.h"
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <string>
 #include <utility>
+#include <vector>
 
 using namespace std::string_literals;
 
@@ -18,13 +27,167 @@ using namespace std::string_literals;
 
 namespace {
 
-unsigned constexpr vblanks_per_second = 60;
-unsigned constexpr min_instructions_during_vblank = 10;
+unsigned constexpr frames_per_second = 60;
+Emulator::Cycles constexpr cycles_per_frame = 29781; // 341 PPU dots * 262 scanlines / 3 dots per cycle
+Emulator::Cycles constexpr vblank_start = 27393; // 341 PPU dots * 241 scanlines / 3 dots per cycle
 auto constexpr title = "";
 
+/**
+ * nes-emulator [--profile=<prefix>] [--labels=<file>]... [--sample-period=<cycles>]
+ *              [--statistics=<file>] [--trace=<file>] [--trace-size=<instructions>]
+ *              [--break=<address>]... [--watch=<first>[-<last>][:r|:w|:rw]]...
+ *              [--strict] <rom> [<recompiled rom>]
+ *
+ * With --profile, the guest code is profiled, and the flat profile and
+ * the folded stacks are written to <prefix>.txt and <prefix>.folded on
+ * exit.
+ *
+ * With --statistics, the CPU's counters are written to the file on
+ * exit, as JSON if its name ends in .json and as CSV otherwise. The
+ * emulator has to be built with cmake -DSTATISTICS=ON for that.
+ *
+ * With --trace, the last --trace-size instructions (about a million by
+ * default) are saved to the file on exit. nes-trace turns it into a
+ * log like nestest.log.
+ *
+ * --break and --watch (addresses in hex) print the registers whenever
+ * the CPU gets to a breakpoint or is about to access watched memory,
+ * and carry on. Watchpoints watch reads and writes unless told otherwise.
+ *
+ * With --strict, the reads and writes of addresses nothing is at, which
+ * see the open bus, are counted, and the counts printed on exit.
+ */
+struct Options {
+        std::vector<std::string> positional;
+        std::optional<std::string> profile;
+        std::optional<std::string> statistics;
+        std::optional<std::string> trace;
+        std::size_t trace_size = Emulator::TraceBuffer::default_capacity;
+        std::vector<Emulator::Address> breakpoints;
+        std::vector<std::string> watchpoints;
+        std::vector<std::string> labels;
+        Emulator::Cycles sample_period = Emulator::Profiler::default_sample_period;
+        bool strict = false;
+};
+
+std::optional<Options> parse_options(int argc, char** argv)
+{
+        auto const value = [](std::string const& argument, std::string const& option) -> std::optional<std::string> {
+                if (argument.compare(0, option.size(), option) != 0)
+                        return std::nullopt;
+                return argument.substr(option.size());
+        };
+
+        Options options;
+        for (int i = 1; i < argc; ++i) {
+                std::string const argument = argv[i];
+                if (auto const prefix = value(argument, "--profile="))
+                        options.profile = *prefix;
+                else if (auto const file = value(argument, "--labels="))
+                        options.labels.push_back(*file);
+                else if (auto const period = value(argument, "--sample-period="))
+                        options.sample_period = std::stoull(*period);
+                else if (auto const file = value(argument, "--statistics="))
+                        options.statistics = *file;
+                else if (auto const file = value(argument, "--trace="))
+                        options.trace = *file;
+                else if (auto const size = value(argument, "--trace-size="))
+                        options.trace_size = std::stoull(*size);
+                else if (auto const address = value(argument, "--break="))
+                        options.breakpoints.push_back(std::stoul(*address, nullptr, 16));
+                else if (auto const watchpoint = value(argument, "--watch="))
+                        options.watchpoints.push_back(*watchpoint);
+                else if (argument == "--strict")
+                        options.strict = true;
+                else if (argument.compare(0, 2, "--") == 0)
+                        return std::nullopt;
+                else
+                        options.positional.push_back(argument);
+        }
+        if (options.positional.empty() || options.positional.size() > 2 || options.sample_period == 0)
+                return std::nullopt;
+        return options;
+}
+
+/**
+ * E.g. 0200-02FF:w
+ */
+void add_watchpoint(Emulator::Debugger& debugger, std::string const& watchpoint)
+{
+        using Access = Emulator::Debugger::Access;
+        auto const colon = watchpoint.find(':');
+        std::string const range = watchpoint.substr(0, colon);
+        std::string const access = colon == std::string::npos ? "rw" : watchpoint.substr(colon + 1);
+        auto const dash = range.find('-');
+        Emulator::Address const first = std::stoul(range.substr(0, dash), nullptr, 16);
+        Emulator::Address const last = dash == std::string::npos ? first
+                                                                 : std::stoul(range.substr(dash + 1), nullptr, 16);
+        debugger.add_watchpoint(first, last,
+                                access == "r" ? Access::read :
+                                access == "w" ? Access::write :
+                                Access::read_write);
+}
+
+void report(Emulator::Debugger::Hit const& hit, Emulator::Labels const& labels)
+{
+        using Kind = Emulator::Debugger::Hit::Kind;
+        auto const& registers = hit.registers;
+        std::cout << (hit.kind == Kind::breakpoint ? "Breakpoint" : hit.kind == Kind::read ? "Read" : "Write");
+        if (hit.kind != Kind::breakpoint)
+                std::cout << " of " << labels.describe(hit.address);
+        std::cout << " at " << labels.describe(registers.pc) << ":" << std::hex << std::uppercase
+                  << " A:" << unsigned {registers.a} << " X:" << unsigned {registers.x}
+                  << " Y:" << unsigned {registers.y} << " P:" << unsigned {registers.p}
+                  << " SP:" << unsigned {registers.sp} << std::dec << std::nouppercase << '\n';
+}
+
+struct Tools {
+        Emulator::Profiler* profiler;
+        Emulator::Debugger const& debugger;
+        Emulator::Labels const& labels;
+};
+
+/**
+ * Interrupts don't need any help from here: their sources
+ * assert them on the CPU's interrupt lines.
+ */
+void run_until(Emulator::CPU& cpu, Tools const& tools, Emulator::Cycles end)
+{
+        while (cpu.cycles() < end) {
+                Emulator::Cycles budget = end - cpu.cycles();
+                if (tools.profiler)
+                        budget = std::min(budget, tools.profiler->sample_period());
+                auto const result = cpu.run(budget);
+                if (tools.profiler)
+                        tools.profiler->sample(cpu.pc(), cpu.cycles());
+                if (result.reason == Emulator::CPU::StopReason::breakpoint)
+                        report(*tools.debugger.last_hit(), tools.labels);
+        }
+}
+
+void write_profile(Emulator::Profiler const& profiler, std::string const& prefix)
+{
+        std::ofstream flat(prefix + ".txt");
+        profiler.write_flat_profile(flat);
+        std::ofstream folded(prefix + ".folded");
+        profiler.write_folded_stacks(folded);
+}
+
+void write_statistics(Emulator::Statistics const& statistics, std::string const& path)
+{
+        std::vector<std::string> const piece_names {"RAM", "PPU", "mapper", "joypad"};
+        std::ofstream out(path);
+        bool const json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json)
+                statistics.write_json(out, piece_names);
+        else
+                statistics.write_csv(out, piece_names);
+}
+
 int main_loop(int argc, char** argv)
 {
-        if (argc != 2) {
+        auto const options = parse_options(argc, argv);
+        if (!options) {
                 std::cout << "Incorrect command-line arguments.\n";
                 return 1;
         }
@@ -40,7 +203,15 @@ int main_loop(int argc, char** argv)
                 {Emulator::JoypadButton::right, Sdl::Scancode::right}
         };
 
-        Emulator::Cartridge cartridge(argv[1]);
+        Emulator::Cartridge cartridge(options->positional[0]);
+        // Optionally, the ROM recompiled by nes-recompile.
+        std::unique_ptr<Emulator::Recompiled::SharedLibrary> const recompiled =
+                options->positional.size() == 2
+                        ? std::make_unique<Emulator::Recompiled::SharedLibrary>(options->positional[1])
+                        : nullptr;
+        Emulator::Labels labels;
+        for (auto const& file : options->labels)
+                labels.load(file);
         Emulator::JoypadMemory joypad_memory(Sdl::get_keyboard_state(), key_bindings);
         auto memory_mapper = Emulator::MemoryMapper::make(cartridge);
         auto const ram = std::make_unique<Emulator::CPU::RAM>();
@@ -48,6 +219,33 @@ int main_loop(int argc, char** argv)
         auto const cpu = std::make_unique<Emulator::CPU>(
                 Emulator::CPU::AccessibleMemory::Pieces{ram.get(), ppu.get(),
                                                         memory_mapper.get(), &joypad_memory});
+        if (recompiled)
+                cpu->use_recompiled_code(recompiled->library());
+        cpu->set_strict(options->strict);
+        if (options->statistics && !cpu->statistics()) {
+                std::cout << "Built without statistics; rebuild with cmake -DSTATISTICS=ON.\n";
+                return 1;
+        }
+        std::unique_ptr<Emulator::TraceBuffer> const trace =
+                options->trace ? std::make_unique<Emulator::TraceBuffer>(options->trace_size) : nullptr;
+        cpu->trace_to(trace.get());
+        std::unique_ptr<Emulator::Profiler> const profiler =
+                options->profile ? std::make_unique<Emulator::Profiler>(labels, options->sample_period) : nullptr;
+        if (profiler)
+                cpu->observe_calls(profiler.get());
+        Emulator::Debugger debugger;
+        for (Emulator::Address const address : options->breakpoints)
+                debugger.add_breakpoint(address);
+        for (auto const& watchpoint : options->watchpoints)
+                add_watchpoint(debugger, watchpoint);
+        cpu->debug_with(&debugger);
+        Tools const tools {profiler.get(), debugger, labels};
+        ppu->on_nmi([&cpu = *cpu](bool asserted)
+                    {
+                            cpu.set_interrupt_line(Emulator::CPU::Interrupt::nmi,
+                                                   Emulator::CPU::InterruptSource::ppu,
+                                                   asserted);
+                    });
 
         Sdl::InitGuard init_guard;
         (void)init_guard;
@@ -55,32 +253,49 @@ int main_loop(int argc, char** argv)
         Sdl::Context const context = Sdl::create_context(title, Emulator::screen_width * 2, Emulator::screen_height * 2);
 
         /**
-         * A vblank occurs vblanks_per_second times per second, also meaning
-         * the screen is redrawn that many times each second.
-         * During a vblank, the emulator will execute at least min_instructions_during_vblank instructions.
+         * Each frame runs the CPU for exactly cycles_per_frame cycles,
+         * with vblank starting vblank_start cycles in, then draws the
+         * screen and sleeps for whatever is left of the frame's share
+         * of real time. Cycles left over from the last instruction of a
+         * frame are taken away from the next one.
          */
 
-        Sdl::Ticks const delay_ms = 1000 / vblanks_per_second;
-        Sdl::Ticks last_vblank_ms = Sdl::get_ticks();
-        unsigned instructions_executed = 0;
-        unsigned debug_instructions_executed = 0; // TODO Delete this
+        Sdl::Ticks const frame_ms = 1000 / frames_per_second;
+        Emulator::Cycles frame_end = 0;
         for (bool quit = false; !quit; quit = Sdl::quit_requested()) {
-                if (instructions_executed >= min_instructions_during_vblank) {
-                        auto const current_time_ms = Sdl::get_ticks();
-                        if (current_time_ms - last_vblank_ms >= delay_ms) {
-                                instructions_executed = 0;
-                                last_vblank_ms = current_time_ms;
-                                Sdl::render_clear(*context.renderer);
-                                Emulator::render_screen(*context.renderer, ppu->current_screen());
-                                Sdl::render_present(*context.renderer);
-                        }
-                }
-                cpu->execute_instruction();
-                ++instructions_executed;
-                ++debug_instructions_executed;
-                std::cout << debug_instructions_executed << '\n';
+                Sdl::Ticks const frame_start_ms = Sdl::get_ticks();
+                Emulator::Cycles const frame_start = frame_end;
+                frame_end += cycles_per_frame;
+                run_until(*cpu, tools, frame_start + vblank_start);
+                ppu->vblank_started();
+                run_until(*cpu, tools, frame_end);
+                ppu->vblank_finished();
+
+                Sdl::render_clear(*context.renderer);
+                Emulator::render_screen(*context.renderer, ppu->current_screen());
+                Sdl::render_present(*context.renderer);
+
+                Sdl::Ticks const elapsed_ms = Sdl::get_ticks() - frame_start_ms;
+                if (elapsed_ms < frame_ms)
+                        Sdl::delay(frame_ms - elapsed_ms);
         }
 
+        cpu->debug_with(nullptr);
+        if (profiler) {
+                cpu->observe_calls(nullptr);
+                write_profile(*profiler, *options->profile);
+        }
+        if (options->statistics)
+                write_statistics(*cpu->statistics(), *options->statistics);
+        if (options->strict) {
+                std::cout << cpu->invalid_accesses().reads << " invalid reads, "
+                          << cpu->invalid_accesses().writes << " invalid writes\n";
+        }
+        if (trace) {
+                cpu->trace_to(nullptr);
+                std::ofstream out(*options->trace, std::ios::binary);
+                trace->save(out);
+        }
         return 0;
 }
 
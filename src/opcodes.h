@@ -0,0 +1,320 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace Emulator {
+
+/**
+ * What's known about each opcode before executing it. Everything that
+ * depends on the opcode alone (the CPU's dispatch table and cycle
+ * counts, the block decoder and the recompiler) is derived from the
+ * one table below, so they can't disagree with each other.
+ */
+namespace Opcodes {
+
+enum class AddressingMode : Byte {
+        implied,
+        accumulator,
+        immediate,
+        relative,
+        zero_page,
+        zero_page_x,
+        zero_page_y,
+        absolute,
+        absolute_x,
+        absolute_y,
+        indirect,
+        indirect_x, // (zp,X)
+        indirect_y  // (zp),Y
+};
+
+/**
+ * What an instruction does with the memory its operand refers to.
+ * The stack, and the pointers of indirect addressing, don't count.
+ */
+enum class MemoryAccess : Byte {
+        none,
+        read,
+        write,
+        read_modify_write
+};
+
+struct OpcodeInfo {
+        std::string_view mnemonic;
+        AddressingMode mode;
+        Byte length; // In bytes, including the opcode
+        /**
+         * Not including the extra cycle for crossing a page
+         * boundary, or the extra cycles of a taken branch.
+         */
+        Byte cycles;
+        bool page_cross_penalty;
+        MemoryAccess access;
+        bool uses_stack;
+        bool jumps; // Sets the program counter itself (not branches)
+        bool known;
+};
+
+namespace Definitions {
+
+using Mode = AddressingMode;
+using Access = MemoryAccess;
+
+struct Definition {
+        Byte opcode;
+        std::string_view mnemonic;
+        Mode mode;
+        Byte cycles;
+        Access access;
+};
+
+inline constexpr Definition definitions[] {
+        {0x00, "BRK", Mode::implied, 7, Access::none},
+        {0x01, "ORA", Mode::indirect_x, 6, Access::read},
+        {0x05, "ORA", Mode::zero_page, 3, Access::read},
+        {0x06, "ASL", Mode::zero_page, 5, Access::read_modify_write},
+        {0x08, "PHP", Mode::implied, 3, Access::none},
+        {0x09, "ORA", Mode::immediate, 2, Access::none},
+        {0x0A, "ASL", Mode::accumulator, 2, Access::none},
+        {0x0D, "ORA", Mode::absolute, 4, Access::read},
+        {0x0E, "ASL", Mode::absolute, 6, Access::read_modify_write},
+        {0x10, "BPL", Mode::relative, 2, Access::none},
+        {0x11, "ORA", Mode::indirect_y, 5, Access::read},
+        {0x15, "ORA", Mode::zero_page_x, 4, Access::read},
+        {0x16, "ASL", Mode::zero_page_x, 6, Access::read_modify_write},
+        {0x18, "CLC", Mode::implied, 2, Access::none},
+        {0x19, "ORA", Mode::absolute_y, 4, Access::read},
+        {0x1D, "ORA", Mode::absolute_x, 4, Access::read},
+        {0x1E, "ASL", Mode::absolute_x, 7, Access::read_modify_write},
+        {0x20, "JSR", Mode::absolute, 6, Access::none},
+        {0x21, "AND", Mode::indirect_x, 6, Access::read},
+        {0x24, "BIT", Mode::zero_page, 3, Access::read},
+        {0x25, "AND", Mode::zero_page, 3, Access::read},
+        {0x26, "ROL", Mode::zero_page, 5, Access::read_modify_write},
+        {0x28, "PLP", Mode::implied, 4, Access::none},
+        {0x29, "AND", Mode::immediate, 2, Access::none},
+        {0x2A, "ROL", Mode::accumulator, 2, Access::none},
+        {0x2C, "BIT", Mode::absolute, 4, Access::read},
+        {0x2D, "AND", Mode::absolute, 4, Access::read},
+        {0x2E, "ROL", Mode::absolute, 6, Access::read_modify_write},
+        {0x30, "BMI", Mode::relative, 2, Access::none},
+        {0x31, "AND", Mode::indirect_y, 5, Access::read},
+        {0x35, "AND", Mode::zero_page_x, 4, Access::read},
+        {0x36, "ROL", Mode::zero_page_x, 6, Access::read_modify_write},
+        {0x38, "SEC", Mode::implied, 2, Access::none},
+        {0x39, "AND", Mode::absolute_y, 4, Access::read},
+        {0x3D, "AND", Mode::absolute_x, 4, Access::read},
+        {0x3E, "ROL", Mode::absolute_x, 7, Access::read_modify_write},
+        {0x40, "RTI", Mode::implied, 6, Access::none},
+        {0x41, "EOR", Mode::indirect_x, 6, Access::read},
+        {0x45, "EOR", Mode::zero_page, 3, Access::read},
+        {0x46, "LSR", Mode::zero_page, 5, Access::read_modify_write},
+        {0x48, "PHA", Mode::implied, 3, Access::none},
+        {0x49, "EOR", Mode::immediate, 2, Access::none},
+        {0x4A, "LSR", Mode::accumulator, 2, Access::none},
+        {0x4C, "JMP", Mode::absolute, 3, Access::none},
+        {0x4D, "EOR", Mode::absolute, 4, Access::read},
+        {0x4E, "LSR", Mode::absolute, 6, Access::read_modify_write},
+        {0x50, "BVC", Mode::relative, 2, Access::none},
+        {0x51, "EOR", Mode::indirect_y, 5, Access::read},
+        {0x55, "EOR", Mode::zero_page_x, 4, Access::read},
+        {0x56, "LSR", Mode::zero_page_x, 6, Access::read_modify_write},
+        {0x58, "CLI", Mode::implied, 2, Access::none},
+        {0x59, "EOR", Mode::absolute_y, 4, Access::read},
+        {0x5D, "EOR", Mode::absolute_x, 4, Access::read},
+        {0x5E, "LSR", Mode::absolute_x, 7, Access::read_modify_write},
+        {0x60, "RTS", Mode::implied, 6, Access::none},
+        {0x61, "ADC", Mode::indirect_x, 6, Access::read},
+        {0x65, "ADC", Mode::zero_page, 3, Access::read},
+        {0x66, "ROR", Mode::zero_page, 5, Access::read_modify_write},
+        {0x68, "PLA", Mode::implied, 4, Access::none},
+        {0x69, "ADC", Mode::immediate, 2, Access::none},
+        {0x6A, "ROR", Mode::accumulator, 2, Access::none},
+        {0x6C, "JMP", Mode::indirect, 5, Access::none},
+        {0x6D, "ADC", Mode::absolute, 4, Access::read},
+        {0x6E, "ROR", Mode::absolute, 6, Access::read_modify_write},
+        {0x70, "BVS", Mode::relative, 2, Access::none},
+        {0x71, "ADC", Mode::indirect_y, 5, Access::read},
+        {0x75, "ADC", Mode::zero_page_x, 4, Access::read},
+        {0x76, "ROR", Mode::zero_page_x, 6, Access::read_modify_write},
+        {0x78, "SEI", Mode::implied, 2, Access::none},
+        {0x79, "ADC", Mode::absolute_y, 4, Access::read},
+        {0x7D, "ADC", Mode::absolute_x, 4, Access::read},
+        {0x7E, "ROR", Mode::absolute_x, 7, Access::read_modify_write},
+        {0x81, "STA", Mode::indirect_x, 6, Access::write},
+        {0x84, "STY", Mode::zero_page, 3, Access::write},
+        {0x85, "STA", Mode::zero_page, 3, Access::write},
+        {0x86, "STX", Mode::zero_page, 3, Access::write},
+        {0x88, "DEY", Mode::implied, 2, Access::none},
+        {0x8A, "TXA", Mode::implied, 2, Access::none},
+        {0x8C, "STY", Mode::absolute, 4, Access::write},
+        {0x8D, "STA", Mode::absolute, 4, Access::write},
+        {0x8E, "STX", Mode::absolute, 4, Access::write},
+        {0x90, "BCC", Mode::relative, 2, Access::none},
+        {0x91, "STA", Mode::indirect_y, 6, Access::write},
+        {0x94, "STY", Mode::zero_page_x, 4, Access::write},
+        {0x95, "STA", Mode::zero_page_x, 4, Access::write},
+        {0x96, "STX", Mode::zero_page_y, 4, Access::write},
+        {0x98, "TYA", Mode::implied, 2, Access::none},
+        {0x99, "STA", Mode::absolute_y, 5, Access::write},
+        {0x9A, "TXS", Mode::implied, 2, Access::none},
+        {0x9D, "STA", Mode::absolute_x, 5, Access::write},
+        {0xA0, "LDY", Mode::immediate, 2, Access::none},
+        {0xA1, "LDA", Mode::indirect_x, 6, Access::read},
+        {0xA2, "LDX", Mode::immediate, 2, Access::none},
+        {0xA4, "LDY", Mode::zero_page, 3, Access::read},
+        {0xA5, "LDA", Mode::zero_page, 3, Access::read},
+        {0xA6, "LDX", Mode::zero_page, 3, Access::read},
+        {0xA8, "TAY", Mode::implied, 2, Access::none},
+        {0xA9, "LDA", Mode::immediate, 2, Access::none},
+        {0xAA, "TAX", Mode::implied, 2, Access::none},
+        {0xAC, "LDY", Mode::absolute, 4, Access::read},
+        {0xAD, "LDA", Mode::absolute, 4, Access::read},
+        {0xAE, "LDX", Mode::absolute, 4, Access::read},
+        {0xB0, "BCS", Mode::relative, 2, Access::none},
+        {0xB1, "LDA", Mode::indirect_y, 5, Access::read},
+        {0xB4, "LDY", Mode::zero_page_x, 4, Access::read},
+        {0xB5, "LDA", Mode::zero_page_x, 4, Access::read},
+        {0xB6, "LDX", Mode::zero_page_y, 4, Access::read},
+        {0xB8, "CLV", Mode::implied, 2, Access::none},
+        {0xB9, "LDA", Mode::absolute_y, 4, Access::read},
+        {0xBA, "TSX", Mode::implied, 2, Access::none},
+        {0xBC, "LDY", Mode::absolute_x, 4, Access::read},
+        {0xBD, "LDA", Mode::absolute_x, 4, Access::read},
+        {0xBE, "LDX", Mode::absolute_y, 4, Access::read},
+        {0xC0, "CPY", Mode::immediate, 2, Access::none},
+        {0xC1, "CMP", Mode::indirect_x, 6, Access::read},
+        {0xC4, "CPY", Mode::zero_page, 3, Access::read},
+        {0xC5, "CMP", Mode::zero_page, 3, Access::read},
+        {0xC6, "DEC", Mode::zero_page, 5, Access::read_modify_write},
+        {0xC8, "INY", Mode::implied, 2, Access::none},
+        {0xC9, "CMP", Mode::immediate, 2, Access::none},
+        {0xCA, "DEX", Mode::implied, 2, Access::none},
+        {0xCC, "CPY", Mode::absolute, 4, Access::read},
+        {0xCD, "CMP", Mode::absolute, 4, Access::read},
+        {0xCE, "DEC", Mode::absolute, 6, Access::read_modify_write},
+        {0xD0, "BNE", Mode::relative, 2, Access::none},
+        {0xD1, "CMP", Mode::indirect_y, 5, Access::read},
+        {0xD5, "CMP", Mode::zero_page_x, 4, Access::read},
+        {0xD6, "DEC", Mode::zero_page_x, 6, Access::read_modify_write},
+        {0xD8, "CLD", Mode::implied, 2, Access::none},
+        {0xD9, "CMP", Mode::absolute_y, 4, Access::read},
+        {0xDD, "CMP", Mode::absolute_x, 4, Access::read},
+        {0xDE, "DEC", Mode::absolute_x, 7, Access::read_modify_write},
+        {0xE0, "CPX", Mode::immediate, 2, Access::none},
+        {0xE1, "SBC", Mode::indirect_x, 6, Access::read},
+        {0xE4, "CPX", Mode::zero_page, 3, Access::read},
+        {0xE5, "SBC", Mode::zero_page, 3, Access::read},
+        {0xE6, "INC", Mode::zero_page, 5, Access::read_modify_write},
+        {0xE8, "INX", Mode::implied, 2, Access::none},
+        {0xE9, "SBC", Mode::immediate, 2, Access::none},
+        {0xEA, "NOP", Mode::implied, 2, Access::none},
+        {0xEC, "CPX", Mode::absolute, 4, Access::read},
+        {0xED, "SBC", Mode::absolute, 4, Access::read},
+        {0xEE, "INC", Mode::absolute, 6, Access::read_modify_write},
+        {0xF0, "BEQ", Mode::relative, 2, Access::none},
+        {0xF1, "SBC", Mode::indirect_y, 5, Access::read},
+        {0xF5, "SBC", Mode::zero_page_x, 4, Access::read},
+        {0xF6, "INC", Mode::zero_page_x, 6, Access::read_modify_write},
+        {0xF8, "SED", Mode::implied, 2, Access::none},
+        {0xF9, "SBC", Mode::absolute_y, 4, Access::read},
+        {0xFD, "SBC", Mode::absolute_x, 4, Access::read},
+        {0xFE, "INC", Mode::absolute_x, 7, Access::read_modify_write},
+};
+
+constexpr Byte length(Mode mode) noexcept
+{
+        switch (mode) {
+                case Mode::implied:
+                case Mode::accumulator:
+                        return 1;
+                case Mode::absolute:
+                case Mode::absolute_x:
+                case Mode::absolute_y:
+                case Mode::indirect:
+                        return 3;
+                default:
+                        return 2;
+        }
+}
+
+/**
+ * Reads take an extra cycle when indexing crosses a page. Writes and
+ * read-modify-writes always take it, so it's in their base cycles.
+ */
+constexpr bool page_cross_penalty(Mode mode, Access access) noexcept
+{
+        return access == Access::read &&
+               (mode == Mode::absolute_x || mode == Mode::absolute_y || mode == Mode::indirect_y);
+}
+
+constexpr bool uses_stack(std::string_view mnemonic) noexcept
+{
+        for (std::string_view const stack_mnemonic : {"BRK", "JSR", "RTI", "RTS", "PHA", "PHP", "PLA", "PLP"}) {
+                if (mnemonic == stack_mnemonic)
+                        return true;
+        }
+        return false;
+}
+
+constexpr bool jumps(std::string_view mnemonic) noexcept
+{
+        for (std::string_view const jump_mnemonic : {"BRK", "JSR", "RTI", "RTS", "JMP"}) {
+                if (mnemonic == jump_mnemonic)
+                        return true;
+        }
+        return false;
+}
+
+constexpr std::array<OpcodeInfo, 256> make_opcode_table() noexcept
+{
+        std::array<OpcodeInfo, 256> table {};
+        for (auto& info : table)
+                info = {"???", Mode::implied, 1, 0, false, Access::none, false, false, false};
+        for (auto const& definition : definitions) {
+                table[definition.opcode] = {
+                        definition.mnemonic,
+                        definition.mode,
+                        length(definition.mode),
+                        definition.cycles,
+                        page_cross_penalty(definition.mode, definition.access),
+                        definition.access,
+                        uses_stack(definition.mnemonic),
+                        jumps(definition.mnemonic),
+                        true
+                };
+        }
+        return table;
+}
+
+}
+
+/**
+ * Unknown opcodes are one byte long and take no cycles.
+ */
+inline constexpr std::array<OpcodeInfo, 256> opcode_table = Definitions::make_opcode_table();
+
+/**
+ * The longest run of instructions that's decoded as one block.
+ */
+inline constexpr std::size_t max_block_size = 32;
+
+constexpr bool is_branch(Byte opcode) noexcept
+{
+        return opcode_table[opcode].mode == AddressingMode::relative;
+}
+
+constexpr bool ends_block(Byte opcode) noexcept
+{
+        auto const& info = opcode_table[opcode];
+        return info.jumps || is_branch(opcode) || !info.known;
+}
+
+}
+
+}
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <algorithm>
+#include <utility>
 #include "ppu.h"
 
 using namespace std::string_literals;
@@ -141,14 +142,31 @@ PPU::PPU(Mirroring mirroring, ReadableMemory& dma_memory) noexcept
         , dma_memory_(dma_memory)
 {}
 
+void PPU::on_nmi(NmiCallback callback)
+{
+        nmi_callback_ = std::move(callback);
+}
+
 void PPU::vblank_started()
 {
         status_.set(vblank_flag);
+        update_nmi_output();
 }
 
 void PPU::vblank_finished()
 {
-        status_.set(vblank_flag);
+        status_.reset(vblank_flag);
+        update_nmi_output();
+}
+
+void PPU::update_nmi_output()
+{
+        bool const nmi_output = in_vblank() && nmi_enabled();
+        if (nmi_output == nmi_output_)
+                return;
+        nmi_output_ = nmi_output;
+        if (nmi_callback_)
+                nmi_callback_(nmi_output);
 }
 
 Byte PPU::read_vram_byte(Address address)
@@ -268,6 +286,7 @@ void PPU::write_byte_impl(Address address, Byte byte)
         switch (address) {
                 case control_register:
                         control_ = byte;
+                        update_nmi_output();
                         break;
 
                 case mask_register:
@@ -146,8 +146,16 @@ public:
         static unsigned constexpr background_tile_size = 8;
         static unsigned constexpr vblank_flag = 7;
 
+        using NmiCallback = std::function<void(bool asserted)>;
+
         PPU(Mirroring mirroring, ReadableMemory& dma_memory) noexcept;
 
+        /**
+         * The callback is called whenever the PPU's NMI output changes.
+         * It's asserted while the PPU is in vblank with NMIs enabled.
+         */
+        void on_nmi(NmiCallback callback);
+
         void vblank_started();
         void vblank_finished();
         Byte read_vram_byte(Address address);
@@ -187,6 +195,7 @@ private:
                                    Byte x, Byte y, Tile const& tile);
         void increment_vram_address() noexcept;
         void execute_dma(Byte source);
+        void update_nmi_output();
 
         ByteBitset control_ = 0;
         ByteBitset mask_ = 0;
@@ -198,6 +207,8 @@ private:
         VRAM vram_;
         OAM oam_ {0};
         ReadableMemory& dma_memory_;
+        NmiCallback nmi_callback_;
+        bool nmi_output_ = false;
 };
 
 }
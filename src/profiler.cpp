@@ -0,0 +1,114 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "profiler.h"
+#include <algorithm>
+#include <iomanip>
+
+namespace Emulator {
+
+namespace {
+
+auto constexpr top_level_name = "(top level)";
+
+template <class Map>
+std::vector<std::pair<typename Map::key_type, Cycles>> most_first(Map const& map)
+{
+        std::vector<std::pair<typename Map::key_type, Cycles>> entries(map.cbegin(), map.cend());
+        std::sort(entries.begin(), entries.end(),
+                  [](auto const& left, auto const& right) {
+                          return left.second != right.second ? left.second > right.second
+                                                             : left.first < right.first;
+                  });
+        return entries;
+}
+
+}
+
+Profiler::Profiler(Labels const& labels, Cycles sample_period)
+        : labels_(labels),
+          sample_period_(sample_period)
+{}
+
+Cycles Profiler::sample_period() const noexcept
+{
+        return sample_period_;
+}
+
+void Profiler::run(CPU& cpu, Cycles cycle_budget)
+{
+        Cycles const end = cpu.cycles() + cycle_budget;
+        while (cpu.cycles() < end) {
+                cpu.run(std::min(end - cpu.cycles(), sample_period_));
+                sample(cpu.pc(), cpu.cycles());
+        }
+}
+
+void Profiler::sample(Address pc, Cycles cycles)
+{
+        Cycles const weight = sampled_ ? cycles - last_sample_ : 0;
+        last_sample_ = cycles;
+        sampled_ = true;
+        if (weight == 0)
+                return;
+
+        total_ += weight;
+        address_cycles_[pc] += weight;
+        std::vector<Address> stack;
+        for (auto const& frame : stack_)
+                stack.push_back(frame.function);
+        stack_cycles_[stack] += weight;
+}
+
+void Profiler::called(Address target, Byte sp)
+{
+        drop_frames_above(sp);
+        stack_.push_back({target, sp});
+}
+
+void Profiler::returned(Byte sp)
+{
+        drop_frames_above(sp);
+}
+
+void Profiler::drop_frames_above(Byte sp) noexcept
+{
+        // The stack grows down, so inner frames have lower stack pointers.
+        while (!stack_.empty() && stack_.back().sp <= sp)
+                stack_.pop_back();
+}
+
+void Profiler::write_flat_profile(std::ostream& out) const
+{
+        std::map<std::string, Cycles> function_cycles;
+        for (auto const& [stack, cycles] : stack_cycles_) {
+                auto const innermost = stack.empty() ? top_level_name : labels_.describe(stack.back());
+                function_cycles[innermost] += cycles;
+        }
+
+        auto const write = [&](std::string const& name, Cycles cycles) {
+                out << std::setw(12) << cycles << "  " << std::fixed << std::setprecision(2)
+                    << std::setw(6) << 100.0 * cycles / total_ << "%  " << name << '\n';
+        };
+
+        out << "Cycles by function:\n";
+        for (auto const& [name, cycles] : most_first(function_cycles))
+                write(name, cycles);
+        out << "\nCycles by address:\n";
+        for (auto const& [address, cycles] : most_first(address_cycles_))
+                write(labels_.describe(address), cycles);
+}
+
+void Profiler::write_folded_stacks(std::ostream& out) const
+{
+        std::map<std::string, Cycles> folded;
+        for (auto const& [stack, cycles] : stack_cycles_) {
+                std::string line = top_level_name;
+                for (Address const function : stack)
+                        line += ";" + labels_.describe(function);
+                folded[line] += cycles;
+        }
+        for (auto const& [line, cycles] : folded)
+                out << line << ' ' << cycles << '\n';
+}
+
+}
@@ -0,0 +1,75 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include "cpu.h"
+#include "labels.h"
+#include <map>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace Emulator {
+
+/**
+ * A sampling profiler for the guest code. Whoever runs the CPU calls
+ * sample() every so often (run() does it every sample_period cycles),
+ * and the profiler keeps track of the call stack through the CPU's
+ * CallObserver hooks. Each sample counts for the cycles since the
+ * previous one.
+ */
+class Profiler : public CPU::CallObserver {
+public:
+        /**
+         * The labels have to outlive the profiler.
+         */
+        explicit Profiler(Labels const& labels, Cycles sample_period = default_sample_period);
+
+        static Cycles constexpr default_sample_period = 1000;
+
+        Cycles sample_period() const noexcept;
+
+        /**
+         * Like CPU::run(), in slices of the sample period.
+         */
+        void run(CPU& cpu, Cycles cycle_budget);
+        void sample(Address pc, Cycles cycles);
+
+        void called(Address target, Byte sp) override;
+        void returned(Byte sp) override;
+
+        /**
+         * Cycles per function and per address, most first.
+         */
+        void write_flat_profile(std::ostream& out) const;
+
+        /**
+         * One line per call stack, outermost function first, in the
+         * format flamegraph.pl and similar tools take.
+         */
+        void write_folded_stacks(std::ostream& out) const;
+
+private:
+        struct Frame {
+                Address function;
+                Byte sp;
+        };
+
+        /**
+         * Frames whose return address is gone from the stack, e.g.
+         * after the code resets the stack pointer, are dropped.
+         */
+        void drop_frames_above(Byte sp) noexcept;
+
+        Labels const& labels_;
+        Cycles const sample_period_;
+        Cycles last_sample_ = 0;
+        bool sampled_ = false;
+        Cycles total_ = 0;
+        std::vector<Frame> stack_;
+        std::unordered_map<Address, Cycles> address_cycles_;
+        std::map<std::vector<Address>, Cycles> stack_cycles_; // Outermost function first
+};
+
+}
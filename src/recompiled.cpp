@@ -0,0 +1,38 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "recompiled.h"
+#include <dlfcn.h>
+
+using namespace std::string_literals;
+
+namespace Emulator {
+
+namespace Recompiled {
+
+SharedLibrary::SharedLibrary(std::string const& path)
+        : handle_(dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL))
+{
+        if (!handle_)
+                throw CantLoadLibrary("Can't load "s + path + ": "s + dlerror());
+
+        library_ = static_cast<Library const*>(dlsym(handle_, library_symbol));
+        if (!library_ || library_->abi_version != abi_version) {
+                dlclose(handle_);
+                throw CantLoadLibrary(path + " isn't a recompiled ROM for this version of the emulator."s);
+        }
+}
+
+SharedLibrary::~SharedLibrary()
+{
+        dlclose(handle_);
+}
+
+Library const& SharedLibrary::library() const noexcept
+{
+        return *library_;
+}
+
+}
+
+}
+
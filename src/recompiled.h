@@ -0,0 +1,187 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "alu.h"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+/**
+ * The interface between the emulator and the code nes-recompile
+ * generates. The generated source only includes this header, so a
+ * recompiled ROM can be built into a shared library without linking
+ * anything from the emulator.
+ *
+ * Each recompiled block is a function that does what the CPU's block
+ * decoder would have decoded at the same address. Loads, stores, ALU
+ * operations, register transfers and branches are compiled to what
+ * they do to the registers, using the same ALU as the core, and reach
+ * memory through the CPU's bus. Everything else calls the CPU's step
+ * for its opcode. Either way, a block is left early when the CPU says
+ * so, e.g. because an instruction overwrote code.
+ */
+
+namespace Emulator {
+
+namespace Recompiled {
+
+std::uint32_t constexpr abi_version = 2;
+
+using Step = bool (*)(void* context, std::uint16_t operand) noexcept;
+
+/**
+ * The CPU's registers, with C, Z, V and N kept the way the core keeps
+ * them: as the values they come from, worked out when needed.
+ */
+struct Registers {
+        std::uint16_t* pc;
+        std::uint8_t* a;
+        std::uint8_t* x;
+        std::uint8_t* y;
+        unsigned* carry_result;        // C is bit 8
+        std::uint8_t* zero_result;     // Z is set when it's 0
+        std::uint8_t* overflow_result; // V is bit 7
+        std::uint8_t* negative_result; // N is bit 7
+
+        bool carry() const noexcept
+        {
+                return *carry_result >> Alu::carry_bit & 1;
+        }
+
+        bool zero() const noexcept
+        {
+                return *zero_result == 0;
+        }
+
+        bool overflow() const noexcept
+        {
+                return *overflow_result >> sign_bit & 1;
+        }
+
+        bool negative() const noexcept
+        {
+                return *negative_result >> sign_bit & 1;
+        }
+
+        void load(std::uint8_t& reg, std::uint8_t value) const noexcept
+        {
+                reg = value;
+                *zero_result = value;
+                *negative_result = value;
+        }
+
+        void adc(std::uint8_t operand) const noexcept
+        {
+                Alu::Result const result = Alu::add(*a, operand, carry());
+                *carry_result = result;
+                *overflow_result = result >> (Alu::overflow_bit - sign_bit);
+                load(*a, result);
+        }
+
+        void sbc(std::uint8_t operand) const noexcept
+        {
+                adc(~operand);
+        }
+
+        void compare(std::uint8_t reg, std::uint8_t operand) const noexcept
+        {
+                Alu::Result const result = Alu::add(reg, ~operand, true);
+                *carry_result = result;
+                *zero_result = result;
+                *negative_result = result;
+        }
+
+        void bit(std::uint8_t operand) const noexcept
+        {
+                *negative_result = operand;
+                *overflow_result = operand << 1;
+                *zero_result = *a & operand;
+        }
+};
+
+/**
+ * Memory accesses, the same as the instructions make them in the CPU,
+ * down to the page crossing cycles and the bus-accurate tier's dummy
+ * reads. Like steps, they return false when the block has to be left
+ * once the instruction is done.
+ */
+struct Bus {
+        bool (*read_zero_page)(void* context, std::uint8_t address, std::uint8_t& byte) noexcept;
+        bool (*write_zero_page)(void* context, std::uint8_t address, std::uint8_t byte) noexcept;
+        /**
+         * For reads that pay for crossing a page, and for absolute
+         * reads, with an index of 0.
+         */
+        bool (*read_absolute)(void* context, std::uint16_t base, std::uint8_t index,
+                              std::uint8_t& byte) noexcept;
+        bool (*write_absolute)(void* context, std::uint16_t address, std::uint8_t byte) noexcept;
+        bool (*write_indexed)(void* context, std::uint16_t base, std::uint8_t index,
+                              std::uint8_t byte) noexcept;
+};
+
+struct Host {
+        void* context;
+        std::uint64_t* cycles;
+        Step const* steps; // Indexed by opcode
+        Registers registers;
+        Bus bus;
+};
+
+/**
+ * Returns how many instructions were executed.
+ */
+using Function = std::size_t (*)(Host const& host);
+
+/**
+ * A block is only used where memory holds the same code it was
+ * compiled from, which takes care of bank switches and of code
+ * in RAM.
+ */
+struct Block {
+        std::uint16_t address;
+        std::uint8_t const* code;
+        std::size_t code_size;
+        Function function;
+};
+
+struct Library {
+        std::uint32_t abi_version;
+        Block const* blocks; // Sorted by address
+        std::size_t block_count;
+};
+
+/**
+ * The name of the Library a recompiled ROM exports.
+ */
+char constexpr library_symbol[] = "emulator_recompiled_library";
+
+class CantLoadLibrary : public std::runtime_error {
+public:
+        using runtime_error::runtime_error;
+};
+
+/**
+ * A recompiled ROM loaded from a shared library.
+ */
+class SharedLibrary {
+public:
+        explicit SharedLibrary(std::string const& path);
+        SharedLibrary(SharedLibrary const&) = delete;
+        SharedLibrary(SharedLibrary&&) = delete;
+        SharedLibrary& operator=(SharedLibrary const&) = delete;
+        SharedLibrary& operator=(SharedLibrary&&) = delete;
+        ~SharedLibrary();
+
+        Library const& library() const noexcept;
+
+private:
+        void* handle_;
+        Library const* library_;
+};
+
+}
+
+}
+
@@ -0,0 +1,348 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "recompiler.h"
+#include "recompiled.h"
+#include "opcodes.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include <deque>
+#include <map>
+#include <string_view>
+
+namespace Emulator {
+
+namespace {
+
+Byte constexpr jsr_opcode = 0x20;
+Byte constexpr jmp_opcode = 0x4C;
+
+std::string hex(unsigned value, int width)
+{
+        std::stringstream ss;
+        ss << std::hex << std::uppercase << std::setfill('0') << std::setw(width) << value;
+        return ss.str();
+}
+
+std::string function_name(Address address)
+{
+        return "block_" + hex(address, 4);
+}
+
+std::string code_name(Address address)
+{
+        return "code_" + hex(address, 4);
+}
+
+std::string literal(unsigned value, int width)
+{
+        return "0x" + hex(value, width);
+}
+
+/**
+ * What the instructions that recompiled code does itself do, in terms
+ * of the Registers r and the operand m. The rest are left to the
+ * CPU's steps.
+ */
+std::map<std::string_view, std::string_view> const reads {
+        {"LDA", "r.load(*r.a, m);"},
+        {"LDX", "r.load(*r.x, m);"},
+        {"LDY", "r.load(*r.y, m);"},
+        {"ADC", "r.adc(m);"},
+        {"SBC", "r.sbc(m);"},
+        {"AND", "r.load(*r.a, *r.a & m);"},
+        {"ORA", "r.load(*r.a, *r.a | m);"},
+        {"EOR", "r.load(*r.a, *r.a ^ m);"},
+        {"CMP", "r.compare(*r.a, m);"},
+        {"CPX", "r.compare(*r.x, m);"},
+        {"CPY", "r.compare(*r.y, m);"},
+        {"BIT", "r.bit(m);"}
+};
+
+std::map<std::string_view, std::string_view> const stores {
+        {"STA", "*r.a"},
+        {"STX", "*r.x"},
+        {"STY", "*r.y"}
+};
+
+std::map<std::string_view, std::string_view> const implied {
+        {"INX", "r.load(*r.x, *r.x + 1);"},
+        {"INY", "r.load(*r.y, *r.y + 1);"},
+        {"DEX", "r.load(*r.x, *r.x - 1);"},
+        {"DEY", "r.load(*r.y, *r.y - 1);"},
+        {"TAX", "r.load(*r.x, *r.a);"},
+        {"TAY", "r.load(*r.y, *r.a);"},
+        {"TXA", "r.load(*r.a, *r.x);"},
+        {"TYA", "r.load(*r.a, *r.y);"},
+        {"CLC", "*r.carry_result = 0;"},
+        {"SEC", "*r.carry_result = 1u << Emulator::Alu::carry_bit;"},
+        {"CLV", "*r.overflow_result = 0;"},
+        {"NOP", ""}
+};
+
+std::map<std::string_view, std::string_view> const branches {
+        {"BPL", "!r.negative()"},
+        {"BMI", "r.negative()"},
+        {"BVC", "!r.overflow()"},
+        {"BVS", "r.overflow()"},
+        {"BCC", "!r.carry()"},
+        {"BCS", "r.carry()"},
+        {"BNE", "!r.zero()"},
+        {"BEQ", "r.zero()"}
+};
+
+/**
+ * The call that makes the memory access of an instruction, or
+ * nothing if recompiled code doesn't do that one itself.
+ */
+std::string bus_access(Opcodes::OpcodeInfo const& info, Address operand, std::string const& value)
+{
+        using Mode = Opcodes::AddressingMode;
+        bool const store = !value.empty();
+        std::string const byte = store ? value : "m";
+        switch (info.mode) {
+        case Mode::zero_page:
+        case Mode::zero_page_x:
+        case Mode::zero_page_y: {
+                std::string address = literal(operand, 2);
+                if (info.mode != Mode::zero_page)
+                        address = "std::uint8_t(" + address + (info.mode == Mode::zero_page_x ? " + *r.x)" : " + *r.y)");
+                return (store ? "host.bus.write_zero_page(" : "host.bus.read_zero_page(") +
+                       std::string("host.context, ") + address + ", " + byte + ")";
+        }
+        case Mode::absolute:
+                if (store)
+                        return "host.bus.write_absolute(host.context, " + literal(operand, 4) + ", " + byte + ")";
+                return "host.bus.read_absolute(host.context, " + literal(operand, 4) + ", 0, m)";
+        case Mode::absolute_x:
+        case Mode::absolute_y: {
+                std::string const index = info.mode == Mode::absolute_x ? "*r.x" : "*r.y";
+                if (store)
+                        return "host.bus.write_indexed(host.context, " + literal(operand, 4) + ", " +
+                               index + ", " + byte + ")";
+                if (!info.page_cross_penalty)
+                        return {};
+                return "host.bus.read_absolute(host.context, " + literal(operand, 4) + ", " + index + ", m)";
+        }
+        default:
+                return {};
+        }
+}
+
+}
+
+Recompiler::Recompiler(ReadableMemory& memory)
+        : memory_(memory)
+{}
+
+void Recompiler::walk_from_vectors()
+{
+        for (auto const interrupt : {CPU::Interrupt::reset, CPU::Interrupt::nmi, CPU::Interrupt::irq})
+                walk_from(memory_.read_pointer(CPU::interrupt_handler_address(interrupt)));
+}
+
+void Recompiler::walk_from(Address address)
+{
+        std::deque<Address> pending {address};
+        while (!pending.empty()) {
+                Address const next = pending.front();
+                pending.pop_front();
+                if (!Cartridge::is_prg_rom(next) || blocks_.count(next))
+                        continue;
+
+                Block block = decode_block(next);
+                if (block.instructions.empty())
+                        continue;
+                for (Address const successor : successors(block))
+                        pending.push_back(successor);
+                blocks_.emplace(next, std::move(block));
+        }
+}
+
+std::vector<Address> Recompiler::block_addresses() const
+{
+        std::vector<Address> addresses;
+        for (auto const& [address, block] : blocks_)
+                addresses.push_back(address);
+        return addresses;
+}
+
+/**
+ * Cuts code into blocks at the same places as the CPU's block decoder,
+ * otherwise the CPU wouldn't find the recompiled blocks.
+ */
+Recompiler::Block Recompiler::decode_block(Address address)
+{
+        Block block;
+        while (block.instructions.size() < Opcodes::max_block_size &&
+               Cartridge::is_prg_rom(address)) {
+                Byte const opcode = memory_.read_byte(address);
+                Byte const length = Opcodes::opcode_table[opcode].length;
+                Address const last_address = address + length - 1;
+                if (!Cartridge::is_prg_rom(last_address))
+                        break;
+
+                Address operand = 0;
+                for (Byte i = length - 1; i > 0; --i)
+                        operand = operand << CHAR_BIT | memory_.read_byte(address + i);
+                for (Byte i = 0; i < length; ++i)
+                        block.code.push_back(memory_.read_byte(address + i));
+                block.instructions.push_back({address, opcode, operand});
+
+                address = last_address + 1;
+                if (Opcodes::ends_block(opcode))
+                        break;
+        }
+        return block;
+}
+
+/**
+ * Where the code can go after the block, as far as can be told
+ * without running it. Subroutines are assumed to return.
+ */
+std::vector<Address> Recompiler::successors(Block const& block)
+{
+        auto const& last = block.instructions.back();
+        Address const next = last.address + Opcodes::opcode_table[last.opcode].length;
+        if (Opcodes::is_branch(last.opcode))
+                return {next, Address(next + TwosComplement::encode(last.operand))};
+        if (last.opcode == jsr_opcode)
+                return {last.operand, next};
+        if (last.opcode == jmp_opcode)
+                return {last.operand};
+        if (Opcodes::ends_block(last.opcode))
+                return {}; // RTS, RTI, BRK, JMP (indirect) or unknown
+        return {next}; // The block was cut short
+}
+
+void Recompiler::generate(std::ostream& out) const
+{
+        out << "// Generated by nes-recompile.\n\n"
+            << "#include \"recompiled.h\"\n\n"
+            << "namespace {\n\n"
+            << "using Emulator::Recompiled::Host;\n\n";
+        for (auto const& [address, block] : blocks_)
+                generate_block(out, address, block);
+
+        out << "Emulator::Recompiled::Block const blocks[] {\n";
+        for (auto const& [address, block] : blocks_) {
+                out << "        {0x" << hex(address, 4) << ", "
+                    << code_name(address) << ", sizeof(" << code_name(address) << "), "
+                    << "&" << function_name(address) << "},\n";
+        }
+        out << "};\n\n"
+            << "}\n\n"
+            << "extern \"C\" Emulator::Recompiled::Library const "
+            << Recompiled::library_symbol << " {\n"
+            << "        Emulator::Recompiled::abi_version,\n"
+            << "        blocks,\n"
+            << "        sizeof(blocks) / sizeof(blocks[0])\n"
+            << "};\n";
+}
+
+void Recompiler::generate_block(std::ostream& out, Address address, Block const& block)
+{
+        out << "std::uint8_t const " << code_name(address) << "[] {";
+        for (std::size_t i = 0; i < block.code.size(); ++i)
+                out << (i % 16 ? " " : "\n        ") << "0x" << hex(block.code[i], 2) << ",";
+        out << "\n};\n\n";
+
+        std::string const shallow(8, ' ');
+        std::string const deep(16, ' ');
+        std::stringstream body;
+        bool uses_registers = false;
+        bool uses_operand = false;
+        bool uses_bus = false;
+        // Steps move the program counter on themselves, recompiled
+        // code only when it leaves the block.
+        bool pc_is_current = true;
+        auto const& instructions = block.instructions;
+        for (std::size_t i = 0; i < instructions.size(); ++i) {
+                auto const& instruction = instructions[i];
+                auto const& info = Opcodes::opcode_table[instruction.opcode];
+                bool const last = i + 1 == instructions.size();
+                std::string const count = std::to_string(i + 1);
+                Address const next = instruction.address + info.length;
+                auto const leave = [&](std::string const& indent) {
+                        return indent + "*r.pc = " + literal(next, 4) + ";\n" +
+                               indent + "return " + count + ";\n";
+                };
+                body << "        // $" << hex(instruction.address, 4) << ": " << info.mnemonic << "\n"
+                     << "        *host.cycles += " << unsigned {info.cycles} << ";\n";
+
+                auto const read = reads.find(info.mnemonic);
+                auto const store = stores.find(info.mnemonic);
+                auto const operation = implied.find(info.mnemonic);
+                auto const branch = branches.find(info.mnemonic);
+                using Mode = Opcodes::AddressingMode;
+                std::string access;
+                if (read != reads.end())
+                        access = bus_access(info, instruction.operand, {});
+                else if (store != stores.end())
+                        access = bus_access(info, instruction.operand, std::string(store->second));
+
+                if (read != reads.end() && info.mode == Mode::immediate) {
+                        body << "        m = " << literal(instruction.operand, 2) << ";\n"
+                             << "        " << read->second << "\n";
+                        uses_operand = true;
+                } else if (read != reads.end() && !access.empty()) {
+                        body << "        go_on = " << access << ";\n"
+                             << "        " << read->second << "\n"
+                             << "        if (!go_on) {\n" << leave(deep) << "        }\n";
+                        uses_operand = uses_bus = true;
+                } else if (store != stores.end() && !access.empty()) {
+                        body << "        if (!" << access << ") {\n" << leave(deep) << "        }\n";
+                        uses_bus = true;
+                } else if (operation != implied.end() && info.mode == Mode::implied) {
+                        if (!operation->second.empty())
+                                body << "        " << operation->second << "\n";
+                } else if (branch != branches.end() && last) {
+                        uses_registers = true;
+                        Address const target = next + TwosComplement::encode(instruction.operand);
+                        unsigned const taken_cycles = 1 + ((next ^ target) >> CHAR_BIT != 0);
+                        body << "        if (" << branch->second << ") {\n"
+                             << "                *host.cycles += " << taken_cycles << ";\n"
+                             << "                *r.pc = " << literal(target, 4) << ";\n"
+                             << "                return " << count << ";\n"
+                             << "        }\n" << leave(shallow);
+                        continue;
+                } else if (instruction.opcode == jmp_opcode) {
+                        uses_registers = true;
+                        body << "        *r.pc = " << literal(instruction.operand, 4) << ";\n"
+                             << "        return " << count << ";\n";
+                        continue;
+                } else {
+                        std::string const call = "host.steps[" + literal(instruction.opcode, 2) +
+                                                 "](host.context, " + literal(instruction.operand, 4) + ")";
+                        if (!pc_is_current)
+                                body << "        *r.pc = " << literal(instruction.address, 4) << ";\n";
+                        uses_registers = uses_registers || !pc_is_current;
+                        pc_is_current = true;
+                        if (last) {
+                                body << "        " << call << ";\n"
+                                     << "        return " << count << ";\n";
+                        } else {
+                                body << "        if (!" << call << ")\n"
+                                     << "                return " << count << ";\n";
+                        }
+                        continue;
+                }
+
+                pc_is_current = false;
+                uses_registers = true;
+                if (last)
+                        body << leave(shallow);
+        }
+
+        out << "std::size_t " << function_name(address) << "(Host const& host)\n"
+            << "{\n";
+        if (uses_registers)
+                out << "        auto const& r = host.registers;\n";
+        if (uses_operand)
+                out << "        std::uint8_t m = 0;\n";
+        if (uses_bus)
+                out << "        bool go_on = true;\n";
+        out << body.str() << "}\n\n";
+}
+
+}
+
@@ -0,0 +1,57 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <map>
+#include <ostream>
+#include <vector>
+
+namespace Emulator {
+
+/**
+ * Turns the reachable code in a ROM into C++ source for a recompiled
+ * ROM library (see recompiled.h). The code is found by following jumps,
+ * branches and subroutine calls from some entry points, only ever
+ * looking at PRG ROM. Code behind indirect jumps, RTS and RTI can't be
+ * found this way, and is left to the interpreter.
+ */
+class Recompiler {
+public:
+        /**
+         * Code is read from memory, which should map the cartridge
+         * the way the CPU sees it.
+         */
+        explicit Recompiler(ReadableMemory& memory);
+
+        /**
+         * Finds the code reachable from the reset, NMI and IRQ handlers.
+         */
+        void walk_from_vectors();
+        void walk_from(Address address);
+
+        std::vector<Address> block_addresses() const;
+        void generate(std::ostream& out) const;
+
+private:
+        struct Instruction {
+                Address address;
+                Byte opcode;
+                Address operand;
+        };
+
+        struct Block {
+                std::vector<Instruction> instructions;
+                std::vector<Byte> code;
+        };
+
+        Block decode_block(Address address);
+        static std::vector<Address> successors(Block const& block);
+        static void generate_block(std::ostream& out, Address address, Block const& block);
+
+        ReadableMemory& memory_;
+        std::map<Address, Block> blocks_;
+};
+
+}
+
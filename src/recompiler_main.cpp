@@ -0,0 +1,39 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "recompiler.h"
+#include "cartridge.h"
+#include <fstream>
+#include <iostream>
+
+/**
+ * nes-recompile ROM OUTPUT writes the C++ source of a recompiled ROM
+ * library for ROM to OUTPUT. Build it into a shared library with the
+ * add_recompiled_rom CMake function, or with e.g.
+ * c++ -std=c++17 -O2 -shared -fPIC -I src OUTPUT -o ROM.so
+ * and pass that to nes-emulator after the ROM.
+ */
+
+int main(int argc, char** argv)
+{
+        if (argc != 3) {
+                std::cout << "Usage: nes-recompile ROM OUTPUT\n";
+                return 1;
+        }
+
+        try {
+                Emulator::Cartridge const cartridge(argv[1]);
+                auto const memory_mapper = Emulator::MemoryMapper::make(cartridge);
+                Emulator::Recompiler recompiler(*memory_mapper);
+                recompiler.walk_from_vectors();
+
+                std::ofstream out(argv[2]);
+                if (!out)
+                        throw Emulator::CantOpenFile(argv[2]);
+                recompiler.generate(out);
+                std::cout << "Recompiled " << recompiler.block_addresses().size() << " blocks.\n";
+        } catch (std::exception const& e) {
+                std::cerr << e.what() << '\n';
+                return 1;
+        }
+        return 0;
+}
@@ -140,6 +140,11 @@ Ticks get_ticks() noexcept
         return SDL_GetTicks();
 }
 
+void delay(Ticks ms) noexcept
+{
+        SDL_Delay(ms);
+}
+
 bool quit_requested() noexcept
 {
         return SDL_QuitRequested();
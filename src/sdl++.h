@@ -106,6 +106,7 @@ enum class Flip {
 
 OptionalEvent poll_event();
 Ticks get_ticks() noexcept;
+void delay(Ticks ms) noexcept;
 bool quit_requested() noexcept;
 
 }
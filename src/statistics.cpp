@@ -0,0 +1,121 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "statistics.h"
+#include "opcodes.h"
+#include <map>
+
+namespace Emulator {
+
+namespace {
+
+using Opcodes::AddressingMode;
+using Opcodes::opcode_table;
+
+std::string mode_name(AddressingMode mode)
+{
+        switch (mode) {
+                case AddressingMode::implied:     return "implied";
+                case AddressingMode::accumulator: return "accumulator";
+                case AddressingMode::immediate:   return "immediate";
+                case AddressingMode::relative:    return "relative";
+                case AddressingMode::zero_page:   return "zero_page";
+                case AddressingMode::zero_page_x: return "zero_page_x";
+                case AddressingMode::zero_page_y: return "zero_page_y";
+                case AddressingMode::absolute:    return "absolute";
+                case AddressingMode::absolute_x:  return "absolute_x";
+                case AddressingMode::absolute_y:  return "absolute_y";
+                case AddressingMode::indirect:    return "indirect";
+                case AddressingMode::indirect_x:  return "indirect_x";
+                case AddressingMode::indirect_y:  return "indirect_y";
+        }
+        return "unknown";
+}
+
+std::map<std::string, std::uint64_t> mode_executions(Statistics const& statistics)
+{
+        std::map<std::string, std::uint64_t> result;
+        for (unsigned opcode = 0; opcode < statistics.executions.size(); ++opcode) {
+                if (statistics.executions[opcode])
+                        result[mode_name(opcode_table[opcode].mode)] += statistics.executions[opcode];
+        }
+        return result;
+}
+
+std::string piece_name(std::vector<std::string> const& names, std::size_t piece)
+{
+        return piece < names.size() ? names[piece] : "piece " + std::to_string(piece);
+}
+
+std::string opcode_name(unsigned opcode)
+{
+        return format_hex(opcode, 2) + " " + std::string(opcode_table[opcode].mnemonic) + " " +
+               mode_name(opcode_table[opcode].mode);
+}
+
+}
+
+/**
+ * One counter per line: counter,key,count.
+ */
+void Statistics::write_csv(std::ostream& out, std::vector<std::string> const& piece_names) const
+{
+        out << "counter,key,count\n";
+        for (unsigned opcode = 0; opcode < executions.size(); ++opcode) {
+                if (executions[opcode])
+                        out << "opcode," << opcode_name(opcode) << ',' << executions[opcode] << '\n';
+        }
+        for (auto const& [mode, count] : mode_executions(*this))
+                out << "addressing_mode," << mode << ',' << count << '\n';
+        for (unsigned opcode = 0; opcode < executions.size(); ++opcode) {
+                if (!Opcodes::is_branch(opcode) || !executions[opcode])
+                        continue;
+                out << "branch_taken," << opcode_name(opcode) << ',' << branches_taken[opcode] << '\n'
+                    << "branch_not_taken," << opcode_name(opcode) << ','
+                    << executions[opcode] - branches_taken[opcode] << '\n';
+        }
+        for (std::size_t piece = 0; piece < accesses.size(); ++piece) {
+                out << "reads," << piece_name(piece_names, piece) << ',' << accesses[piece].reads << '\n'
+                    << "writes," << piece_name(piece_names, piece) << ',' << accesses[piece].writes << '\n';
+        }
+}
+
+void Statistics::write_json(std::ostream& out, std::vector<std::string> const& piece_names) const
+{
+        auto const separator = [&out](bool& first) {
+                out << (first ? "\n" : ",\n");
+                first = false;
+        };
+
+        out << "{\n  \"opcodes\": [";
+        bool first = true;
+        for (unsigned opcode = 0; opcode < executions.size(); ++opcode) {
+                if (!executions[opcode])
+                        continue;
+                separator(first);
+                auto const& info = opcode_table[opcode];
+                out << "    {\"opcode\": \"" << format_hex(opcode, 2) << "\", \"mnemonic\": \"" << info.mnemonic
+                    << "\", \"mode\": \"" << mode_name(info.mode) << "\", \"executions\": " << executions[opcode];
+                if (Opcodes::is_branch(opcode))
+                        out << ", \"taken\": " << branches_taken[opcode]
+                            << ", \"not_taken\": " << executions[opcode] - branches_taken[opcode];
+                out << "}";
+        }
+
+        out << "\n  ],\n  \"addressing_modes\": {";
+        first = true;
+        for (auto const& [mode, count] : mode_executions(*this)) {
+                separator(first);
+                out << "    \"" << mode << "\": " << count;
+        }
+
+        out << "\n  },\n  \"accesses\": [";
+        first = true;
+        for (std::size_t piece = 0; piece < accesses.size(); ++piece) {
+                separator(first);
+                out << "    {\"piece\": \"" << piece_name(piece_names, piece) << "\", \"reads\": "
+                    << accesses[piece].reads << ", \"writes\": " << accesses[piece].writes << "}";
+        }
+        out << "\n  ]\n}\n";
+}
+
+}
@@ -0,0 +1,49 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Emulator {
+
+/**
+ * What the CPU core spent its time on, for deciding which fast paths
+ * are worth having. Only kept when the core is built with
+ * EMULATOR_STATISTICS (cmake -DSTATISTICS=ON), since counting slows
+ * it down.
+ *
+ * Instructions are counted however they're run: interpreted, fused or
+ * compiled. Recompiled code can't count what it runs, so it isn't used
+ * while statistics are kept. Skipped idle loop iterations (see the
+ * CPU's idle loop detection) aren't run, so they don't count.
+ */
+struct Statistics {
+        struct Accesses {
+                std::uint64_t reads = 0;
+                std::uint64_t writes = 0;
+        };
+
+        std::array<std::uint64_t, 256> executions {}; // By opcode
+        std::array<std::uint64_t, 256> branches_taken {}; // By opcode
+
+        /**
+         * The reads and writes the program makes, by memory piece, in
+         * the order the pieces were given to the CPU. Reading code to
+         * decode it doesn't count.
+         */
+        std::vector<Accesses> accesses;
+
+        /**
+         * The names are for the memory pieces. Addressing modes and
+         * untaken branches are worked out from the opcode counts.
+         */
+        void write_csv(std::ostream& out, std::vector<std::string> const& piece_names) const;
+        void write_json(std::ostream& out, std::vector<std::string> const& piece_names) const;
+};
+
+}
@@ -0,0 +1,158 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "trace.h"
+#include "disassembler.h"
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace Emulator {
+
+namespace {
+
+char constexpr magic[8] = {'N', 'E', 'S', 'T', 'R', 'A', 'C', 'E'};
+std::uint32_t constexpr format_version = 1;
+
+unsigned constexpr ppu_dots_per_cycle = 3;
+unsigned constexpr ppu_dots_per_scanline = 341;
+unsigned constexpr ppu_scanlines = 262;
+
+std::size_t constexpr disassembly_width = 32;
+
+std::string hex(unsigned value, int width)
+{
+        std::stringstream ss;
+        ss << std::hex << std::uppercase << std::setfill('0') << std::setw(width) << value;
+        return ss.str();
+}
+
+template <class Integer>
+void write_little_endian(std::ostream& out, Integer value)
+{
+        for (std::size_t i = 0; i < sizeof(Integer); ++i)
+                out.put(static_cast<char>(value >> i * CHAR_BIT & byte_max));
+}
+
+template <class Integer>
+Integer read_little_endian(std::istream& in)
+{
+        Integer value = 0;
+        for (std::size_t i = 0; i < sizeof(Integer); ++i) {
+                int const byte = in.get();
+                if (byte == std::char_traits<char>::eof())
+                        throw InvalidTrace();
+                value |= Integer(byte) << i * CHAR_BIT;
+        }
+        return value;
+}
+
+std::size_t round_up_to_power_of_two(std::size_t n) noexcept
+{
+        std::size_t result = 1;
+        while (result < n)
+                result <<= 1;
+        return result;
+}
+
+}
+
+InvalidTrace::InvalidTrace()
+        : runtime_error("Not a saved instruction trace.")
+{}
+
+TraceBuffer::TraceBuffer(std::size_t capacity)
+        : records_(round_up_to_power_of_two(capacity)),
+          mask_(records_.size() - 1)
+{}
+
+std::size_t TraceBuffer::capacity() const noexcept
+{
+        return records_.size();
+}
+
+std::uint64_t TraceBuffer::recorded() const noexcept
+{
+        return recorded_;
+}
+
+std::vector<TraceRecord> TraceBuffer::records() const
+{
+        std::uint64_t const first = recorded_ > records_.size() ? recorded_ - records_.size() : 0;
+        std::vector<TraceRecord> result;
+        result.reserve(recorded_ - first);
+        for (std::uint64_t i = first; i < recorded_; ++i)
+                result.push_back(records_[i & mask_]);
+        return result;
+}
+
+void TraceBuffer::clear() noexcept
+{
+        recorded_ = 0;
+}
+
+void TraceBuffer::save(std::ostream& out) const
+{
+        auto const records = this->records();
+        out.write(magic, sizeof(magic));
+        write_little_endian(out, format_version);
+        write_little_endian(out, std::uint64_t {records.size()});
+        for (auto const& record : records) {
+                write_little_endian(out, std::uint64_t {record.cycles});
+                write_little_endian(out, record.pc);
+                for (Byte const byte : record.bytes)
+                        out.put(static_cast<char>(byte));
+                for (Byte const byte : {record.a, record.x, record.y, record.p, record.sp})
+                        out.put(static_cast<char>(byte));
+        }
+}
+
+std::vector<TraceRecord> load_trace(std::istream& in)
+{
+        char header[sizeof(magic)];
+        if (!in.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0 ||
+            read_little_endian<std::uint32_t>(in) != format_version)
+                throw InvalidTrace();
+
+        auto const count = read_little_endian<std::uint64_t>(in);
+        std::vector<TraceRecord> records;
+        for (std::uint64_t i = 0; i < count; ++i) {
+                TraceRecord record;
+                record.cycles = read_little_endian<std::uint64_t>(in);
+                record.pc = read_little_endian<Address>(in);
+                for (Byte& byte : record.bytes)
+                        byte = read_little_endian<Byte>(in);
+                for (Byte* byte : {&record.a, &record.x, &record.y, &record.p, &record.sp})
+                        *byte = read_little_endian<Byte>(in);
+                records.push_back(record);
+        }
+        return records;
+}
+
+std::string nestest_line(TraceRecord const& record)
+{
+        auto const instruction = Disassembler::decode(record.pc, record.bytes);
+        std::string bytes;
+        for (unsigned i = 0; i < instruction.length; ++i)
+                bytes += hex(instruction.bytes[i], 2) + " ";
+        std::string const disassembly = instruction.mnemonic + (instruction.operand.empty() ? "" : " ") +
+                                        instruction.operand;
+
+        Cycles const dots = record.cycles * ppu_dots_per_cycle;
+        std::stringstream line;
+        line << hex(record.pc, 4) << "  " << std::left << std::setw(10) << bytes
+             << std::setw(disassembly_width) << disassembly << std::right
+             << "A:" << hex(record.a, 2) << " X:" << hex(record.x, 2) << " Y:" << hex(record.y, 2)
+             << " P:" << hex(record.p, 2) << " SP:" << hex(record.sp, 2)
+             << " PPU:" << std::setw(3) << dots / ppu_dots_per_scanline % ppu_scanlines
+             << "," << std::setw(3) << dots % ppu_dots_per_scanline
+             << " CYC:" << record.cycles;
+        return line.str();
+}
+
+void write_nestest_log(std::ostream& out, std::vector<TraceRecord> const& records)
+{
+        for (auto const& record : records)
+                out << nestest_line(record) << '\n';
+}
+
+}
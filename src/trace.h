@@ -0,0 +1,97 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "utils.h"
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Emulator {
+
+/**
+ * The CPU as an instruction found it, before executing it. Padded to 32
+ * bytes so that no record straddles two cache lines.
+ */
+struct alignas(32) TraceRecord {
+        Cycles cycles;
+        Address pc;
+        std::array<Byte, 3> bytes; // The opcode and its operand
+        Byte a;
+        Byte x;
+        Byte y;
+        Byte p;
+        Byte sp;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "Recording should touch a single cache line");
+
+class InvalidTrace : public std::runtime_error {
+public:
+        InvalidTrace();
+};
+
+/**
+ * The last so many instructions the CPU executed (see CPU::trace_to).
+ * Recording one writes a single record and bumps a counter, so even a
+ * frame's worth of instructions costs little.
+ */
+class TraceBuffer {
+public:
+        static std::size_t constexpr default_capacity = std::size_t {1} << 20;
+
+        /**
+         * The capacity is rounded up to a power of two.
+         */
+        explicit TraceBuffer(std::size_t capacity = default_capacity);
+
+        void record(TraceRecord const& record) noexcept
+        {
+                records_[recorded_++ & mask_] = record;
+        }
+
+        std::size_t capacity() const noexcept;
+
+        /**
+         * How many instructions were recorded, including those
+         * that have been overwritten since.
+         */
+        std::uint64_t recorded() const noexcept;
+
+        /**
+         * The records still in the buffer, oldest first.
+         */
+        std::vector<TraceRecord> records() const;
+        void clear() noexcept;
+
+        /**
+         * Writes records() in the binary format load_trace() reads,
+         * which is the same on every host.
+         */
+        void save(std::ostream& out) const;
+
+private:
+        std::vector<TraceRecord> records_;
+        std::size_t mask_;
+        std::uint64_t recorded_ = 0;
+};
+
+/**
+ * Throws InvalidTrace if the input isn't a saved trace.
+ */
+std::vector<TraceRecord> load_trace(std::istream& in);
+
+/**
+ * In the format of nestest.log, e.g.
+ * C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+ * without the memory values nestest.log shows after some operands.
+ * The PPU position is worked out from the cycle count.
+ */
+std::string nestest_line(TraceRecord const& record);
+void write_nestest_log(std::ostream& out, std::vector<TraceRecord> const& records);
+
+}
@@ -0,0 +1,36 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "trace.h"
+#include <fstream>
+#include <iostream>
+
+/**
+ * nes-trace TRACE OUTPUT turns an instruction trace saved by
+ * nes-emulator --trace into a log in the format of nestest.log, for
+ * diffing against the logs of other emulators.
+ */
+
+int main(int argc, char** argv)
+{
+        if (argc != 3) {
+                std::cout << "Usage: nes-trace TRACE OUTPUT\n";
+                return 1;
+        }
+
+        try {
+                std::ifstream in(argv[1], std::ios::binary);
+                if (!in)
+                        throw Emulator::CantOpenFile(argv[1]);
+                auto const records = Emulator::load_trace(in);
+
+                std::ofstream out(argv[2]);
+                if (!out)
+                        throw Emulator::CantOpenFile(argv[2]);
+                Emulator::write_nestest_log(out, records);
+                std::cout << "Wrote " << records.size() << " instructions.\n";
+        } catch (std::exception const& e) {
+                std::cerr << e.what() << '\n';
+                return 1;
+        }
+        return 0;
+}
@@ -3,6 +3,10 @@
 #include "utils.h"
 #include "sdl++.h"
 #include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std::string_literals;
 
@@ -74,6 +78,27 @@ void Memory::write_pointer(Address address, Address pointer)
         write_byte(address + 1, high);
 }
 
+void Memory::on_remap(RemapCallback callback)
+{
+        remap_callback_ = std::move(callback);
+}
+
+Byte const* Memory::readable_page(Address) noexcept
+{
+        return nullptr;
+}
+
+Byte* Memory::writable_page(Address) noexcept
+{
+        return nullptr;
+}
+
+void Memory::remapped()
+{
+        if (remap_callback_)
+                remap_callback_();
+}
+
 CantOpenFile::CantOpenFile(std::string const& path)
         : runtime_error("Can't open file "s + path)
 {}
@@ -92,19 +117,56 @@ std::vector<Byte> read_bytes(std::string const& path)
 
 std::vector<Byte> read_bytes(std::ifstream& ifstream)
 {
-        std::vector<Byte> result;
+        // Everything from where the stream is to the end, in one go if
+        // the size can be told up front.
+        auto const start = ifstream.tellg();
+        if (start != -1 && ifstream.seekg(0, std::ios_base::end)) {
+                auto const end = ifstream.tellg();
+                ifstream.seekg(start);
+                std::vector<Byte> result(end - start);
+                ifstream.read(reinterpret_cast<char*>(result.data()), result.size());
+                result.resize(ifstream.gcount());
+                return result;
+        }
+        ifstream.clear();
+        return {std::istreambuf_iterator<char>(ifstream), std::istreambuf_iterator<char>()};
+}
 
-        for (;;) {
-                Byte const b = ifstream.get();
-                if (ifstream.eof())
-                        break;
-                result.push_back(b);
+MappedFile::MappedFile(std::string const& path)
+{
+        int const file = ::open(path.c_str(), O_RDONLY);
+        if (file == -1)
+                throw CantOpenFile(path);
+
+        struct stat status;
+        if (fstat(file, &status) != 0) {
+                ::close(file);
+                throw CantOpenFile(path);
         }
 
-        // Maybe this code would be faster if I used reserve,
-        // or if I read the file multiple bytes at a time.
+        // mmap can't map nothing, and there's nothing to map anyway.
+        size_ = status.st_size;
+        if (size_ > 0)
+                memory_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, file, 0);
+        ::close(file);
+        if (memory_ == MAP_FAILED)
+                throw CantOpenFile(path);
+}
 
-        return result;
+MappedFile::~MappedFile()
+{
+        if (memory_)
+                munmap(memory_, size_);
+}
+
+Byte const* MappedFile::data() const noexcept
+{
+        return static_cast<Byte const*>(memory_);
+}
+
+std::size_t MappedFile::size() const noexcept
+{
+        return size_;
 }
 
 Byte low_byte(Address address) noexcept
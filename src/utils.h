@@ -17,6 +17,7 @@
 #include <iomanip>
 #include <sstream>
 #include <iterator>
+#include <functional>
 
 namespace Emulator {
 
@@ -41,6 +42,7 @@ using AutoBitset = std::bitset<sizeof(T) * CHAR_BIT>;
 using SignedByte = std::int8_t;
 using Byte = std::uint8_t;
 using Address = std::uint16_t;
+using Cycles = std::uint64_t;
 using ByteBitset = std::bitset<CHAR_BIT>;
 template <class T, std::size_t W, std::size_t H>
 using Matrix = std::array<std::array<T, W>, H>;
@@ -88,13 +90,36 @@ protected:
 
 class Memory : public ReadableMemory {
 public:
+        using RemapCallback = std::function<void()>;
+
         bool address_is_writable(Address address) const noexcept;
         void write_byte(Address address, Byte byte);
         void write_pointer(Address address, Address pointer);
 
+        /**
+         * The callback is called whenever different memory gets
+         * mapped to the same addresses, e.g. on a bank switch.
+         */
+        void on_remap(RemapCallback callback);
+
+        /**
+         * The bytes behind the 256 addresses of the page starting at
+         * page_start, if they're plain memory that's all in this piece,
+         * so that a bus can read (or write) them directly. nullptr
+         * otherwise, which is the default, and for pieces that need to
+         * see every access. The pointers stay good until the next remap.
+         */
+        virtual Byte const* readable_page(Address page_start) noexcept;
+        virtual Byte* writable_page(Address page_start) noexcept;
+
 protected:
         virtual bool address_is_writable_impl(Address address) const noexcept = 0;
         virtual void write_byte_impl(Address, Byte byte) = 0;
+
+        void remapped();
+
+private:
+        RemapCallback remap_callback_;
 };
 
 class CantOpenFile : public std::runtime_error {
@@ -117,6 +142,28 @@ std::string format_hex(T value, int width = sizeof(T)*2)
 std::vector<Byte> read_bytes(std::string const& path);
 std::vector<Byte> read_bytes(std::ifstream& ifstream);
 
+/**
+ * A whole file, mapped read-only into memory. Everything that maps the
+ * same file shares its pages through the OS page cache, and only the
+ * pages that get used are ever read.
+ */
+class MappedFile {
+public:
+        explicit MappedFile(std::string const& path);
+        MappedFile(MappedFile const&) = delete;
+        MappedFile(MappedFile&&) = delete;
+        MappedFile& operator=(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile&&) = delete;
+        ~MappedFile();
+
+        Byte const* data() const noexcept;
+        std::size_t size() const noexcept;
+
+private:
+        void* memory_ = nullptr;
+        std::size_t size_ = 0;
+};
+
 template <class T>
 bool get_bit(T t, unsigned bit_num) noexcept
 {
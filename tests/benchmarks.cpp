@@ -0,0 +1,296 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "mem.h"
+#include "../src/utils.h"
+#include "../src/cpu.h"
+#include "../src/alu.h"
+#include "../src/recompiled.h"
+#include "../src/recompiler.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Not a test suite, just a quick way to see how fast the CPU core is.
+ * Build with -DCMAKE_BUILD_TYPE=Release, otherwise the numbers are meaningless.
+ */
+
+namespace {
+
+unsigned constexpr program_start = 0x0600u;
+
+class BenchmarkMemory : public Emulator::CPU::RAM {
+public:
+        explicit BenchmarkMemory(std::vector<Emulator::Byte> const& program)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(program_start + i, program[i]);
+        }
+
+private:
+        bool address_is_readable_impl(Emulator::Address address) const noexcept override
+        {
+                using CPU = Emulator::CPU;
+                auto const reset_handler_address =
+                        CPU::interrupt_handler_address(CPU::Interrupt::reset);
+                return address == reset_handler_address ||
+                       address == reset_handler_address + 1 ||
+                       RAM::address_is_readable_impl(address);
+        }
+
+        Emulator::Byte read_byte_impl(Emulator::Address address) override
+        {
+                using CPU = Emulator::CPU;
+                auto const reset_handler_address =
+                        CPU::interrupt_handler_address(CPU::Interrupt::reset);
+                if (address == reset_handler_address)
+                        return Emulator::low_byte(program_start);
+                else if (address == reset_handler_address + 1)
+                        return Emulator::high_byte(program_start);
+                return RAM::read_byte_impl(address);
+        }
+};
+
+/**
+ loop:
+   LDA $00
+   CLC
+   ADC #$03
+   STA $00
+   STA $0200,X
+   LDX $01
+   INX
+   STX $01
+   CPX #$80
+   BNE loop
+   JMP loop
+*/
+
+std::vector<Emulator::Byte> const alu_loop {
+        0xA5, 0x00, 0x18, 0x69, 0x03, 0x85, 0x00, 0x9D,
+        0x00, 0x02, 0xA6, 0x01, 0xE8, 0x86, 0x01, 0xE0,
+        0x80, 0xD0, 0xED, 0x4C, 0x00, 0x06
+};
+
+/**
+ The same loop in PRG ROM, where nes-recompile looks for code.
+*/
+Emulator::Address constexpr rom_start = 0x8000;
+
+std::vector<Emulator::Byte> const rom_alu_loop {
+        0xA5, 0x00, 0x18, 0x69, 0x03, 0x85, 0x00, 0x9D,
+        0x00, 0x02, 0xA6, 0x01, 0xE8, 0x86, 0x01, 0xE0,
+        0x80, 0xD0, 0xED, 0x4C, 0x00, 0x80
+};
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+                for (auto const interrupt : {Emulator::CPU::Interrupt::nmi,
+                                             Emulator::CPU::Interrupt::reset,
+                                             Emulator::CPU::Interrupt::irq})
+                        write_pointer(Emulator::CPU::interrupt_handler_address(interrupt), rom_start);
+        }
+};
+
+unsigned long constexpr instructions_per_run = 20'000'000;
+unsigned long constexpr alu_operations_per_run = 100'000'000;
+
+template <class Execute>
+void benchmark_instructions(std::string const& name,
+                            std::vector<Emulator::Byte> const& program,
+                            Execute execute)
+{
+        BenchmarkMemory memory(program);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&memory});
+
+        auto const start = std::chrono::steady_clock::now();
+        execute(cpu);
+        auto const end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double> const seconds = end - start;
+        std::cout << name << ": "
+                  << instructions_per_run / seconds.count() / 1e6
+                  << " million instructions/s\n";
+}
+
+void one_by_one(Emulator::CPU& cpu)
+{
+        for (unsigned long i = 0; i < instructions_per_run; ++i)
+                cpu.execute_instruction();
+}
+
+void batched(Emulator::CPU& cpu)
+{
+        cpu.execute_instructions(instructions_per_run);
+}
+
+/**
+ * Recompiles the program like nes-recompile does, and builds it with
+ * $CXX (c++ by default) and $CXXFLAGS. Returns nullptr if that fails.
+ */
+std::unique_ptr<Emulator::Recompiled::SharedLibrary> recompile(std::vector<Emulator::Byte> const& program)
+{
+        RomMemory memory(program);
+        Emulator::Recompiler recompiler(memory);
+        recompiler.walk_from_vectors();
+
+        char const* const temporary = std::getenv("TMPDIR");
+        std::string const stem = std::string(temporary ? temporary : "/tmp") + "/nes-benchmark-recompiled";
+        std::ofstream source(stem + ".cpp");
+        recompiler.generate(source);
+        source.close();
+
+        char const* const compiler = std::getenv("CXX");
+        char const* const flags = std::getenv("CXXFLAGS");
+        std::string const command = std::string(compiler ? compiler : "c++") + " " + (flags ? flags : "") +
+                                    " -std=c++17 -O2 -shared -fPIC -I " EMULATOR_SOURCE_DIR " " +
+                                    stem + ".cpp -o " + stem + ".so";
+        if (std::system(command.c_str()) != 0)
+                return nullptr;
+        return std::make_unique<Emulator::Recompiled::SharedLibrary>(stem + ".so");
+}
+
+/**
+ * The ALU loop from ROM, through the block cache and then recompiled
+ * ahead of time. Both have to end up in the same state.
+ */
+void benchmark_recompiled()
+{
+        auto const run = [](std::string const& name, Emulator::Recompiled::Library const* library) {
+                Emulator::CPU::RAM ram;
+                RomMemory memory(rom_alu_loop);
+                auto cpu = std::make_unique<Emulator::CPU>(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+                if (library)
+                        cpu->use_recompiled_code(*library);
+
+                auto const start = std::chrono::steady_clock::now();
+                cpu->execute_instructions(instructions_per_run);
+                auto const end = std::chrono::steady_clock::now();
+
+                std::chrono::duration<double> const seconds = end - start;
+                std::cout << name << ": "
+                          << instructions_per_run / seconds.count() / 1e6
+                          << " million instructions/s\n";
+                return cpu;
+        };
+
+        auto const cached = run("ALU loop from ROM, block cache", nullptr);
+        auto const library = recompile(rom_alu_loop);
+        if (!library) {
+                std::cout << "ALU loop from ROM, recompiled: couldn't build the recompiled code\n";
+                return;
+        }
+        auto const recompiled = run("ALU loop from ROM, recompiled", &library->library());
+        if (recompiled->cycles() != cached->cycles() || recompiled->pc() != cached->pc() ||
+            recompiled->a() != cached->a() || recompiled->x() != cached->x() ||
+            recompiled->p() != cached->p())
+                std::cout << "The recompiled code ended up in a different state!\n";
+}
+
+#ifdef EMULATOR_JIT
+
+/**
+ * The ALU loop from ROM once the JIT has compiled it. Compiling happens
+ * in the background, so the CPU gets warmed up first.
+ */
+void benchmark_jit()
+{
+        Emulator::CPU::RAM ram;
+        RomMemory memory(rom_alu_loop);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+        cpu.execute_instructions(100'000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cpu.execute_instructions(100'000);
+
+        auto const start = std::chrono::steady_clock::now();
+        cpu.execute_instructions(instructions_per_run);
+        auto const end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double> const seconds = end - start;
+        std::cout << "ALU loop from ROM, JIT: "
+                  << instructions_per_run / seconds.count() / 1e6
+                  << " million instructions/s\n";
+}
+
+#endif
+
+/**
+ * Each result feeds into the next operation, like it would in
+ * a 6502 program, so lookups pay their full latency.
+ */
+template <class Operation>
+void benchmark_alu(std::string const& name, Operation operation)
+{
+        std::mt19937 random;
+        std::uniform_int_distribution<unsigned> distribution(0, Emulator::byte_max);
+        std::vector<Emulator::Byte> operands(alu_operations_per_run);
+        for (auto& operand : operands)
+                operand = distribution(random);
+
+        Emulator::Byte a = 0;
+        bool carry = false;
+        unsigned long checksum = 0;
+
+        auto const start = std::chrono::steady_clock::now();
+        for (auto const operand : operands) {
+                Emulator::Alu::Result const result = operation(a, operand, carry);
+                a = result;
+                carry = result >> Emulator::Alu::carry_bit & 1;
+                checksum += result;
+        }
+        auto const end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double> const seconds = end - start;
+        std::cout << name << ": "
+                  << alu_operations_per_run / seconds.count() / 1e6
+                  << " million operations/s (checksum " << checksum << ")\n";
+}
+
+Emulator::Alu::Result add_arithmetic(Emulator::Byte a, Emulator::Byte operand, bool carry)
+{
+        return Emulator::Alu::add(a, operand, carry);
+}
+
+Emulator::Alu::Result add_table(Emulator::Byte a, Emulator::Byte operand, bool carry)
+{
+        return Emulator::Alu::add_table[Emulator::Alu::add_index(a, operand, carry)];
+}
+
+Emulator::Alu::Result rotate_arithmetic(Emulator::Byte a, Emulator::Byte operand, bool carry)
+{
+        return Emulator::Alu::shift_right(a ^ operand, carry);
+}
+
+Emulator::Alu::Result rotate_table(Emulator::Byte a, Emulator::Byte operand, bool carry)
+{
+        auto const index = Emulator::Alu::shift_index(a ^ operand, carry);
+        return Emulator::Alu::shift_right_table[index];
+}
+
+}
+
+int main()
+{
+        benchmark_instructions("ALU loop, one by one", alu_loop, one_by_one);
+        benchmark_instructions("ALU loop, batched", alu_loop, batched);
+        benchmark_recompiled();
+#ifdef EMULATOR_JIT
+        benchmark_jit();
+#endif
+        benchmark_alu("ADC, arithmetic", add_arithmetic);
+        benchmark_alu("ADC, lookup table", add_table);
+        benchmark_alu("ROR, arithmetic", rotate_arithmetic);
+        benchmark_alu("ROR, lookup table", rotate_table);
+}
+
@@ -2,8 +2,11 @@
 
 #include "catch.hpp"
 #include "../src/cartridge.h"
+#include <algorithm>
 #include <array>
+#include <memory>
 #include <string>
+#include <vector>
 
 using namespace std::string_literals;
 
@@ -84,3 +87,84 @@ TEST_CASE("Loading a cartridge that doesn't exist on disk should fail")
                           Emulator::CantOpenFile);
 }
 
+
+namespace {
+
+/**
+ * An NROM cartridge image with the given number of PRG ROM banks, each
+ * starting with its bank number and ending with the number plus $80.
+ */
+std::vector<Emulator::Byte> nrom_image(Emulator::Byte prg_rom_banks)
+{
+        std::vector<Emulator::Byte> data {'N', 'E', 'S', 0x1A, prg_rom_banks, 1};
+        data.resize(Emulator::Cartridge::header_size);
+        for (Emulator::Byte bank = 0; bank < prg_rom_banks; ++bank) {
+                std::vector<Emulator::Byte> bytes(Emulator::Cartridge::prg_rom_bank_size);
+                bytes.front() = bank;
+                bytes.back() = bank + 0x80;
+                data.insert(data.end(), bytes.cbegin(), bytes.cend());
+        }
+        data.resize(data.size() + 0x2000); // CHR ROM
+        return data;
+}
+
+}
+
+TEST_CASE("PRG ROM banks show up where the CPU expects them")
+{
+        SECTION("Two banks fill both halves")
+        {
+                Emulator::Cartridge const cartridge(nrom_image(2));
+                CHECK(cartridge.read_prg_rom_byte(0x8000) == 0x00);
+                CHECK(cartridge.read_prg_rom_byte(0xBFFF) == 0x80);
+                CHECK(cartridge.read_prg_rom_byte(0xC000) == 0x01);
+                CHECK(cartridge.read_prg_rom_byte(0xFFFF) == 0x81);
+        }
+
+        SECTION("A single bank is mirrored in both halves")
+        {
+                Emulator::Cartridge const cartridge(nrom_image(1));
+                CHECK(cartridge.read_prg_rom_byte(0x8000) == 0x00);
+                CHECK(cartridge.read_prg_rom_byte(0xBFFF) == 0x80);
+                CHECK(cartridge.read_prg_rom_byte(0xC000) == 0x00);
+                CHECK(cartridge.read_prg_rom_byte(0xFFFF) == 0x80);
+        }
+}
+
+TEST_CASE("NROM PRG RAM writes stay in PRG RAM")
+{
+        // Whatever comes right after the mapper would get the writes
+        // if PRG RAM were indexed by the CPU address.
+        struct Guarded {
+                Emulator::NROM nrom;
+                std::array<Emulator::Byte, 0x8000> after {};
+        };
+
+        Emulator::Cartridge const cartridge(nrom_image(1));
+        std::unique_ptr<Guarded> const guarded(new Guarded {Emulator::NROM(cartridge)});
+        guarded->nrom.write_byte(Emulator::NROM::prg_ram_start, 0x12);
+        guarded->nrom.write_byte(Emulator::NROM::prg_ram_end, 0x34);
+
+        CHECK(guarded->nrom.read_byte(Emulator::NROM::prg_ram_start) == 0x12);
+        CHECK(guarded->nrom.read_byte(Emulator::NROM::prg_ram_end) == 0x34);
+        CHECK(std::all_of(guarded->after.cbegin(), guarded->after.cend(),
+                          [](Emulator::Byte byte) { return byte == 0; }));
+}
+
+TEST_CASE("A mapped cartridge has the same data as one read into memory")
+{
+        auto const path = "../roms/Super Mario Bros. 1.nes"s;
+        Emulator::Cartridge const mapped(path);
+        Emulator::Cartridge const read(Emulator::read_bytes(path));
+
+        CHECK(mapped.mmc_id() == read.mmc_id());
+        for (unsigned address = Emulator::Cartridge::prg_rom_lower_bank_start; address <= 0xFFFF; ++address)
+                REQUIRE(mapped.read_prg_rom_byte(address) == read.read_prg_rom_byte(address));
+}
+
+TEST_CASE("Loading a cartridge shorter than its PRG ROM should fail")
+{
+        std::vector<Emulator::Byte> data {'N', 'E', 'S', 0x1A, 2, 1};
+        data.resize(Emulator::Cartridge::header_size + Emulator::Cartridge::prg_rom_bank_size);
+        REQUIRE_THROWS_AS(Emulator::Cartridge(data), Emulator::InvalidCartridge);
+}
@@ -2,10 +2,12 @@
 
 #include "catch.hpp"
 #include "mem.h"
+#include "differential.h"
 #include "../src/utils.h"
 #include "../src/cpu.h"
 #include <utility>
 #include <memory>
+#include <numeric>
 
 /**
  * TODO Interrupts haven't been tested.
@@ -59,13 +61,132 @@ private:
         }
 };
 
+/**
+ * Two banks of a single page at $8000, switched by writing to it. Reads
+ * can go straight to the bytes of the current bank.
+ */
+class BankedPage : public Emulator::Memory {
+public:
+        static Emulator::Address constexpr start = 0x8000;
+
+        std::array<std::array<Emulator::Byte, 0x100>, 2> banks {};
+        unsigned remaps = 0;
+
+        Emulator::Byte const* readable_page(Emulator::Address page_start) noexcept override
+        {
+                return page_start == start ? banks[bank_].data() : nullptr;
+        }
+
+protected:
+        bool address_is_writable_impl(Emulator::Address address) const noexcept override
+        {
+                return Emulator::high_byte(address) == Emulator::high_byte(start);
+        }
+
+        bool address_is_readable_impl(Emulator::Address address) const noexcept override
+        {
+                return address_is_writable_impl(address);
+        }
+
+        void write_byte_impl(Emulator::Address, Emulator::Byte byte) override
+        {
+                bank_ = byte % banks.size();
+                ++remaps;
+                remapped();
+        }
+
+        Emulator::Byte read_byte_impl(Emulator::Address address) override
+        {
+                return banks[bank_][Emulator::low_byte(address)];
+        }
+
+private:
+        std::size_t bank_ = 0;
+};
+
+/**
+ * Two registers at $4016 and $4017, with nothing else on their page, like
+ * the joypads.
+ */
+class IoRegisters : public Emulator::Memory {
+public:
+        std::array<Emulator::Byte, 2> registers {};
+
+protected:
+        bool address_is_writable_impl(Emulator::Address address) const noexcept override
+        {
+                return address == 0x4016 || address == 0x4017;
+        }
+
+        bool address_is_readable_impl(Emulator::Address address) const noexcept override
+        {
+                return address_is_writable_impl(address);
+        }
+
+        void write_byte_impl(Emulator::Address address, Emulator::Byte byte) override
+        {
+                registers[address - 0x4016] = byte;
+        }
+
+        Emulator::Byte read_byte_impl(Emulator::Address address) override
+        {
+                return registers[address - 0x4016];
+        }
+};
+
+/**
+ * Runs the program up to program_end one instruction at a time, then
+ * runs the same number of instructions in one go on another CPU.
+ */
+void check_batch_matches_one_by_one(std::vector<Emulator::Byte> const& program,
+                                    Emulator::Address program_end)
+{
+        ExampleMemory single_memory(program);
+        Emulator::CPU single(Emulator::CPU::AccessibleMemory::Pieces {&single_memory});
+        std::size_t instructions = 0;
+        while (single.pc() != program_end) {
+                single.execute_instruction();
+                ++instructions;
+        }
+
+        ExampleMemory batch_memory(program);
+        Emulator::CPU batch(Emulator::CPU::AccessibleMemory::Pieces {&batch_memory});
+        CHECK(batch.execute_instructions(instructions) == single.cycles());
+
+        CHECK(batch.a() == single.a());
+        CHECK(batch.x() == single.x());
+        CHECK(batch.y() == single.y());
+        CHECK(batch.p() == single.p());
+        CHECK(batch.pc() == single.pc());
+        CHECK(batch.sp() == single.sp());
+        CHECK(batch.cycles() == single.cycles());
+        for (unsigned i = 0; i < program_start; ++i)
+                CHECK(batch.read_byte(i) == single.read_byte(i));
+}
+
+/**
+ * Every example program also gets run on all the engines, in lockstep
+ * with the reference CPU.
+ */
 std::unique_ptr<Emulator::CPU> execute_example_program(ExampleMemory& example_memory,
                                                        std::size_t program_size)
 {
+        auto image = Differential::program_image({}, program_start);
+        std::copy(example_memory.data(), example_memory.data() + Emulator::CPU::RAM::real_size, image.begin());
+
         auto cpu = std::make_unique<Emulator::CPU>(
                 Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
-        while (cpu->pc() != program_start + program_size)
+        std::size_t instructions = 0;
+        while (cpu->pc() != program_start + program_size) {
                 cpu->execute_instruction();
+                ++instructions;
+        }
+
+        for (auto const& engine : Differential::engines()) {
+                INFO(engine.name);
+                auto const divergence = Differential::find_divergence(engine, image, instructions);
+                CHECK(divergence.value_or("") == "");
+        }
         return cpu;
 }
 
@@ -138,6 +259,104 @@ TEST_CASE("CPU::AccessibleMemory tests")
         }
 }
 
+TEST_CASE("CPU::AccessibleMemory follows bank switches")
+{
+        Emulator::CPU::RAM ram;
+        BankedPage banked;
+        banked.banks[0][0x34] = 0xAA;
+        banked.banks[1][0x34] = 0xBB;
+        Emulator::CPU::AccessibleMemory accessible_memory({&ram, &banked});
+        unsigned remaps = 0;
+        accessible_memory.on_remap([&] { ++remaps; });
+
+        accessible_memory.write(0x0834, 0x12);
+        CHECK(ram.read_byte(0x0034) == 0x12);
+        CHECK(accessible_memory.read(0x1034) == 0x12);
+
+        CHECK(accessible_memory.read(0x8034) == 0xAA);
+        accessible_memory.write(0x80FF, 1);
+        CHECK(banked.remaps == 1);
+        CHECK(remaps == 1);
+        CHECK(accessible_memory.read(0x8034) == 0xBB);
+        CHECK(accessible_memory.read_byte(0x8034) == 0xBB);
+        CHECK(accessible_memory.readable_piece(0x8034) == 1);
+}
+
+TEST_CASE("Addresses nothing is at see the open bus")
+{
+        Emulator::CPU::RAM ram;
+        Emulator::CPU::AccessibleMemory accessible_memory({&ram});
+
+        accessible_memory.write(0x0010, 0x5A);
+        CHECK(accessible_memory.read(0x4000) == 0x5A);
+        accessible_memory.write(0x4000, 0x33);
+        CHECK(accessible_memory.read(0x8000) == 0x33);
+        CHECK(accessible_memory.read(0x0010) == 0x5A);
+        CHECK(accessible_memory.read(0x8000) == 0x5A);
+        CHECK(accessible_memory.invalid_accesses().reads == 0);
+        CHECK(accessible_memory.invalid_accesses().writes == 0);
+
+        SECTION("Strict mode counts the accesses")
+        {
+                accessible_memory.set_strict(true);
+                accessible_memory.read(0x4000);
+                accessible_memory.read(0x0010);
+                accessible_memory.write(0xFFFF, 0);
+                CHECK(accessible_memory.invalid_accesses().reads == 1);
+                CHECK(accessible_memory.invalid_accesses().writes == 1);
+        }
+
+        SECTION("Checked accesses still throw")
+        {
+                CHECK_THROWS_AS(accessible_memory.read_byte(0x4000), Emulator::InvalidRead);
+                CHECK_THROWS_AS(accessible_memory.write_byte(0x4000, 0), Emulator::InvalidWrite);
+        }
+
+        SECTION("The CPU runs on")
+        {
+                /**
+                 LDA $10
+                 LDA $5000
+                 STA $5001
+                */
+                ExampleMemory memory({0xA5, 0x10, 0xAD, 0x00, 0x50, 0x8D, 0x01, 0x50});
+                memory.write_byte(0x0010, 0x77);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&memory});
+                cpu.set_strict(true);
+                for (int i = 0; i < 3; ++i)
+                        cpu.execute_instruction();
+                CHECK(cpu.a() == 0x50); // The high byte of the address
+                CHECK(cpu.pc() == program_start + 8);
+                CHECK(cpu.invalid_accesses().reads == 1);
+                CHECK(cpu.invalid_accesses().writes == 1);
+        }
+}
+
+TEST_CASE("An I/O page belongs to the piece with registers on it")
+{
+        Emulator::CPU::RAM ram;
+        IoRegisters io;
+        Emulator::CPU::AccessibleMemory accessible_memory({&ram, &io});
+        accessible_memory.set_strict(true);
+
+        accessible_memory.write(0x4016, 0x21);
+        accessible_memory.write(0x4017, 0x42);
+        CHECK(io.registers[0] == 0x21);
+        CHECK(io.registers[1] == 0x42);
+        CHECK(accessible_memory.read(0x4016) == 0x21);
+        CHECK(accessible_memory.readable_piece(0x4017) == 1);
+        CHECK(accessible_memory.writable_piece(0x4016) == 1);
+
+        CHECK(accessible_memory.readable_piece(0x4000) == accessible_memory.piece_count());
+        CHECK(accessible_memory.writable_piece(0x40FF) == accessible_memory.piece_count());
+        CHECK(accessible_memory.read(0x4000) == 0x21);
+        accessible_memory.write(0x4018, 0x99);
+        CHECK(io.registers[0] == 0x21);
+        CHECK(io.registers[1] == 0x42);
+        CHECK(accessible_memory.invalid_accesses().reads == 1);
+        CHECK(accessible_memory.invalid_accesses().writes == 1);
+}
+
 TEST_CASE("6502 instructions tests")
 {
         SECTION("Some values are loaded into the regisers")
@@ -2501,3 +2720,899 @@ TEST_CASE("6502 instructions tests")
         // TODO Test BRK, if that's even possible
 }
 
+
+/**
+ * Memory where the zero page and the stack aren't in a CPU::RAM,
+ * so the CPU can't take any shortcuts to them.
+ */
+class FlatMemory : public TestMemory<0x10000> {
+public:
+        explicit FlatMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(0x0000)
+        {
+                for (unsigned i = 0; i < size; ++i)
+                        write_byte(i, 0x00);
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(program_start + i, program[i]);
+                write_pointer(Emulator::CPU::interrupt_handler_address(Emulator::CPU::Interrupt::reset),
+                              program_start);
+        }
+};
+
+TEST_CASE("Zero page and stack accesses wrap around")
+{
+        auto const check_wraps = [](std::vector<Emulator::Byte> const& program, auto check) {
+                SECTION("Through the RAM directly")
+                {
+                        ExampleMemory example_memory(program);
+                        std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+                        check(*cpu);
+                }
+
+                SECTION("Through the memory pieces")
+                {
+                        FlatMemory flat_memory(program);
+                        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&flat_memory});
+                        while (cpu.pc() != program_start + program.size())
+                                cpu.execute_instruction();
+                        check(cpu);
+                }
+        };
+
+        SECTION("Zero page indexing")
+        {
+                /**
+                 LDX #$01
+                 LDA #$42
+                 STA $FF,X
+                 LDY $00
+                */
+
+                check_wraps({0xA2, 0x01, 0xA9, 0x42, 0x95, 0xFF, 0xA4, 0x00},
+                            [](Emulator::CPU& cpu) {
+                                    CHECK(cpu.y() == 0x42);
+                                    CHECK(cpu.read_byte(0x0100) == 0x00);
+                            });
+        }
+
+        SECTION("Pointers on the zero page")
+        {
+                /**
+                 LDA #$00
+                 STA $FF
+                 LDA #$03
+                 STA $00
+                 LDA #$42
+                 LDY #$01
+                 STA ($FF),Y
+                 LDX #$FF
+                 LDA ($00,X)
+                */
+
+                check_wraps({0xA9, 0x00, 0x85, 0xFF, 0xA9, 0x03, 0x85, 0x00,
+                             0xA9, 0x42, 0xA0, 0x01, 0x91, 0xFF, 0xA2, 0xFF,
+                             0xA1, 0x00},
+                            [](Emulator::CPU& cpu) {
+                                    CHECK(cpu.read_byte(0x0301) == 0x42);
+                                    CHECK(cpu.a() == 0x00);
+                            });
+        }
+
+        SECTION("The stack")
+        {
+                /**
+                 LDX #$00
+                 TXS
+                 LDA #$42
+                 PHA
+                 PHA
+                 LDA #$00
+                 PLA
+                 PLA
+                */
+
+                check_wraps({0xA2, 0x00, 0x9A, 0xA9, 0x42, 0x48, 0x48, 0xA9,
+                             0x00, 0x68, 0x68},
+                            [](Emulator::CPU& cpu) {
+                                    CHECK(cpu.read_byte(0x0100) == 0x42);
+                                    CHECK(cpu.read_byte(0x01FF) == 0x42);
+                                    CHECK(cpu.read_byte(0x0200) == 0x00);
+                                    CHECK(cpu.a() == 0x42);
+                                    CHECK(cpu.sp() == 0x00);
+                            });
+        }
+}
+
+TEST_CASE("6502 cycle counting tests")
+{
+        auto const count_cycles = [](std::vector<Emulator::Byte> const& program)
+        {
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                std::vector<unsigned> cycles;
+                while (cpu.pc() != program_start + program.size())
+                        cycles.push_back(cpu.execute_instruction());
+                CHECK(cpu.cycles() == std::accumulate(cycles.cbegin(), cycles.cend(), 0u));
+                return cycles;
+        };
+
+        SECTION("Indexed reads pay for crossing a page, writes don't")
+        {
+                /**
+                 LDX #$01
+                 LDA $02FF,X
+                 LDA $0200,X
+                 STA $02FF,X
+                 BEQ next
+                 next:
+                   BNE next
+                   NOP
+                */
+
+                std::vector<Emulator::Byte> program {
+                        0xA2, 0x01, 0xBD, 0xFF, 0x02, 0xBD, 0x00, 0x02,
+                        0x9D, 0xFF, 0x02, 0xF0, 0x00, 0xD0, 0xFE, 0xEA
+                };
+
+                CHECK(count_cycles(program) == std::vector<unsigned> {2, 5, 4, 5, 3, 2, 2});
+        }
+
+        SECTION("Indirect indexed reads pay for crossing a page")
+        {
+                /**
+                 LDA #$F0
+                 STA $10
+                 LDY #$20
+                 LDA ($10),Y
+                 LDY #$0F
+                 LDA ($10),Y
+                 STA ($10),Y
+                */
+
+                std::vector<Emulator::Byte> program {
+                        0xA9, 0xF0, 0x85, 0x10, 0xA0, 0x20, 0xB1, 0x10,
+                        0xA0, 0x0F, 0xB1, 0x10, 0x91, 0x10
+                };
+
+                CHECK(count_cycles(program) == std::vector<unsigned> {2, 3, 2, 6, 2, 5, 6});
+        }
+
+        SECTION("A taken branch that crosses a page takes two extra cycles")
+        {
+                std::vector<Emulator::Byte> program(0xFC + 5, 0xEA); // NOPs up to $06FC
+                program[0xFC] = 0xD0; // BNE $0700
+                program[0xFC + 1] = 0x02;
+
+                auto const cycles = count_cycles(program);
+                REQUIRE(cycles.size() == 0xFC + 2);
+                CHECK(cycles[0xFC] == 4);
+                CHECK(cycles.back() == 2);
+        }
+}
+
+TEST_CASE("Executing instructions in a batch matches executing them one by one")
+{
+        /**
+         The "Some branches are selected" program, with a
+         JSR/RTS thrown in.
+        */
+
+        std::vector<Emulator::Byte> const program {
+                0xA9, 0xFE, 0x69, 0x01, 0x10, 0x02, 0x85, 0x00, 
+                0x30, 0x02, 0x85, 0x01, 0x85, 0x02, 0xA9, 0x00,
+                0x69, 0x05, 0xE6, 0x04, 0xA6, 0x04, 0xE0, 0x0A, 
+                0xD0, 0xF6, 0xF0, 0x05, 0xA9, 0x22, 0x8D, 0x00,
+                0x02, 0x85, 0x03, 0x38, 0x90, 0xFB, 0xB0, 0x05, 
+                0xA9, 0x22, 0x8D, 0x00, 0x02, 0xEA, 0x18, 0x90,
+                0x05, 0xA9, 0x22, 0x8D, 0x00, 0x02, 0xA9, 0x7F, 
+                0x69, 0x01, 0x50, 0x02, 0x70, 0x05, 0xA9, 0x22,
+                0x8D, 0x00, 0x02, 0xA9, 0x00, 0x69, 0x02, 0x70, 
+                0x02, 0x50, 0x05, 0xA9, 0x22, 0x8D, 0x00, 0x02,
+                0x20, 0x56, 0x06, 0xEA, 0xEA, 0xE8, 0x60
+        };
+        Emulator::Address constexpr program_end = 0x0655;
+
+        check_batch_matches_one_by_one(program, program_end);
+}
+
+TEST_CASE("Hot loops give the same results however they're executed")
+{
+        /**
+         Long enough for the inner loop to get hot, and it
+         overwrites the operand of its ADC every time around.
+
+           LDY #$00
+         outer:
+           LDX #$00
+         inner:
+           TXA
+           CLC
+           ADC $0300,Y
+           STA $0300,X
+           INX
+           BNE inner
+           INC $0607 ; The operand of the ADC above
+           INY
+           CPY #$40
+           BNE outer
+        */
+
+        std::vector<Emulator::Byte> const program {
+                0xA0, 0x00, 0xA2, 0x00, 0x8A, 0x18, 0x79, 0x00,
+                0x03, 0x9D, 0x00, 0x03, 0xE8, 0xD0, 0xF5, 0xEE,
+                0x07, 0x06, 0xC8, 0xC0, 0x40, 0xD0, 0xEB
+        };
+        Emulator::Address constexpr program_end = 0x0617;
+
+        check_batch_matches_one_by_one(program, program_end);
+}
+
+TEST_CASE("Self-modifying code tests")
+{
+        auto const check_program = [](std::vector<Emulator::Byte> const& program,
+                                      std::size_t instructions)
+        {
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                cpu.execute_instructions(instructions);
+                return cpu.x();
+        };
+
+        SECTION("An instruction overwrites the next one")
+        {
+                /**
+                 LDA #$42
+                 STA $0606 ; The operand of the LDX below
+                 LDX #$00
+                */
+
+                std::vector<Emulator::Byte> program {
+                        0xA9, 0x42, 0x8D, 0x06, 0x06, 0xA2, 0x00
+                };
+
+                CHECK(check_program(program, 3) == 0x42);
+        }
+
+        SECTION("An instruction overwrites the next one through a mirror")
+        {
+                /**
+                 LDA #$42
+                 STA $1606 ; The operand of the LDX below, mirrored
+                 LDX #$00
+                */
+
+                std::vector<Emulator::Byte> program {
+                        0xA9, 0x42, 0x8D, 0x06, 0x16, 0xA2, 0x00
+                };
+
+                CHECK(check_program(program, 3) == 0x42);
+        }
+
+        SECTION("A loop overwrites its own code")
+        {
+                /**
+                 loop:
+                   LDX #$00
+                   INC $0601 ; The operand of the LDX above
+                   LDA $0601
+                   CMP #$05
+                   BNE loop
+                */
+
+                std::vector<Emulator::Byte> program {
+                        0xA2, 0x00, 0xEE, 0x01, 0x06, 0xAD, 0x01, 0x06,
+                        0xC9, 0x05, 0xD0, 0xF4
+                };
+
+                // The last time around the loop, the LDX is LDX #$04.
+                CHECK(check_program(program, 5 * 5) == 0x04);
+        }
+}
+
+TEST_CASE("6502 status flag tests")
+{
+        SECTION("ADC carries out when a carry in makes it wrap around")
+        {
+                /**
+                 SEC
+                 LDA #$10
+                 ADC #$FF
+                */
+
+                std::vector<Emulator::Byte> const program {0x38, 0xA9, 0x10, 0x69, 0xFF};
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK(cpu->a() == 0x10);
+                CHECK(cpu->p() == 0x21);
+        }
+
+        SECTION("SBC of equal values borrows when there's a borrow in")
+        {
+                /**
+                 CLC
+                 LDA #$10
+                 SBC #$10
+                */
+
+                std::vector<Emulator::Byte> const program {0x18, 0xA9, 0x10, 0xE9, 0x10};
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK(cpu->a() == 0xFF);
+                CHECK(cpu->p() == 0xA0);
+        }
+
+        SECTION("BIT takes N and V from memory, and Z from A AND memory")
+        {
+                /**
+                 LDA #$C0
+                 STA $00
+                 LDA #$01
+                 BIT $00
+                */
+
+                std::vector<Emulator::Byte> const program {
+                        0xA9, 0xC0, 0x85, 0x00, 0xA9, 0x01, 0x24, 0x00
+                };
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK(cpu->p() == 0xE2);
+        }
+
+        SECTION("Flags pulled with PLP are pushed back by PHP")
+        {
+                /**
+                 LDA #$C3
+                 PHA
+                 PLP
+                 PHP
+                 PLA
+                */
+
+                std::vector<Emulator::Byte> const program {0xA9, 0xC3, 0x48, 0x28, 0x08, 0x68};
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK(cpu->a() == 0xE3);
+                CHECK(cpu->p() == 0xE1);
+        }
+
+        SECTION("PLP doesn't take B from the stack")
+        {
+                /**
+                 LDA #$FF
+                 PHA
+                 PLP
+                */
+
+                std::vector<Emulator::Byte> const program {0xA9, 0xFF, 0x48, 0x28};
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK(cpu->p() == 0xEF);
+        }
+
+        SECTION("TXS leaves the flags alone")
+        {
+                /**
+                 LDX #$00
+                 LDA #$80
+                 TXS
+                */
+
+                std::vector<Emulator::Byte> const program {0xA2, 0x00, 0xA9, 0x80, 0x9A};
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK(cpu->sp() == 0x00);
+                CHECK((cpu->p() & 0x82) == 0x80);
+        }
+
+        SECTION("SED and CLD set and clear D")
+        {
+                /**
+                 SED
+                 PHP
+                 PLA
+                 TAX
+                 CLD
+                 PHP
+                 PLA
+                */
+
+                std::vector<Emulator::Byte> const program {0xF8, 0x08, 0x68, 0xAA, 0xD8, 0x08, 0x68};
+
+                ExampleMemory example_memory(program);
+                std::unique_ptr cpu = execute_example_program(example_memory, program.size());
+
+                CHECK((cpu->x() & 0x08) != 0);
+                CHECK((cpu->a() & 0x08) == 0);
+        }
+
+        SECTION("RTI pulls the flags and returns to the pulled address itself")
+        {
+                /**
+                 LDA #$06
+                 PHA
+                 LDA #$0B
+                 PHA
+                 LDA #$C3
+                 PHA
+                 RTI
+                 NOP
+                */
+
+                std::vector<Emulator::Byte> const program {
+                        0xA9, 0x06, 0x48, 0xA9, 0x0B, 0x48, 0xA9, 0xC3,
+                        0x48, 0x40, 0xEA
+                };
+
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                for (int i = 0; i < 7; ++i)
+                        cpu.execute_instruction();
+
+                CHECK(cpu.pc() == 0x060B);
+                CHECK(cpu.p() == 0xE3);
+        }
+}
+
+TEST_CASE("Running the CPU for a cycle budget")
+{
+        /**
+         loop:
+           LDA #$01
+           LDX #$02
+           STA $0200
+           INX
+           JMP loop
+        */
+
+        std::vector<Emulator::Byte> const program {
+                0xA9, 0x01, 0xA2, 0x02, 0x8D, 0x00, 0x02, 0xE8,
+                0x4C, 0x00, 0x06
+        };
+
+        SECTION("The CPU stops at the first instruction that uses up the budget")
+        {
+                ExampleMemory single_memory(program);
+                Emulator::CPU single(Emulator::CPU::AccessibleMemory::Pieces {&single_memory});
+                while (single.cycles() < 100)
+                        single.execute_instruction();
+
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                auto const result = cpu.run(100);
+
+                CHECK(result.reason == Emulator::CPU::StopReason::cycle_budget);
+                CHECK(result.cycles == single.cycles());
+                CHECK(cpu.cycles() == single.cycles());
+                CHECK(cpu.pc() == single.pc());
+                CHECK(cpu.x() == single.x());
+        }
+
+        SECTION("A stop request ends the run after the current instruction")
+        {
+                class StoppingMemory : public ExampleMemory {
+                public:
+                        using ExampleMemory::ExampleMemory;
+
+                        Emulator::CPU* cpu = nullptr;
+
+                        // Writes have to come through write_byte_impl.
+                        Emulator::Byte* writable_page(Emulator::Address) noexcept override
+                        {
+                                return nullptr;
+                        }
+
+                private:
+                        void write_byte_impl(Emulator::Address address, Emulator::Byte byte) override
+                        {
+                                ExampleMemory::write_byte_impl(address, byte);
+                                if (address == 0x0200 && cpu)
+                                        cpu->stop(Emulator::CPU::StopReason::nmi);
+                        }
+                };
+
+                StoppingMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                example_memory.cpu = &cpu;
+
+                auto const result = cpu.run(1000);
+                CHECK(result.reason == Emulator::CPU::StopReason::nmi);
+                CHECK(result.cycles == 8);
+                CHECK(cpu.pc() == 0x0607);
+
+                // The next run starts right after the STA, and stops at the next one.
+                auto const next_result = cpu.run(1000);
+                CHECK(next_result.reason == Emulator::CPU::StopReason::nmi);
+                CHECK(next_result.cycles == 13);
+                CHECK(cpu.pc() == 0x0607);
+                CHECK(cpu.x() == 0x02);
+        }
+}
+
+TEST_CASE("Idle loops are skipped without changing the results")
+{
+        /**
+           LDX #$00
+         wait:
+           LDA $10
+           BEQ wait
+           INX
+           LDY $10
+         done:
+           JMP done
+        */
+
+        std::vector<Emulator::Byte> const program {
+                0xA2, 0x00, 0xA5, 0x10, 0xF0, 0xFC, 0xE8, 0xA4,
+                0x10, 0x4C, 0x09, 0x06
+        };
+
+        SECTION("Running for a budget stops where single steps would")
+        {
+                Emulator::Cycles constexpr budget = 1'000'003;
+
+                ExampleMemory single_memory(program);
+                Emulator::CPU single(Emulator::CPU::AccessibleMemory::Pieces {&single_memory});
+                while (single.cycles() < budget)
+                        single.execute_instruction();
+
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                CHECK(cpu.run(budget).cycles == single.cycles());
+                CHECK(cpu.pc() == single.pc());
+                CHECK(cpu.a() == single.a());
+        }
+
+        SECTION("Executing a number of instructions stops where single steps would")
+        {
+                std::size_t constexpr instructions = 100'001;
+
+                ExampleMemory single_memory(program);
+                Emulator::CPU single(Emulator::CPU::AccessibleMemory::Pieces {&single_memory});
+                for (std::size_t i = 0; i < instructions; ++i)
+                        single.execute_instruction();
+
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                CHECK(cpu.execute_instructions(instructions) == single.cycles());
+                CHECK(cpu.pc() == single.pc());
+        }
+
+        SECTION("The loop ends once memory changes between runs")
+        {
+                ExampleMemory example_memory(program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                cpu.run(1'000'000);
+                CHECK(cpu.x() == 0x00);
+
+                example_memory.write_byte(0x10, 0x42);
+                cpu.run(100);
+                CHECK(cpu.x() == 0x01);
+                CHECK(cpu.y() == 0x42);
+        }
+}
+
+TEST_CASE("Fused instruction pairs stop where single steps would")
+{
+        /**
+           LDY #$00
+         outer:
+           LDX #$07
+         inner:
+           TYA
+           STA $0200,X
+           DEX
+           BNE inner
+           INY
+           TYA
+           CMP #$20
+           BNE outer
+        */
+
+        std::vector<Emulator::Byte> const program {
+                0xA0, 0x00, 0xA2, 0x07, 0x98, 0x9D, 0x00, 0x02,
+                0xCA, 0xD0, 0xF9, 0xC8, 0x98, 0xC9, 0x20, 0xD0,
+                0xF1
+        };
+        Emulator::Address constexpr program_end = 0x0611;
+
+        check_batch_matches_one_by_one(program, program_end);
+
+        SECTION("Running for a budget")
+        {
+                for (Emulator::Cycles budget = 1; budget < 200; ++budget) {
+                        ExampleMemory single_memory(program);
+                        Emulator::CPU single(Emulator::CPU::AccessibleMemory::Pieces {&single_memory});
+                        while (single.cycles() < budget)
+                                single.execute_instruction();
+
+                        ExampleMemory example_memory(program);
+                        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                        CHECK(cpu.run(budget).cycles == single.cycles());
+                        CHECK(cpu.pc() == single.pc());
+                        CHECK(cpu.x() == single.x());
+                }
+        }
+
+        SECTION("Executing a number of instructions")
+        {
+                for (std::size_t instructions = 1; instructions < 100; ++instructions) {
+                        ExampleMemory single_memory(program);
+                        Emulator::CPU single(Emulator::CPU::AccessibleMemory::Pieces {&single_memory});
+                        for (std::size_t i = 0; i < instructions; ++i)
+                                single.execute_instruction();
+
+                        ExampleMemory example_memory(program);
+                        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&example_memory});
+                        CHECK(cpu.execute_instructions(instructions) == single.cycles());
+                        CHECK(cpu.pc() == single.pc());
+                }
+        }
+}
+
+TEST_CASE("Interrupt lines")
+{
+        /**
+         * $0600:
+         * loop:
+         *   INX
+         *   JMP loop
+         *
+         * $0700 (NMI and IRQ handler):
+         *   INY
+         *   RTI
+         */
+
+        std::vector<Emulator::Byte> const program {0xE8, 0x4C, 0x00, 0x06};
+        FlatMemory flat_memory(program);
+        flat_memory.write_byte(0x0700, 0xC8);
+        flat_memory.write_byte(0x0701, 0x40);
+        for (auto const interrupt : {Emulator::CPU::Interrupt::nmi, Emulator::CPU::Interrupt::irq})
+                flat_memory.write_pointer(Emulator::CPU::interrupt_handler_address(interrupt), 0x0700);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&flat_memory});
+
+        using Interrupt = Emulator::CPU::Interrupt;
+        using Source = Emulator::CPU::InterruptSource;
+
+        SECTION("An interrupt is taken at the next instruction boundary, in 7 cycles")
+        {
+                cpu.execute_instruction();
+                cpu.set_interrupt_line(Interrupt::nmi, Source::ppu, true);
+                CHECK(cpu.execute_instruction() == 7 + 2);
+                CHECK(cpu.pc() == 0x0701);
+                CHECK(cpu.y() == 0x01);
+                CHECK(cpu.sp() == 0xFC);
+        }
+
+        SECTION("NMI is taken once for each time the line gets asserted")
+        {
+                cpu.set_interrupt_line(Interrupt::nmi, Source::ppu, true);
+                cpu.run(1000);
+                CHECK(cpu.y() == 0x01);
+
+                // Another source doesn't make a new edge while the line is asserted.
+                cpu.set_interrupt_line(Interrupt::nmi, Source::mapper, true);
+                cpu.run(1000);
+                CHECK(cpu.y() == 0x01);
+
+                cpu.set_interrupt_line(Interrupt::nmi, Source::ppu, false);
+                cpu.set_interrupt_line(Interrupt::nmi, Source::mapper, false);
+                cpu.set_interrupt_line(Interrupt::nmi, Source::ppu, true);
+                cpu.run(1000);
+                CHECK(cpu.y() == 0x02);
+        }
+
+        SECTION("IRQ is taken for as long as the line is asserted")
+        {
+                cpu.set_interrupt_line(Interrupt::irq, Source::apu_frame_counter, true);
+                cpu.run(100);
+                auto const irqs = cpu.y();
+                CHECK(irqs > 1);
+
+                cpu.set_interrupt_line(Interrupt::irq, Source::apu_frame_counter, false);
+                cpu.run(100);
+                CHECK(cpu.y() == irqs);
+        }
+
+        SECTION("IRQ isn't taken while I is set")
+        {
+                flat_memory.write_byte(0x0600, 0x78); // SEI
+                cpu.execute_instruction();
+                cpu.set_interrupt_line(Interrupt::irq, Source::mapper, true);
+                cpu.run(100);
+                CHECK(cpu.y() == 0x00);
+        }
+
+        SECTION("BRK is taken even while I is set")
+        {
+                flat_memory.write_byte(0x0600, 0x78); // SEI
+                flat_memory.write_byte(0x0601, 0x00); // BRK
+                cpu.execute_instruction();
+                cpu.execute_instruction();
+                CHECK(cpu.pc() == 0x0700);
+                CHECK(cpu.sp() == 0xFC);
+                CHECK(flat_memory.read_byte(0x01FF) == 0x06);
+                CHECK(flat_memory.read_byte(0x01FE) == 0x03);
+        }
+}
+
+TEST_CASE("run() can stop where an interrupt goes pending")
+{
+        /**
+         * Asserts NMI on writes to $4000 and IRQ on writes to $4001,
+         * like the PPU and a mapper would.
+         */
+        class InterruptingMemory : public FlatMemory {
+        public:
+                using FlatMemory::FlatMemory;
+
+                Emulator::CPU* cpu = nullptr;
+
+        private:
+                void write_byte_impl(Emulator::Address address, Emulator::Byte byte) override
+                {
+                        FlatMemory::write_byte_impl(address, byte);
+                        if (!cpu)
+                                return;
+                        if (address == 0x4000)
+                                cpu->set_interrupt_line(Emulator::CPU::Interrupt::nmi,
+                                                        Emulator::CPU::InterruptSource::ppu, true);
+                        else if (address == 0x4001)
+                                cpu->set_interrupt_line(Emulator::CPU::Interrupt::irq,
+                                                        Emulator::CPU::InterruptSource::mapper, true);
+                }
+        };
+
+        /**
+         * $0600:
+         *   STA $4000 (or $4001)
+         * loop:
+         *   INX
+         *   JMP loop
+         *
+         * $0700 (NMI and IRQ handler):
+         *   INY
+         *   RTI
+         */
+
+        auto const check_stops = [](Emulator::Byte register_low_byte, Emulator::CPU::StopReason reason) {
+                InterruptingMemory memory({0x8D, register_low_byte, 0x40, 0xE8, 0x4C, 0x03, 0x06});
+                memory.write_byte(0x0700, 0xC8);
+                memory.write_byte(0x0701, 0x40);
+                for (auto const interrupt : {Emulator::CPU::Interrupt::nmi, Emulator::CPU::Interrupt::irq})
+                        memory.write_pointer(Emulator::CPU::interrupt_handler_address(interrupt), 0x0700);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&memory});
+                memory.cpu = &cpu;
+
+                SECTION("By default the interrupt is just taken")
+                {
+                        CHECK(cpu.run(100).reason == Emulator::CPU::StopReason::cycle_budget);
+                        CHECK(cpu.y() != 0x00);
+                }
+
+                SECTION("Stopping leaves the interrupt to the next run")
+                {
+                        cpu.stop_at_interrupts(true);
+                        auto const result = cpu.run(100);
+                        CHECK(result.reason == reason);
+                        CHECK(result.cycles == 4);
+                        CHECK(cpu.pc() == 0x0603);
+                        CHECK(cpu.y() == 0x00);
+
+                        cpu.run(7);
+                        CHECK(cpu.pc() == 0x0700);
+                        cpu.run(2);
+                        CHECK(cpu.y() == 0x01);
+                }
+        };
+
+        SECTION("NMI")
+        {
+                check_stops(0x00, Emulator::CPU::StopReason::nmi);
+        }
+
+        SECTION("IRQ")
+        {
+                check_stops(0x01, Emulator::CPU::StopReason::irq);
+        }
+}
+
+TEST_CASE("JMP (indirect) stays on the page of the pointer")
+{
+        /**
+         JMP ($02FF)
+        */
+        FlatMemory flat_memory({0x6C, 0xFF, 0x02});
+        flat_memory.write_byte(0x02FF, 0x34);
+        flat_memory.write_byte(0x0200, 0x12);
+        flat_memory.write_byte(0x0300, 0x56);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&flat_memory});
+        cpu.execute_instruction();
+        CHECK(cpu.pc() == 0x1234);
+}
+
+TEST_CASE("Accuracy tiers")
+{
+        using Emulator::Address;
+        using Emulator::CPU;
+
+        /**
+         * Stands in for registers that notice every access.
+         */
+        class BusLog : public TestMemory<0x2000> {
+        public:
+                BusLog()
+                        : TestMemory(0x2000)
+                {}
+
+                std::vector<std::pair<char, Address>> accesses;
+
+        protected:
+                void write_byte_impl(Address address, Emulator::Byte byte) override
+                {
+                        accesses.emplace_back('w', address);
+                        TestMemory::write_byte_impl(address, byte);
+                }
+
+                Emulator::Byte read_byte_impl(Address address) override
+                {
+                        accesses.emplace_back('r', address);
+                        return TestMemory::read_byte_impl(address);
+                }
+        };
+
+        /**
+         LDX #$10
+         LDA $20F8,X
+         LDA $2000,X
+         STA $2000,X
+         INC $2020
+        */
+        std::vector<Emulator::Byte> const program {
+                0xA2, 0x10, 0xBD, 0xF8, 0x20, 0xBD, 0x00, 0x20,
+                0x9D, 0x00, 0x20, 0xEE, 0x20, 0x20
+        };
+
+        auto const run = [&](CPU::Accuracy accuracy) {
+                BusLog log;
+                FlatMemory flat_memory(program);
+                CPU cpu(CPU::AccessibleMemory::Pieces {&log, &flat_memory}, accuracy);
+                cpu.execute_instructions(5);
+                CHECK(cpu.pc() == program_start + program.size());
+                CHECK(cpu.cycles() == 2 + 5 + 4 + 5 + 6);
+                return log.accesses;
+        };
+
+        SECTION("The fast tier only makes the accesses that matter")
+        {
+                std::vector<std::pair<char, Address>> const expected {
+                        {'r', 0x2108},
+                        {'r', 0x2010},
+                        {'w', 0x2010},
+                        {'r', 0x2020}, {'w', 0x2020}
+                };
+                CHECK(run(CPU::Accuracy::fast) == expected);
+        }
+
+        SECTION("The bus tier adds dummy reads and the first write of read-modify-writes")
+        {
+                std::vector<std::pair<char, Address>> const expected {
+                        {'r', 0x2008}, {'r', 0x2108},
+                        {'r', 0x2010},
+                        {'r', 0x2010}, {'w', 0x2010},
+                        {'r', 0x2020}, {'w', 0x2020}, {'w', 0x2020}
+                };
+                CHECK(run(CPU::Accuracy::bus) == expected);
+        }
+}
@@ -0,0 +1,132 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "mem.h"
+#include "../src/cpu.h"
+#include "../src/debugger.h"
+#include <vector>
+
+namespace {
+
+Emulator::Address constexpr rom_start = 0x8000;
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+                write_pointer(Emulator::CPU::interrupt_handler_address(Emulator::CPU::Interrupt::reset), rom_start);
+        }
+};
+
+/**
+   LDX #$03
+ loop:
+   STX $0200
+   DEX
+   BNE loop
+   JSR load
+ done:
+   JMP done
+ load:
+   LDA $0200
+   RTS
+*/
+std::vector<Emulator::Byte> const program {
+        0xA2, 0x03, 0x8E, 0x00, 0x02, 0xCA, 0xD0, 0xFA,
+        0x20, 0x0E, 0x80, 0x4C, 0x0B, 0x80, 0xAD, 0x00,
+        0x02, 0x60
+};
+
+Emulator::Cycles constexpr budget = 1000;
+
+}
+
+TEST_CASE("The debugger stops the CPU")
+{
+        Emulator::CPU::RAM ram;
+        RomMemory memory(program);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+        Emulator::Debugger debugger;
+        cpu.debug_with(&debugger);
+        using Kind = Emulator::Debugger::Hit::Kind;
+        using Access = Emulator::Debugger::Access;
+
+        SECTION("At breakpoints, before the instruction")
+        {
+                debugger.add_breakpoint(0x8005);
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                CHECK(cpu.pc() == 0x8005);
+                CHECK(cpu.x() == 3);
+                REQUIRE(debugger.last_hit());
+                CHECK(debugger.last_hit()->kind == Kind::breakpoint);
+                CHECK(debugger.last_hit()->address == 0x8005);
+
+                SECTION("Running again carries on from there")
+                {
+                        CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                        CHECK(cpu.pc() == 0x8005);
+                        CHECK(cpu.x() == 2);
+                }
+
+                SECTION("Without breakpoints, it runs to the end of the budget")
+                {
+                        debugger.remove_breakpoints(0x8005);
+                        CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::cycle_budget);
+                }
+        }
+
+        SECTION("At breakpoints whose condition holds")
+        {
+                debugger.add_breakpoint(0x8005, [](auto const& registers) { return registers.x == 1; });
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                CHECK(cpu.pc() == 0x8005);
+                CHECK(cpu.x() == 1);
+        }
+
+        SECTION("Before writes to watched memory")
+        {
+                debugger.add_watchpoint(0x0200, 0x02FF, Access::write);
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                CHECK(cpu.pc() == 0x8002);
+                REQUIRE(debugger.last_hit());
+                CHECK(debugger.last_hit()->kind == Kind::write);
+                CHECK(debugger.last_hit()->address == 0x0200);
+                CHECK(ram.read_byte(0x0200) == 0);
+        }
+
+        SECTION("Before reads of watched memory")
+        {
+                debugger.add_watchpoint(0x0200, 0x0200, Access::read);
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                CHECK(cpu.pc() == 0x800E);
+                CHECK(debugger.last_hit()->kind == Kind::read);
+        }
+
+        SECTION("Before pushes onto a watched stack")
+        {
+                debugger.add_watchpoint(0x0100, 0x01FF, Access::read_write);
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                CHECK(cpu.pc() == 0x8008);
+                CHECK(debugger.last_hit()->kind == Kind::write);
+
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::breakpoint);
+                CHECK(cpu.pc() == 0x8011);
+                CHECK(debugger.last_hit()->kind == Kind::read);
+        }
+
+        SECTION("Not at all while it has nothing to stop for")
+        {
+                Emulator::CPU::RAM undebugged_ram;
+                RomMemory undebugged_memory(program);
+                Emulator::CPU undebugged(Emulator::CPU::AccessibleMemory::Pieces {&undebugged_ram, &undebugged_memory});
+
+                CHECK(cpu.run(budget).reason == Emulator::CPU::StopReason::cycle_budget);
+                undebugged.run(budget);
+                CHECK(cpu.cycles() == undebugged.cycles());
+                CHECK(cpu.pc() == undebugged.pc());
+                CHECK_FALSE(debugger.last_hit());
+        }
+}
@@ -0,0 +1,318 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "differential.h"
+#include "reference_cpu.h"
+#include "../src/disassembler.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <sstream>
+
+using Emulator::Address;
+using Emulator::Byte;
+using Emulator::CPU;
+
+namespace Differential {
+
+namespace {
+
+Address constexpr ppu_status_address = 0x2002;
+Byte constexpr vblank_started = 0x80;
+
+std::string hex(unsigned value, int width)
+{
+        std::stringstream ss;
+        ss << std::hex << std::uppercase << std::setfill('0') << std::setw(width) << value;
+        return ss.str();
+}
+
+class ReferenceEngine : public Engine {
+public:
+        explicit ReferenceEngine(std::vector<Byte> const& image)
+                : machine_(image),
+                  bus_(machine_.pieces()),
+                  cpu_(bus_),
+                  disassembler_(bus_)
+        {}
+
+        void run(std::size_t instructions) override
+        {
+                for (std::size_t i = 0; i < instructions; ++i)
+                        cpu_.step();
+        }
+
+        void nmi() override
+        {
+                cpu_.nmi();
+        }
+
+        State state() const override
+        {
+                return {cpu_.pc, cpu_.a, cpu_.x, cpu_.y, cpu_.sp, cpu_.p, cpu_.cycles};
+        }
+
+        Machine& machine() noexcept override
+        {
+                return machine_;
+        }
+
+        /**
+         * The instruction the reference is about to execute.
+         */
+        std::string next_instruction()
+        {
+                return disassembler_.disassemble(cpu_.pc).text();
+        }
+
+private:
+        Machine machine_;
+        CPU::AccessibleMemory bus_;
+        ReferenceCpu cpu_;
+        Emulator::Disassembler disassembler_;
+};
+
+class CpuEngine : public Engine {
+public:
+        CpuEngine(std::vector<Byte> const& image, CPU::Accuracy accuracy, bool traced)
+                : machine_(image),
+                  cpu_(machine_.pieces(), accuracy),
+                  trace_(traced_instructions)
+        {
+                if (traced)
+                        cpu_.trace_to(&trace_);
+        }
+
+        void run(std::size_t instructions) override
+        {
+                if (instructions == 1)
+                        cpu_.execute_instruction();
+                else
+                        cpu_.execute_instructions(instructions);
+        }
+
+        void nmi() override
+        {
+                cpu_.hardware_interrupt(CPU::Interrupt::nmi);
+        }
+
+        State state() const override
+        {
+                return {cpu_.pc(), cpu_.a(), cpu_.x(), cpu_.y(), cpu_.sp(), cpu_.p(), cpu_.cycles()};
+        }
+
+        Machine& machine() noexcept override
+        {
+                return machine_;
+        }
+
+private:
+        static std::size_t constexpr traced_instructions = 64;
+
+        Machine machine_;
+        CPU cpu_;
+        Emulator::TraceBuffer trace_;
+};
+
+EngineFactory cpu_engine(CPU::Accuracy accuracy, bool traced = false)
+{
+        return [accuracy, traced](std::vector<Byte> const& image) {
+                return std::make_unique<CpuEngine>(image, accuracy, traced);
+        };
+}
+
+std::string describe(State const& state)
+{
+        std::stringstream ss;
+        ss << "PC:" << hex(state.pc, 4) << " A:" << hex(state.a, 2) << " X:" << hex(state.x, 2)
+           << " Y:" << hex(state.y, 2) << " P:" << hex(state.p, 2) << " SP:" << hex(state.sp, 2)
+           << " CYC:" << state.cycles;
+        return ss.str();
+}
+
+/**
+ * The first address where the memory of two machines differs.
+ */
+std::optional<Address> compare_memory(Machine& left, Machine& right)
+{
+        Byte const* const left_ram = left.ram.data();
+        Byte const* const right_ram = right.ram.data();
+        if (std::memcmp(left_ram, right_ram, CPU::RAM::real_size) != 0) {
+                auto const mismatch = std::mismatch(left_ram, left_ram + CPU::RAM::real_size, right_ram);
+                return Address(mismatch.first - left_ram);
+        }
+        if (left.high.bytes != right.high.bytes) {
+                auto const mismatch = std::mismatch(left.high.bytes.cbegin(), left.high.bytes.cend(),
+                                                    right.high.bytes.cbegin());
+                return Address(HighMemory::start + (mismatch.first - left.high.bytes.cbegin()));
+        }
+        return std::nullopt;
+}
+
+Byte read_machine(Machine& machine, Address address)
+{
+        if (address < HighMemory::start)
+                return machine.ram.data()[address % CPU::RAM::real_size];
+        return machine.high.bytes[address - HighMemory::start];
+}
+
+/**
+ * Returns the error, if running threw one.
+ */
+std::optional<std::string> run(Engine& engine, std::size_t instructions)
+{
+        try {
+                engine.run(instructions);
+        } catch (std::exception const& e) {
+                return e.what();
+        }
+        return std::nullopt;
+}
+
+}
+
+bool HighMemory::address_is_writable_impl(Address address) const noexcept
+{
+        return address >= start;
+}
+
+bool HighMemory::address_is_readable_impl(Address address) const noexcept
+{
+        return address >= start;
+}
+
+void HighMemory::write_byte_impl(Address address, Byte byte)
+{
+        if (address > io_end)
+                bytes[address - start] = byte;
+}
+
+Byte HighMemory::read_byte_impl(Address address)
+{
+        if (address > io_end)
+                return bytes[address - start];
+        return address == ppu_status_address ? vblank_started : 0;
+}
+
+Byte const* HighMemory::readable_page(Address page_start) noexcept
+{
+        return writable_page(page_start);
+}
+
+Byte* HighMemory::writable_page(Address page_start) noexcept
+{
+        if (page_start <= io_end)
+                return nullptr;
+        return bytes.data() + (page_start - start);
+}
+
+Machine::Machine(std::vector<Byte> const& image)
+{
+        std::copy(image.cbegin(), image.cbegin() + CPU::RAM::real_size, ram.data());
+        std::copy(image.cbegin() + HighMemory::start, image.cend(), high.bytes.begin());
+}
+
+CPU::AccessibleMemory::Pieces Machine::pieces() noexcept
+{
+        return {&ram, &high};
+}
+
+bool State::operator==(State const& other) const noexcept
+{
+        return pc == other.pc && a == other.a && x == other.x && y == other.y &&
+               sp == other.sp && p == other.p && cycles == other.cycles;
+}
+
+bool State::operator!=(State const& other) const noexcept
+{
+        return !(*this == other);
+}
+
+std::vector<Byte> program_image(std::vector<Byte> const& program, Address start)
+{
+        std::vector<Byte> image(0x10000);
+        std::copy(program.cbegin(), program.cend(), image.begin() + start);
+        Address const reset_vector = CPU::interrupt_handler_address(CPU::Interrupt::reset);
+        image[reset_vector] = Emulator::low_byte(start);
+        image[reset_vector + 1] = Emulator::high_byte(start);
+        return image;
+}
+
+std::vector<Byte> rom_image(Emulator::Cartridge const& cartridge)
+{
+        std::vector<Byte> image(0x10000);
+        for (unsigned address = Emulator::Cartridge::prg_rom_lower_bank_start; address < image.size(); ++address)
+                image[address] = cartridge.read_prg_rom_byte(address);
+        return image;
+}
+
+std::vector<EngineKind> const& engines()
+{
+        static std::vector<EngineKind> const kinds {
+                {"fast, one by one", cpu_engine(CPU::Accuracy::fast), 1},
+                {"fast, batched", cpu_engine(CPU::Accuracy::fast), 64},
+                {"bus, one by one", cpu_engine(CPU::Accuracy::bus), 1},
+                {"bus, batched", cpu_engine(CPU::Accuracy::bus), 64},
+                {"fast, traced", cpu_engine(CPU::Accuracy::fast, true), 64}
+        };
+        return kinds;
+}
+
+std::optional<std::string> find_divergence(EngineKind const& tested,
+                                           std::vector<Byte> const& image,
+                                           std::size_t instructions,
+                                           std::size_t nmi_interval)
+{
+        ReferenceEngine reference(image);
+        auto const engine = tested.make(image);
+
+        std::size_t done = 0;
+        while (done < instructions) {
+                if (nmi_interval && done && done % nmi_interval == 0) {
+                        reference.nmi();
+                        engine->nmi();
+                }
+
+                std::size_t chunk = std::min(tested.chunk, instructions - done);
+                if (nmi_interval)
+                        chunk = std::min(chunk, nmi_interval - done % nmi_interval);
+
+                std::vector<std::string> disassembly;
+                std::optional<std::string> reference_error;
+                for (std::size_t i = 0; i < chunk && !reference_error; ++i) {
+                        disassembly.push_back(reference.next_instruction());
+                        reference_error = run(reference, 1);
+                }
+                auto const engine_error = run(*engine, chunk);
+
+                State const expected = reference.state();
+                State const actual = engine->state();
+                auto const different_address = compare_memory(reference.machine(), engine->machine());
+                bool const both_stopped = reference_error && engine_error;
+                if (expected == actual && !different_address && (both_stopped || (!reference_error && !engine_error))) {
+                        if (both_stopped)
+                                return std::nullopt;
+                        done += chunk;
+                        continue;
+                }
+
+                std::stringstream report;
+                report << tested.name << " diverges from the reference in instructions "
+                       << done << " to " << done + disassembly.size() - 1 << ":\n";
+                for (auto const& line : disassembly)
+                        report << "    " << line << "\n";
+                report << "reference: " << describe(expected)
+                       << (reference_error ? " (" + *reference_error + ")" : "") << "\n"
+                       << tested.name << ": " << describe(actual)
+                       << (engine_error ? " (" + *engine_error + ")" : "") << "\n";
+                if (different_address) {
+                        report << "memory first differs at $" << hex(*different_address, 4)
+                               << ": " << hex(read_machine(reference.machine(), *different_address), 2)
+                               << " vs " << hex(read_machine(engine->machine(), *different_address), 2) << "\n";
+                }
+                return report.str();
+        }
+        return std::nullopt;
+}
+
+}
@@ -0,0 +1,128 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "../src/utils.h"
+#include "../src/cpu.h"
+#include "../src/cartridge.h"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Runs an execution engine in lockstep with ReferenceCpu, and compares
+ * the registers, the cycle count and all of memory as they go. Any way
+ * of running the CPU core can be plugged in as an Engine and gets
+ * checked the same way.
+ */
+namespace Differential {
+
+/**
+ * Everything from $2000 up, as flat memory, apart from the I/O
+ * registers: the PPU status register always says vblank has started,
+ * and the rest read as 0 and ignore writes. That's enough for games to
+ * get past their startup loops, and every engine sees the same.
+ */
+class HighMemory : public Emulator::Memory {
+public:
+        static Emulator::Address constexpr start = 0x2000;
+        static Emulator::Address constexpr io_end = 0x401F;
+
+        std::array<Emulator::Byte, 0x10000 - start> bytes {};
+
+        Emulator::Byte const* readable_page(Emulator::Address page_start) noexcept override;
+        Emulator::Byte* writable_page(Emulator::Address page_start) noexcept override;
+
+protected:
+        bool address_is_writable_impl(Emulator::Address address) const noexcept override;
+        bool address_is_readable_impl(Emulator::Address address) const noexcept override;
+        void write_byte_impl(Emulator::Address address, Emulator::Byte byte) override;
+        Emulator::Byte read_byte_impl(Emulator::Address address) override;
+};
+
+/**
+ * What an engine runs on: the internal RAM and HighMemory, loaded
+ * from a 64 KB image. $0800-$1FFF of the image is ignored, since the
+ * RAM is mirrored there.
+ */
+struct Machine {
+        explicit Machine(std::vector<Emulator::Byte> const& image);
+
+        Emulator::CPU::AccessibleMemory::Pieces pieces() noexcept;
+
+        Emulator::CPU::RAM ram;
+        HighMemory high;
+};
+
+struct State {
+        Emulator::Address pc;
+        Emulator::Byte a;
+        Emulator::Byte x;
+        Emulator::Byte y;
+        Emulator::Byte sp;
+        Emulator::Byte p;
+        std::uint64_t cycles;
+
+        bool operator==(State const& other) const noexcept;
+        bool operator!=(State const& other) const noexcept;
+};
+
+class Engine {
+public:
+        virtual ~Engine() = default;
+
+        /**
+         * Throws whatever the engine throws, e.g. on an unknown opcode.
+         */
+        virtual void run(std::size_t instructions) = 0;
+        virtual void nmi() = 0;
+        virtual State state() const = 0;
+        virtual Machine& machine() noexcept = 0;
+};
+
+using EngineFactory = std::function<std::unique_ptr<Engine>(std::vector<Emulator::Byte> const& image)>;
+
+struct EngineKind {
+        std::string name;
+        EngineFactory make;
+        /**
+         * How many instructions it's given at a time, between
+         * comparisons. More than 1 lets batched execution kick in.
+         */
+        std::size_t chunk;
+};
+
+/**
+ * A 64 KB image with the program at start, and the reset vector
+ * pointing there.
+ */
+std::vector<Emulator::Byte> program_image(std::vector<Emulator::Byte> const& program,
+                                          Emulator::Address start);
+
+/**
+ * The PRG ROM of an NROM cartridge, where the CPU sees it.
+ */
+std::vector<Emulator::Byte> rom_image(Emulator::Cartridge const& cartridge);
+
+/**
+ * The ways of running Emulator::CPU that get checked.
+ */
+std::vector<EngineKind> const& engines();
+
+/**
+ * Runs up to the given number of instructions, with an NMI every
+ * nmi_interval instructions if that isn't 0. Returns a report of the
+ * first place where the engine and the reference disagree, with the
+ * disassembly of the instructions that got them there. Running into
+ * an unknown opcode ends the run, as long as both engines do it.
+ */
+std::optional<std::string> find_divergence(EngineKind const& tested,
+                                           std::vector<Emulator::Byte> const& image,
+                                           std::size_t instructions,
+                                           std::size_t nmi_interval = 0);
+
+}
@@ -0,0 +1,67 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "differential.h"
+#include "../src/cartridge.h"
+#include "../src/opcodes.h"
+#include <random>
+
+namespace {
+
+Emulator::Address constexpr stream_start = 0x8000;
+
+/**
+ * Random bytes everywhere, with a stream of random instructions at
+ * the reset vector. Jumps and branches take the code anywhere, so runs
+ * end sooner or later on an unknown opcode.
+ */
+std::vector<Emulator::Byte> random_image(unsigned seed)
+{
+        std::mt19937 random(seed);
+        std::uniform_int_distribution<unsigned> byte(0x00, 0xFF);
+        std::vector<Emulator::Byte> image(0x10000);
+        for (auto& b : image)
+                b = byte(random);
+
+        std::vector<Emulator::Byte> known;
+        for (unsigned opcode = 0; opcode < 0x100; ++opcode) {
+                if (Emulator::Opcodes::opcode_table[opcode].known)
+                        known.push_back(opcode);
+        }
+        std::uniform_int_distribution<std::size_t> pick(0, known.size() - 1);
+        for (unsigned address = stream_start; address < stream_start + 0x1000;) {
+                Emulator::Byte const opcode = known[pick(random)];
+                image[address] = opcode;
+                address += Emulator::Opcodes::opcode_table[opcode].length;
+        }
+        image[0xFFFC] = Emulator::low_byte(stream_start);
+        image[0xFFFD] = Emulator::high_byte(stream_start);
+        return image;
+}
+
+}
+
+TEST_CASE("The CPU agrees with the reference on random instruction streams")
+{
+        for (auto const& engine : Differential::engines()) {
+                for (unsigned seed = 0; seed < 50; ++seed) {
+                        INFO(engine.name << ", seed " << seed);
+                        auto const divergence = Differential::find_divergence(engine, random_image(seed), 2000);
+                        CHECK(divergence.value_or("") == "");
+                }
+        }
+}
+
+TEST_CASE("The CPU agrees with the reference on ROMs")
+{
+        for (auto const* path : {"../roms/Super Mario Bros. 1.nes", "../roms/NEStress.nes"}) {
+                Emulator::Cartridge const cartridge(path);
+                REQUIRE(cartridge.mmc_id() == 0);
+                for (auto const& engine : Differential::engines()) {
+                        INFO(engine.name << ", " << path);
+                        auto const divergence = Differential::find_divergence(
+                                engine, Differential::rom_image(cartridge), 50000, 3000);
+                        CHECK(divergence.value_or("") == "");
+                }
+        }
+}
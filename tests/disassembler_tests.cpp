@@ -0,0 +1,91 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "mem.h"
+#include "../src/disassembler.h"
+#include <vector>
+
+namespace {
+
+Emulator::Address constexpr rom_start = 0x8000;
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+        }
+};
+
+}
+
+TEST_CASE("The disassembler turns code back into assembly")
+{
+        /**
+         reset:
+           LDX #$05
+         loop:
+           LDA $20F8,X
+           STA ($10),Y
+           DEX
+           BNE loop
+           JMP (vector)
+        */
+
+        RomMemory memory({
+                0xA2, 0x05, 0xBD, 0xF8, 0x20, 0x91, 0x10, 0xCA,
+                0xD0, 0xF8, 0x6C, 0x00, 0x90
+        });
+        Emulator::Disassembler disassembler(memory);
+
+        SECTION("One line per instruction")
+        {
+                auto const lines = disassembler.disassemble(0x8000, 0x800A);
+                std::vector<std::string> texts;
+                for (auto const& line : lines)
+                        texts.push_back(line.text());
+                std::vector<std::string> const expected {
+                        "$8000: A2 05     LDX #$05",
+                        "$8002: BD F8 20  LDA $20F8,X",
+                        "$8005: 91 10     STA ($10),Y",
+                        "$8007: CA        DEX",
+                        "$8008: D0 F8     BNE $8002",
+                        "$800A: 6C 00 90  JMP ($9000)"
+                };
+                CHECK(texts == expected);
+                CHECK(lines[1].cycles == "4+");
+                CHECK(lines[2].cycles == "6");
+                CHECK(lines[4].cycles == "2+");
+        }
+
+        SECTION("With labels")
+        {
+                disassembler.labels().add(0x8000, "reset");
+                disassembler.labels().add(0x8002, "loop");
+                disassembler.labels().add(0x9000, "vector");
+                disassembler.labels().add(0x0010, "pointer");
+                CHECK(disassembler.disassemble(0x8000).label == "reset");
+                CHECK(disassembler.disassemble(0x8005).operand == "(pointer),Y");
+                CHECK(disassembler.disassemble(0x8008).operand == "loop");
+                CHECK(disassembler.disassemble(0x800A).text() == "$800A: 6C 00 90  JMP (vector)");
+        }
+
+        SECTION("Overwritten code is decoded again")
+        {
+                CHECK(disassembler.disassemble(0x8007).mnemonic == "DEX");
+                memory.write_byte(0x8007, 0x88);
+                CHECK(disassembler.disassemble(0x8007).mnemonic == "DEY");
+                memory.write_byte(0x8003, 0x00);
+                CHECK(disassembler.disassemble(0x8002).operand == "$2000,X");
+        }
+
+        SECTION("Bytes past the instruction are left out")
+        {
+                auto const line = Emulator::Disassembler::decode(0xC000, {0xEA, 0x12, 0x34});
+                CHECK(line.length == 1);
+                CHECK(line.text() == "$C000: EA        NOP");
+                CHECK(line.bytes == std::array<Emulator::Byte, 3> {0xEA, 0x00, 0x00});
+        }
+}
@@ -0,0 +1,81 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "../src/opcodes.h"
+
+using Emulator::Opcodes::opcode_table;
+using Emulator::Opcodes::AddressingMode;
+using Emulator::Opcodes::MemoryAccess;
+
+TEST_CASE("Opcode table")
+{
+        SECTION("Known opcodes")
+        {
+                unsigned known = 0;
+                for (auto const& info : opcode_table)
+                        known += info.known;
+                CHECK(known == 151);
+
+                auto const& lda = opcode_table[0xBD];
+                CHECK(lda.mnemonic == "LDA");
+                CHECK(lda.mode == AddressingMode::absolute_x);
+                CHECK(lda.length == 3);
+                CHECK(lda.cycles == 4);
+                CHECK(lda.page_cross_penalty);
+                CHECK(lda.access == MemoryAccess::read);
+
+                auto const& sta = opcode_table[0x91];
+                CHECK(sta.mnemonic == "STA");
+                CHECK(sta.mode == AddressingMode::indirect_y);
+                CHECK(sta.length == 2);
+                CHECK(sta.cycles == 6);
+                CHECK(!sta.page_cross_penalty);
+                CHECK(sta.access == MemoryAccess::write);
+
+                auto const& jmp = opcode_table[0x6C];
+                CHECK(jmp.mnemonic == "JMP");
+                CHECK(jmp.mode == AddressingMode::indirect);
+                CHECK(jmp.length == 3);
+                CHECK(jmp.jumps);
+                CHECK(!jmp.uses_stack);
+
+                CHECK(opcode_table[0x48].uses_stack); // PHA
+                CHECK(opcode_table[0xFE].access == MemoryAccess::read_modify_write); // INC abs,X
+                CHECK(opcode_table[0x0A].mode == AddressingMode::accumulator); // ASL A
+        }
+
+        SECTION("Unknown opcodes")
+        {
+                auto const& unknown = opcode_table[0x02];
+                CHECK(!unknown.known);
+                CHECK(unknown.length == 1);
+                CHECK(unknown.cycles == 0);
+                CHECK(Emulator::Opcodes::ends_block(0x02));
+        }
+
+        SECTION("Everything with an operand in memory reads or writes it")
+        {
+                for (auto const& info : opcode_table) {
+                        bool const has_memory_operand = info.mode != AddressingMode::implied &&
+                                                        info.mode != AddressingMode::accumulator &&
+                                                        info.mode != AddressingMode::immediate &&
+                                                        info.mode != AddressingMode::relative;
+                        if (has_memory_operand && !info.jumps) {
+                                INFO(info.mnemonic);
+                                CHECK(info.access != MemoryAccess::none);
+                        }
+                }
+        }
+
+        SECTION("Only indexed reads pay for crossing a page")
+        {
+                for (auto const& info : opcode_table) {
+                        if (!info.page_cross_penalty)
+                                continue;
+                        CHECK(info.access == MemoryAccess::read);
+                        CHECK((info.mode == AddressingMode::absolute_x ||
+                               info.mode == AddressingMode::absolute_y ||
+                               info.mode == AddressingMode::indirect_y));
+                }
+        }
+}
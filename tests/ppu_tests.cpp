@@ -405,6 +405,31 @@ TEST_CASE("PPU registers tests")
         }
 }
 
+TEST_CASE("PPU NMI output tests")
+{
+        TestMemory<Emulator::oam_size * 2> test_memory(0);
+        Emulator::PPU ppu(Emulator::Mirroring::horizontal, test_memory);
+        std::vector<bool> changes;
+        ppu.on_nmi([&](bool asserted) { changes.push_back(asserted); });
+
+        SECTION("NMI is asserted during vblank with NMIs enabled")
+        {
+                ppu.write_byte(0x2000, 0x80);
+                ppu.vblank_started();
+                ppu.vblank_finished();
+                CHECK(changes == std::vector<bool> {true, false});
+        }
+
+        SECTION("Enabling NMIs during vblank asserts NMI")
+        {
+                ppu.vblank_started();
+                CHECK(changes.empty());
+                ppu.write_byte(0x2000, 0x80);
+                ppu.write_byte(0x2000, 0x00);
+                CHECK(changes == std::vector<bool> {true, false});
+        }
+}
+
 TEST_CASE("PPU screen tests")
 {
 
@@ -0,0 +1,142 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "mem.h"
+#include "../src/cpu.h"
+#include "../src/labels.h"
+#include "../src/profiler.h"
+#include <sstream>
+#include <vector>
+
+namespace {
+
+Emulator::Address constexpr rom_start = 0x8000;
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+                write_pointer(Emulator::CPU::interrupt_handler_address(Emulator::CPU::Interrupt::reset), rom_start);
+        }
+};
+
+/**
+ main:
+   JSR count
+   JMP main
+ count:
+   LDX #$10
+ loop:
+   DEX
+   BNE loop
+   RTS
+*/
+std::vector<Emulator::Byte> const call_program {
+        0x20, 0x06, 0x80, 0x4C, 0x00, 0x80, 0xA2, 0x10,
+        0xCA, 0xD0, 0xFD, 0x60
+};
+
+Emulator::Labels call_program_labels()
+{
+        std::stringstream file("al 008000 .main\n"
+                               "al 008006 .count\n"
+                               "al 008008 .loop\n");
+        Emulator::Labels labels;
+        labels.load(file);
+        return labels;
+}
+
+}
+
+TEST_CASE("Labels are read from assembler output")
+{
+        Emulator::Labels labels;
+
+        SECTION("VICE label files")
+        {
+                std::stringstream file("al 00C000 .reset\r\n"
+                                       "al 00C010 .nmi\n"
+                                       "something else\n");
+                labels.load(file);
+                REQUIRE(labels.find(0xC000));
+                CHECK(*labels.find(0xC000) == "reset");
+                REQUIRE(labels.find(0xC010));
+                CHECK(*labels.find(0xC010) == "nmi");
+        }
+
+        SECTION("ca65 debug files")
+        {
+                std::stringstream file("version\tmajor=2,minor=0\n"
+                                       "sym\tid=0,name=\"reset\",addrsize=absolute,scope=0,def=3,val=0xC000,seg=0,type=lab\n"
+                                       "sym\tid=1,name=\"PPUCTRL\",addrsize=absolute,scope=0,def=1,val=0x2000,type=equ\n");
+                labels.load(file);
+                REQUIRE(labels.find(0xC000));
+                CHECK(*labels.find(0xC000) == "reset");
+                CHECK_FALSE(labels.find(0x2000));
+        }
+
+        SECTION("asm6 listings")
+        {
+                std::stringstream file("00000                           PPUCTRL = $2000\n"
+                                       "0C000 78                        reset: sei\n"
+                                       "0C001 D8                        @wait: cld\n"
+                                       "0C002 A9 00                         lda #0\n");
+                labels.load(file);
+                REQUIRE(labels.find(0xC000));
+                CHECK(*labels.find(0xC000) == "reset");
+                CHECK_FALSE(labels.find(0xC001));
+                CHECK_FALSE(labels.find(0x0000));
+        }
+
+        SECTION("Addresses are described relative to the label before them")
+        {
+                labels.add(0xC000, "reset");
+                CHECK(labels.describe(0xC000) == "reset");
+                CHECK(labels.describe(0xC005) == "reset+5");
+                CHECK(labels.describe(0xC100) == "$C100");
+                CHECK(labels.describe(0x8000) == "$8000");
+        }
+}
+
+TEST_CASE("The profiler attributes cycles to the functions on the call stack")
+{
+        Emulator::CPU::RAM ram;
+        RomMemory memory(call_program);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+        Emulator::Labels const labels = call_program_labels();
+        Emulator::Profiler profiler(labels, 7);
+        cpu.observe_calls(&profiler);
+
+        Emulator::Cycles const start = cpu.cycles();
+        profiler.sample(cpu.pc(), start);
+        profiler.run(cpu, 10000);
+        cpu.observe_calls(nullptr);
+
+        std::stringstream folded;
+        profiler.write_folded_stacks(folded);
+        std::string line;
+        std::vector<std::pair<std::string, unsigned long>> stacks;
+        while (std::getline(folded, line)) {
+                auto const space = line.rfind(' ');
+                stacks.emplace_back(line.substr(0, space), std::stoul(line.substr(space + 1)));
+        }
+        REQUIRE(stacks.size() == 2);
+        CHECK(stacks[0].first == "(top level)");
+        CHECK(stacks[1].first == "(top level);count");
+        CHECK(stacks[0].second + stacks[1].second == cpu.cycles() - start);
+        // JSR and JMP are 9 cycles out of every 95.
+        CHECK(stacks[1].second > 8 * stacks[0].second);
+
+        std::stringstream flat;
+        profiler.write_flat_profile(flat);
+        std::string const profile = flat.str();
+        auto const functions = profile.find("Cycles by function:");
+        auto const addresses = profile.find("Cycles by address:");
+        REQUIRE(functions != std::string::npos);
+        REQUIRE(addresses != std::string::npos);
+        CHECK(profile.find("count", functions) < profile.find("(top level)", functions));
+        CHECK(profile.find("loop", addresses) != std::string::npos);
+}
@@ -0,0 +1,159 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "mem.h"
+#include "../src/cpu.h"
+#include "../src/recompiled.h"
+#include "../src/recompiler.h"
+#include <sstream>
+#include <vector>
+
+namespace {
+
+Emulator::Address constexpr rom_start = 0x8000;
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+                for (auto const interrupt : {Emulator::CPU::Interrupt::nmi,
+                                             Emulator::CPU::Interrupt::reset,
+                                             Emulator::CPU::Interrupt::irq})
+                        write_pointer(Emulator::CPU::interrupt_handler_address(interrupt), rom_start);
+        }
+};
+
+/**
+ LDX #$05
+ loop:
+   DEX
+   BNE loop
+ done:
+   JMP done
+*/
+std::vector<Emulator::Byte> const loop_program {
+        0xA2, 0x05, 0xCA, 0xD0, 0xFD, 0x4C, 0x05, 0x80
+};
+
+unsigned recompiled_runs = 0;
+
+/**
+ * What nes-recompile generates for the loop.
+ */
+std::size_t recompiled_loop(Emulator::Recompiled::Host const& host)
+{
+        auto const& r = host.registers;
+        ++recompiled_runs;
+        *host.cycles += 2;
+        r.load(*r.x, *r.x - 1);
+        *host.cycles += 2;
+        if (!r.zero()) {
+                *host.cycles += 1;
+                *r.pc = 0x8002;
+                return 2;
+        }
+        *r.pc = 0x8005;
+        return 2;
+}
+
+}
+
+TEST_CASE("The recompiler finds the code reachable from the vectors")
+{
+        /**
+           JSR subroutine
+         loop:
+           DEX
+           BNE loop
+           JMP ($0300)
+         subroutine:
+           RTS
+        */
+
+        RomMemory memory({
+                0x20, 0x0A, 0x80, 0xCA, 0xD0, 0xFD, 0x6C, 0x00,
+                0x03, 0x00, 0x60
+        });
+        Emulator::Recompiler recompiler(memory);
+        recompiler.walk_from_vectors();
+
+        std::vector<Emulator::Address> const expected {0x8000, 0x8003, 0x8006, 0x800A};
+        CHECK(recompiler.block_addresses() == expected);
+
+        std::stringstream source;
+        recompiler.generate(source);
+        CHECK(source.str().find(Emulator::Recompiled::library_symbol) != std::string::npos);
+        CHECK(source.str().find("block_8003(") != std::string::npos);
+
+        SECTION("Simple instructions become native code")
+        {
+                CHECK(source.str().find("r.load(*r.x, *r.x - 1);") != std::string::npos);
+                CHECK(source.str().find("steps[0xCA]") == std::string::npos);
+                CHECK(source.str().find("steps[0xD0]") == std::string::npos);
+        }
+
+        SECTION("Other instructions still go through the interpreter")
+        {
+                CHECK(source.str().find("steps[0x6C]") != std::string::npos);
+        }
+}
+
+TEST_CASE("The CPU runs recompiled code where memory holds the same code")
+{
+        Emulator::CPU::RAM interpreted_ram;
+        RomMemory interpreted_memory(loop_program);
+        Emulator::CPU interpreted(Emulator::CPU::AccessibleMemory::Pieces {
+                &interpreted_ram, &interpreted_memory});
+        interpreted.execute_instructions(12);
+
+        SECTION("Recompiled code gives the same results")
+        {
+                std::vector<Emulator::Byte> const code {0xCA, 0xD0, 0xFD};
+                std::vector<Emulator::Recompiled::Block> const blocks {
+                        {0x8002, code.data(), code.size(), &recompiled_loop}
+                };
+                Emulator::Recompiled::Library const library {
+                        Emulator::Recompiled::abi_version, blocks.data(), blocks.size()
+                };
+
+                Emulator::CPU::RAM ram;
+                RomMemory memory(loop_program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+                cpu.use_recompiled_code(library);
+                recompiled_runs = 0;
+                cpu.execute_instructions(12);
+
+                // Recompiled code doesn't count what it runs, so statistics builds skip it.
+                CHECK((recompiled_runs > 0) == !cpu.statistics());
+                CHECK(cpu.cycles() == interpreted.cycles());
+                CHECK(cpu.pc() == interpreted.pc());
+                CHECK(cpu.x() == interpreted.x());
+                CHECK(cpu.p() == interpreted.p());
+        }
+
+        SECTION("Code compiled from different bytes isn't used")
+        {
+                std::vector<Emulator::Byte> const code {0xCA, 0xD0, 0xFC};
+                std::vector<Emulator::Recompiled::Block> const blocks {
+                        {0x8002, code.data(), code.size(), &recompiled_loop}
+                };
+                Emulator::Recompiled::Library const library {
+                        Emulator::Recompiled::abi_version, blocks.data(), blocks.size()
+                };
+
+                Emulator::CPU::RAM ram;
+                RomMemory memory(loop_program);
+                Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+                cpu.use_recompiled_code(library);
+                recompiled_runs = 0;
+                cpu.execute_instructions(12);
+
+                CHECK(recompiled_runs == 0);
+                CHECK(cpu.cycles() == interpreted.cycles());
+                CHECK(cpu.pc() == interpreted.pc());
+        }
+}
+
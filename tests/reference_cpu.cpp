@@ -0,0 +1,419 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "reference_cpu.h"
+#include <stdexcept>
+
+using Emulator::Address;
+using Emulator::Byte;
+
+ReferenceCpu::ReferenceCpu(Emulator::Memory& memory)
+        : memory_(memory)
+{
+        pc = read_word(0xFFFC);
+}
+
+void ReferenceCpu::step()
+{
+        Byte const opcode = read(pc++);
+        cycles += execute(opcode);
+}
+
+void ReferenceCpu::nmi()
+{
+        interrupt(0xFFFA, p & ~break_flag);
+        cycles += 7;
+}
+
+unsigned ReferenceCpu::execute(Byte opcode)
+{
+        switch (opcode) {
+        case 0x00: brk(); return 7; // BRK
+        case 0x01: set_nz(a |= read(indirect_x())); return 6; // ORA
+        case 0x05: set_nz(a |= read(zero_page())); return 3; // ORA
+        case 0x06: modify(zero_page(), &ReferenceCpu::asl); return 5; // ASL
+        case 0x08: push(p | unused_flag); return 3; // PHP
+        case 0x09: set_nz(a |= read(immediate())); return 2; // ORA
+        case 0x0A: a = asl(a); return 2; // ASL
+        case 0x0D: set_nz(a |= read(absolute())); return 4; // ORA
+        case 0x0E: modify(absolute(), &ReferenceCpu::asl); return 6; // ASL
+        case 0x10: branch(!flag(negative_flag)); return 2; // BPL
+        case 0x11: set_nz(a |= read(indirect_y(true))); return 5; // ORA
+        case 0x15: set_nz(a |= read(zero_page_x())); return 4; // ORA
+        case 0x16: modify(zero_page_x(), &ReferenceCpu::asl); return 6; // ASL
+        case 0x18: set_flag(carry_flag, false); return 2; // CLC
+        case 0x19: set_nz(a |= read(absolute_y(true))); return 4; // ORA
+        case 0x1D: set_nz(a |= read(absolute_x(true))); return 4; // ORA
+        case 0x1E: modify(absolute_x(false), &ReferenceCpu::asl); return 7; // ASL
+        case 0x20: jsr(); return 6; // JSR
+        case 0x21: set_nz(a &= read(indirect_x())); return 6; // AND
+        case 0x24: bit(read(zero_page())); return 3; // BIT
+        case 0x25: set_nz(a &= read(zero_page())); return 3; // AND
+        case 0x26: modify(zero_page(), &ReferenceCpu::rol); return 5; // ROL
+        case 0x28: p = (pull() & ~break_flag) | unused_flag; return 4; // PLP
+        case 0x29: set_nz(a &= read(immediate())); return 2; // AND
+        case 0x2A: a = rol(a); return 2; // ROL
+        case 0x2C: bit(read(absolute())); return 4; // BIT
+        case 0x2D: set_nz(a &= read(absolute())); return 4; // AND
+        case 0x2E: modify(absolute(), &ReferenceCpu::rol); return 6; // ROL
+        case 0x30: branch(flag(negative_flag)); return 2; // BMI
+        case 0x31: set_nz(a &= read(indirect_y(true))); return 5; // AND
+        case 0x35: set_nz(a &= read(zero_page_x())); return 4; // AND
+        case 0x36: modify(zero_page_x(), &ReferenceCpu::rol); return 6; // ROL
+        case 0x38: set_flag(carry_flag, true); return 2; // SEC
+        case 0x39: set_nz(a &= read(absolute_y(true))); return 4; // AND
+        case 0x3D: set_nz(a &= read(absolute_x(true))); return 4; // AND
+        case 0x3E: modify(absolute_x(false), &ReferenceCpu::rol); return 7; // ROL
+        case 0x40: rti(); return 6; // RTI
+        case 0x41: set_nz(a ^= read(indirect_x())); return 6; // EOR
+        case 0x45: set_nz(a ^= read(zero_page())); return 3; // EOR
+        case 0x46: modify(zero_page(), &ReferenceCpu::lsr); return 5; // LSR
+        case 0x48: push(a); return 3; // PHA
+        case 0x49: set_nz(a ^= read(immediate())); return 2; // EOR
+        case 0x4A: a = lsr(a); return 2; // LSR
+        case 0x4C: pc = absolute(); return 3; // JMP
+        case 0x4D: set_nz(a ^= read(absolute())); return 4; // EOR
+        case 0x4E: modify(absolute(), &ReferenceCpu::lsr); return 6; // LSR
+        case 0x50: branch(!flag(overflow_flag)); return 2; // BVC
+        case 0x51: set_nz(a ^= read(indirect_y(true))); return 5; // EOR
+        case 0x55: set_nz(a ^= read(zero_page_x())); return 4; // EOR
+        case 0x56: modify(zero_page_x(), &ReferenceCpu::lsr); return 6; // LSR
+        case 0x58: set_flag(interrupt_flag, false); return 2; // CLI
+        case 0x59: set_nz(a ^= read(absolute_y(true))); return 4; // EOR
+        case 0x5D: set_nz(a ^= read(absolute_x(true))); return 4; // EOR
+        case 0x5E: modify(absolute_x(false), &ReferenceCpu::lsr); return 7; // LSR
+        case 0x60: rts(); return 6; // RTS
+        case 0x61: adc(read(indirect_x())); return 6; // ADC
+        case 0x65: adc(read(zero_page())); return 3; // ADC
+        case 0x66: modify(zero_page(), &ReferenceCpu::ror); return 5; // ROR
+        case 0x68: set_nz(a = pull()); return 4; // PLA
+        case 0x69: adc(read(immediate())); return 2; // ADC
+        case 0x6A: a = ror(a); return 2; // ROR
+        case 0x6C: pc = indirect(); return 5; // JMP
+        case 0x6D: adc(read(absolute())); return 4; // ADC
+        case 0x6E: modify(absolute(), &ReferenceCpu::ror); return 6; // ROR
+        case 0x70: branch(flag(overflow_flag)); return 2; // BVS
+        case 0x71: adc(read(indirect_y(true))); return 5; // ADC
+        case 0x75: adc(read(zero_page_x())); return 4; // ADC
+        case 0x76: modify(zero_page_x(), &ReferenceCpu::ror); return 6; // ROR
+        case 0x78: set_flag(interrupt_flag, true); return 2; // SEI
+        case 0x79: adc(read(absolute_y(true))); return 4; // ADC
+        case 0x7D: adc(read(absolute_x(true))); return 4; // ADC
+        case 0x7E: modify(absolute_x(false), &ReferenceCpu::ror); return 7; // ROR
+        case 0x81: write(indirect_x(), a); return 6; // STA
+        case 0x84: write(zero_page(), y); return 3; // STY
+        case 0x85: write(zero_page(), a); return 3; // STA
+        case 0x86: write(zero_page(), x); return 3; // STX
+        case 0x88: set_nz(--y); return 2; // DEY
+        case 0x8A: set_nz(a = x); return 2; // TXA
+        case 0x8C: write(absolute(), y); return 4; // STY
+        case 0x8D: write(absolute(), a); return 4; // STA
+        case 0x8E: write(absolute(), x); return 4; // STX
+        case 0x90: branch(!flag(carry_flag)); return 2; // BCC
+        case 0x91: write(indirect_y(false), a); return 6; // STA
+        case 0x94: write(zero_page_x(), y); return 4; // STY
+        case 0x95: write(zero_page_x(), a); return 4; // STA
+        case 0x96: write(zero_page_y(), x); return 4; // STX
+        case 0x98: set_nz(a = y); return 2; // TYA
+        case 0x99: write(absolute_y(false), a); return 5; // STA
+        case 0x9A: sp = x; return 2; // TXS
+        case 0x9D: write(absolute_x(false), a); return 5; // STA
+        case 0xA0: set_nz(y = read(immediate())); return 2; // LDY
+        case 0xA1: set_nz(a = read(indirect_x())); return 6; // LDA
+        case 0xA2: set_nz(x = read(immediate())); return 2; // LDX
+        case 0xA4: set_nz(y = read(zero_page())); return 3; // LDY
+        case 0xA5: set_nz(a = read(zero_page())); return 3; // LDA
+        case 0xA6: set_nz(x = read(zero_page())); return 3; // LDX
+        case 0xA8: set_nz(y = a); return 2; // TAY
+        case 0xA9: set_nz(a = read(immediate())); return 2; // LDA
+        case 0xAA: set_nz(x = a); return 2; // TAX
+        case 0xAC: set_nz(y = read(absolute())); return 4; // LDY
+        case 0xAD: set_nz(a = read(absolute())); return 4; // LDA
+        case 0xAE: set_nz(x = read(absolute())); return 4; // LDX
+        case 0xB0: branch(flag(carry_flag)); return 2; // BCS
+        case 0xB1: set_nz(a = read(indirect_y(true))); return 5; // LDA
+        case 0xB4: set_nz(y = read(zero_page_x())); return 4; // LDY
+        case 0xB5: set_nz(a = read(zero_page_x())); return 4; // LDA
+        case 0xB6: set_nz(x = read(zero_page_y())); return 4; // LDX
+        case 0xB8: set_flag(overflow_flag, false); return 2; // CLV
+        case 0xB9: set_nz(a = read(absolute_y(true))); return 4; // LDA
+        case 0xBA: set_nz(x = sp); return 2; // TSX
+        case 0xBC: set_nz(y = read(absolute_x(true))); return 4; // LDY
+        case 0xBD: set_nz(a = read(absolute_x(true))); return 4; // LDA
+        case 0xBE: set_nz(x = read(absolute_y(true))); return 4; // LDX
+        case 0xC0: compare(y, read(immediate())); return 2; // CPY
+        case 0xC1: compare(a, read(indirect_x())); return 6; // CMP
+        case 0xC4: compare(y, read(zero_page())); return 3; // CPY
+        case 0xC5: compare(a, read(zero_page())); return 3; // CMP
+        case 0xC6: modify(zero_page(), &ReferenceCpu::dec); return 5; // DEC
+        case 0xC8: set_nz(++y); return 2; // INY
+        case 0xC9: compare(a, read(immediate())); return 2; // CMP
+        case 0xCA: set_nz(--x); return 2; // DEX
+        case 0xCC: compare(y, read(absolute())); return 4; // CPY
+        case 0xCD: compare(a, read(absolute())); return 4; // CMP
+        case 0xCE: modify(absolute(), &ReferenceCpu::dec); return 6; // DEC
+        case 0xD0: branch(!flag(zero_flag)); return 2; // BNE
+        case 0xD1: compare(a, read(indirect_y(true))); return 5; // CMP
+        case 0xD5: compare(a, read(zero_page_x())); return 4; // CMP
+        case 0xD6: modify(zero_page_x(), &ReferenceCpu::dec); return 6; // DEC
+        case 0xD8: set_flag(decimal_flag, false); return 2; // CLD
+        case 0xD9: compare(a, read(absolute_y(true))); return 4; // CMP
+        case 0xDD: compare(a, read(absolute_x(true))); return 4; // CMP
+        case 0xDE: modify(absolute_x(false), &ReferenceCpu::dec); return 7; // DEC
+        case 0xE0: compare(x, read(immediate())); return 2; // CPX
+        case 0xE1: adc(~read(indirect_x())); return 6; // SBC
+        case 0xE4: compare(x, read(zero_page())); return 3; // CPX
+        case 0xE5: adc(~read(zero_page())); return 3; // SBC
+        case 0xE6: modify(zero_page(), &ReferenceCpu::inc); return 5; // INC
+        case 0xE8: set_nz(++x); return 2; // INX
+        case 0xE9: adc(~read(immediate())); return 2; // SBC
+        case 0xEA: return 2; // NOP
+        case 0xEC: compare(x, read(absolute())); return 4; // CPX
+        case 0xED: adc(~read(absolute())); return 4; // SBC
+        case 0xEE: modify(absolute(), &ReferenceCpu::inc); return 6; // INC
+        case 0xF0: branch(flag(zero_flag)); return 2; // BEQ
+        case 0xF1: adc(~read(indirect_y(true))); return 5; // SBC
+        case 0xF5: adc(~read(zero_page_x())); return 4; // SBC
+        case 0xF6: modify(zero_page_x(), &ReferenceCpu::inc); return 6; // INC
+        case 0xF8: set_flag(decimal_flag, true); return 2; // SED
+        case 0xF9: adc(~read(absolute_y(true))); return 4; // SBC
+        case 0xFD: adc(~read(absolute_x(true))); return 4; // SBC
+        case 0xFE: modify(absolute_x(false), &ReferenceCpu::inc); return 7; // INC
+        default:
+                --pc;
+                throw std::runtime_error("Unknown opcode");
+        }
+}
+
+Byte ReferenceCpu::read(Address address)
+{
+        return memory_.read_byte(address);
+}
+
+Address ReferenceCpu::read_word(Address address)
+{
+        return read(address) | read(address + 1) << 8;
+}
+
+void ReferenceCpu::write(Address address, Byte byte)
+{
+        memory_.write_byte(address, byte);
+}
+
+void ReferenceCpu::push(Byte byte)
+{
+        write(0x0100 | sp--, byte);
+}
+
+Byte ReferenceCpu::pull()
+{
+        return read(0x0100 | ++sp);
+}
+
+Address ReferenceCpu::immediate()
+{
+        return pc++;
+}
+
+Address ReferenceCpu::zero_page()
+{
+        return read(pc++);
+}
+
+Address ReferenceCpu::zero_page_x()
+{
+        return Byte(read(pc++) + x);
+}
+
+Address ReferenceCpu::zero_page_y()
+{
+        return Byte(read(pc++) + y);
+}
+
+Address ReferenceCpu::absolute()
+{
+        Address const address = read_word(pc);
+        pc += 2;
+        return address;
+}
+
+Address ReferenceCpu::absolute_x(bool page_cross_penalty)
+{
+        return indexed(absolute(), x, page_cross_penalty);
+}
+
+Address ReferenceCpu::absolute_y(bool page_cross_penalty)
+{
+        return indexed(absolute(), y, page_cross_penalty);
+}
+
+Address ReferenceCpu::indexed(Address base, Byte index, bool page_cross_penalty)
+{
+        Address const address = base + index;
+        if (page_cross_penalty && (address & 0xFF00) != (base & 0xFF00))
+                ++cycles;
+        return address;
+}
+
+/**
+ * The high byte of the target comes from the start of the same page
+ * when the pointer is at the end of one.
+ */
+Address ReferenceCpu::indirect()
+{
+        Address const pointer = absolute();
+        Address const high_address = (pointer & 0xFF00) | ((pointer + 1) & 0x00FF);
+        return read(pointer) | read(high_address) << 8;
+}
+
+Address ReferenceCpu::indirect_x()
+{
+        Byte const pointer = read(pc++) + x;
+        return read(pointer) | read(Byte(pointer + 1)) << 8;
+}
+
+Address ReferenceCpu::indirect_y(bool page_cross_penalty)
+{
+        Byte const pointer = read(pc++);
+        Address const base = read(pointer) | read(Byte(pointer + 1)) << 8;
+        return indexed(base, y, page_cross_penalty);
+}
+
+bool ReferenceCpu::flag(Byte flag) const
+{
+        return p & flag;
+}
+
+void ReferenceCpu::set_flag(Byte flag, bool value)
+{
+        p = value ? p | flag : p & ~flag;
+}
+
+void ReferenceCpu::set_nz(Byte value)
+{
+        set_flag(zero_flag, value == 0);
+        set_flag(negative_flag, value & 0x80);
+}
+
+void ReferenceCpu::adc(Byte operand)
+{
+        unsigned const sum = a + operand + flag(carry_flag);
+        set_flag(carry_flag, sum > 0xFF);
+        set_flag(overflow_flag, ~(a ^ operand) & (a ^ sum) & 0x80);
+        a = sum;
+        set_nz(a);
+}
+
+void ReferenceCpu::compare(Byte reg, Byte operand)
+{
+        set_flag(carry_flag, reg >= operand);
+        set_nz(reg - operand);
+}
+
+void ReferenceCpu::bit(Byte operand)
+{
+        set_flag(zero_flag, (a & operand) == 0);
+        set_flag(overflow_flag, operand & 0x40);
+        set_flag(negative_flag, operand & 0x80);
+}
+
+void ReferenceCpu::branch(bool condition)
+{
+        auto const offset = static_cast<std::int8_t>(read(pc++));
+        if (!condition)
+                return;
+        Address const target = pc + offset;
+        cycles += (target & 0xFF00) == (pc & 0xFF00) ? 1 : 2;
+        pc = target;
+}
+
+void ReferenceCpu::modify(Address address, Byte (ReferenceCpu::*operation)(Byte))
+{
+        write(address, (this->*operation)(read(address)));
+}
+
+Byte ReferenceCpu::asl(Byte operand)
+{
+        set_flag(carry_flag, operand & 0x80);
+        Byte const result = operand << 1;
+        set_nz(result);
+        return result;
+}
+
+Byte ReferenceCpu::lsr(Byte operand)
+{
+        set_flag(carry_flag, operand & 0x01);
+        Byte const result = operand >> 1;
+        set_nz(result);
+        return result;
+}
+
+Byte ReferenceCpu::rol(Byte operand)
+{
+        Byte const result = operand << 1 | flag(carry_flag);
+        set_flag(carry_flag, operand & 0x80);
+        set_nz(result);
+        return result;
+}
+
+Byte ReferenceCpu::ror(Byte operand)
+{
+        Byte const result = operand >> 1 | flag(carry_flag) << 7;
+        set_flag(carry_flag, operand & 0x01);
+        set_nz(result);
+        return result;
+}
+
+Byte ReferenceCpu::inc(Byte operand)
+{
+        set_nz(operand + 1);
+        return operand + 1;
+}
+
+Byte ReferenceCpu::dec(Byte operand)
+{
+        set_nz(operand - 1);
+        return operand - 1;
+}
+
+/**
+ * Pushes the address of its own last byte.
+ */
+void ReferenceCpu::jsr()
+{
+        Address const target = read_word(pc);
+        Address const return_address = pc + 1;
+        push(return_address >> 8);
+        push(return_address & 0xFF);
+        pc = target;
+}
+
+void ReferenceCpu::rts()
+{
+        Byte const low = pull();
+        pc = (low | pull() << 8) + 1;
+}
+
+void ReferenceCpu::rti()
+{
+        p = (pull() & ~break_flag) | unused_flag;
+        Byte const low = pull();
+        pc = low | pull() << 8;
+}
+
+/**
+ * BRK skips a padding byte, and isn't masked by I.
+ */
+void ReferenceCpu::brk()
+{
+        ++pc;
+        interrupt(0xFFFE, p | break_flag);
+}
+
+void ReferenceCpu::interrupt(Address vector, Byte pushed_flags)
+{
+        push(pc >> 8);
+        push(pc & 0xFF);
+        push(pushed_flags | unused_flag);
+        set_flag(interrupt_flag, true);
+        pc = read_word(vector);
+}
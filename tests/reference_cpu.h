@@ -0,0 +1,93 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#pragma once
+
+#include "../src/utils.h"
+#include <cstdint>
+
+/**
+ * A deliberately plain 6502 (the NES's, so without decimal mode) to
+ * check the emulator's CPU against. It's one switch over the opcodes,
+ * with every access going straight to memory and the flags kept in P.
+ * Nothing in here comes from src/cpu.cpp or src/opcodes.h, so a mistake
+ * there doesn't get copied over.
+ *
+ * PHP pushes P without the break flag, like the simulator in 6502js/
+ * that the example programs in cpu_tests.cpp were checked with.
+ */
+class ReferenceCpu {
+public:
+        /**
+         * Starts the way the emulator's CPU does: at the reset vector,
+         * with the stack pointer at $FF and only the unused flag set.
+         */
+        explicit ReferenceCpu(Emulator::Memory& memory);
+
+        /**
+         * Throws std::runtime_error on an unknown opcode, leaving the
+         * program counter on it.
+         */
+        void step();
+        void nmi();
+
+        Emulator::Address pc = 0;
+        Emulator::Byte a = 0;
+        Emulator::Byte x = 0;
+        Emulator::Byte y = 0;
+        Emulator::Byte sp = 0xFF;
+        Emulator::Byte p = unused_flag;
+        std::uint64_t cycles = 0;
+
+private:
+        static Emulator::Byte constexpr carry_flag = 1 << 0;
+        static Emulator::Byte constexpr zero_flag = 1 << 1;
+        static Emulator::Byte constexpr interrupt_flag = 1 << 2;
+        static Emulator::Byte constexpr decimal_flag = 1 << 3;
+        static Emulator::Byte constexpr break_flag = 1 << 4;
+        static Emulator::Byte constexpr unused_flag = 1 << 5;
+        static Emulator::Byte constexpr overflow_flag = 1 << 6;
+        static Emulator::Byte constexpr negative_flag = 1 << 7;
+
+        unsigned execute(Emulator::Byte opcode);
+
+        Emulator::Byte read(Emulator::Address address);
+        Emulator::Address read_word(Emulator::Address address);
+        void write(Emulator::Address address, Emulator::Byte byte);
+        void push(Emulator::Byte byte);
+        Emulator::Byte pull();
+
+        Emulator::Address immediate();
+        Emulator::Address zero_page();
+        Emulator::Address zero_page_x();
+        Emulator::Address zero_page_y();
+        Emulator::Address absolute();
+        Emulator::Address absolute_x(bool page_cross_penalty);
+        Emulator::Address absolute_y(bool page_cross_penalty);
+        Emulator::Address indexed(Emulator::Address base, Emulator::Byte index, bool page_cross_penalty);
+        Emulator::Address indirect();
+        Emulator::Address indirect_x();
+        Emulator::Address indirect_y(bool page_cross_penalty);
+
+        bool flag(Emulator::Byte flag) const;
+        void set_flag(Emulator::Byte flag, bool value);
+        void set_nz(Emulator::Byte value);
+
+        void adc(Emulator::Byte operand);
+        void compare(Emulator::Byte reg, Emulator::Byte operand);
+        void bit(Emulator::Byte operand);
+        void branch(bool condition);
+        void modify(Emulator::Address address, Emulator::Byte (ReferenceCpu::*operation)(Emulator::Byte));
+        Emulator::Byte asl(Emulator::Byte operand);
+        Emulator::Byte lsr(Emulator::Byte operand);
+        Emulator::Byte rol(Emulator::Byte operand);
+        Emulator::Byte ror(Emulator::Byte operand);
+        Emulator::Byte inc(Emulator::Byte operand);
+        Emulator::Byte dec(Emulator::Byte operand);
+        void jsr();
+        void rts();
+        void rti();
+        void brk();
+        void interrupt(Emulator::Address vector, Emulator::Byte pushed_flags);
+
+        Emulator::Memory& memory_;
+};
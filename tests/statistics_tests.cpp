@@ -0,0 +1,107 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "mem.h"
+#include "../src/cpu.h"
+#include "../src/statistics.h"
+#include <sstream>
+#include <vector>
+
+namespace {
+
+Emulator::Address constexpr rom_start = 0x8000;
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+                write_pointer(Emulator::CPU::interrupt_handler_address(Emulator::CPU::Interrupt::reset), rom_start);
+        }
+};
+
+}
+
+TEST_CASE("The CPU counts what it executes")
+{
+        /**
+           LDX #$03
+         loop:
+           DEX
+           BNE loop
+           LDA $8000
+           STA $0200
+           INC $10
+        */
+
+        Emulator::CPU::RAM ram;
+        RomMemory memory({
+                0xA2, 0x03, 0xCA, 0xD0, 0xFD, 0xAD, 0x00, 0x80,
+                0x8D, 0x00, 0x02, 0xE6, 0x10
+        });
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+        cpu.execute_instructions(10);
+
+        Emulator::Statistics const* const statistics = cpu.statistics();
+        if (!statistics)
+                return; // Built without EMULATOR_STATISTICS
+
+        CHECK(statistics->executions[0xA2] == 1);
+        CHECK(statistics->executions[0xCA] == 3);
+        CHECK(statistics->executions[0xD0] == 3);
+        CHECK(statistics->branches_taken[0xD0] == 2);
+        CHECK(statistics->executions[0xE6] == 1);
+
+        REQUIRE(statistics->accesses.size() == 2);
+        CHECK(statistics->accesses[0].reads == 1);  // INC
+        CHECK(statistics->accesses[0].writes == 2); // STA, INC
+        CHECK(statistics->accesses[1].reads == 3);  // The reset vector and LDA
+        CHECK(statistics->accesses[1].writes == 0);
+
+        SECTION("The counts carry on through a reset")
+        {
+                cpu.hardware_interrupt(Emulator::CPU::Interrupt::reset);
+                cpu.execute_instructions(1);
+                CHECK(cpu.statistics()->executions[0xA2] == 2);
+        }
+}
+
+TEST_CASE("Statistics are written as CSV and JSON")
+{
+        Emulator::Statistics statistics;
+        statistics.executions[0xA9] = 5; // LDA #imm
+        statistics.executions[0x69] = 2; // ADC #imm
+        statistics.executions[0xD0] = 4; // BNE
+        statistics.branches_taken[0xD0] = 3;
+        statistics.accesses = {{7, 8}, {1, 0}};
+        std::vector<std::string> const names {"RAM", "PPU"};
+
+        SECTION("CSV")
+        {
+                std::stringstream csv;
+                statistics.write_csv(csv, names);
+                std::string const text = csv.str();
+                CHECK(text.find("counter,key,count\n") == 0);
+                CHECK(text.find("opcode,0xa9 LDA immediate,5\n") != std::string::npos);
+                CHECK(text.find("addressing_mode,immediate,7\n") != std::string::npos);
+                CHECK(text.find("addressing_mode,relative,4\n") != std::string::npos);
+                CHECK(text.find("branch_taken,0xd0 BNE relative,3\n") != std::string::npos);
+                CHECK(text.find("branch_not_taken,0xd0 BNE relative,1\n") != std::string::npos);
+                CHECK(text.find("reads,RAM,7\nwrites,RAM,8\n") != std::string::npos);
+                CHECK(text.find("reads,PPU,1\n") != std::string::npos);
+        }
+
+        SECTION("JSON")
+        {
+                std::stringstream json;
+                statistics.write_json(json, names);
+                std::string const text = json.str();
+                CHECK(text.find("{\"opcode\": \"0xd0\", \"mnemonic\": \"BNE\", \"mode\": \"relative\", "
+                                "\"executions\": 4, \"taken\": 3, \"not_taken\": 1}") != std::string::npos);
+                CHECK(text.find("\"immediate\": 7") != std::string::npos);
+                CHECK(text.find("{\"piece\": \"PPU\", \"reads\": 1, \"writes\": 0}") != std::string::npos);
+                CHECK(text.back() == '\n');
+        }
+}
@@ -0,0 +1,137 @@
+// vim: set shiftwidth=8 tabstop=8:
+
+#include "catch.hpp"
+#include "mem.h"
+#include "../src/cpu.h"
+#include "../src/trace.h"
+#include <sstream>
+#include <vector>
+
+namespace {
+
+Emulator::Address constexpr rom_start = 0x8000;
+
+class RomMemory : public TestMemory<0x8000> {
+public:
+        explicit RomMemory(std::vector<Emulator::Byte> const& program)
+                : TestMemory(rom_start)
+        {
+                for (unsigned i = 0; i < program.size(); ++i)
+                        write_byte(rom_start + i, program[i]);
+                write_pointer(Emulator::CPU::interrupt_handler_address(Emulator::CPU::Interrupt::reset), rom_start);
+        }
+};
+
+/**
+   LDX #$02
+ loop:
+   DEX
+   BNE loop
+ done:
+   JMP done
+*/
+std::vector<Emulator::Byte> const loop_program {
+        0xA2, 0x02, 0xCA, 0xD0, 0xFD, 0x4C, 0x05, 0x80
+};
+
+Emulator::TraceRecord make_record(Emulator::Cycles cycles, Emulator::Address pc)
+{
+        return {cycles, pc, {0xEA, 0x00, 0x00}, 0x01, 0x02, 0x03, 0x24, 0xFD};
+}
+
+}
+
+TEST_CASE("The CPU records every instruction while it's tracing")
+{
+        Emulator::CPU::RAM ram;
+        RomMemory memory(loop_program);
+        Emulator::CPU cpu(Emulator::CPU::AccessibleMemory::Pieces {&ram, &memory});
+        Emulator::TraceBuffer trace(16);
+        cpu.trace_to(&trace);
+        Emulator::Cycles const start = cpu.cycles();
+        cpu.execute_instructions(7);
+
+        auto const records = trace.records();
+        REQUIRE(records.size() == 7);
+        std::vector<Emulator::Address> pcs;
+        for (auto const& record : records)
+                pcs.push_back(record.pc);
+        std::vector<Emulator::Address> const expected_pcs {
+                0x8000, 0x8002, 0x8003, 0x8002, 0x8003, 0x8005, 0x8005
+        };
+        CHECK(pcs == expected_pcs);
+        CHECK(records[0].cycles == start);
+        CHECK(records[1].cycles == start + 2);
+        CHECK(records[1].x == 0x02);
+        CHECK(records[5].bytes == std::array<Emulator::Byte, 3> {0x4C, 0x05, 0x80});
+
+        SECTION("Tracing doesn't change what the CPU does")
+        {
+                Emulator::CPU::RAM untraced_ram;
+                RomMemory untraced_memory(loop_program);
+                Emulator::CPU untraced(Emulator::CPU::AccessibleMemory::Pieces {&untraced_ram, &untraced_memory});
+                untraced.execute_instructions(7);
+                CHECK(cpu.pc() == untraced.pc());
+                CHECK(cpu.x() == untraced.x());
+                CHECK(cpu.p() == untraced.p());
+                CHECK(cpu.cycles() == untraced.cycles());
+        }
+
+        SECTION("Nothing is recorded once tracing is off")
+        {
+                cpu.trace_to(nullptr);
+                cpu.execute_instructions(5);
+                CHECK(trace.recorded() == 7);
+        }
+}
+
+TEST_CASE("The trace buffer keeps the latest records")
+{
+        Emulator::TraceBuffer trace(3);
+        REQUIRE(trace.capacity() == 4);
+        for (Emulator::Address pc = 0; pc < 6; ++pc)
+                trace.record(make_record(pc, pc));
+
+        CHECK(trace.recorded() == 6);
+        auto const records = trace.records();
+        REQUIRE(records.size() == 4);
+        CHECK(records.front().pc == 2);
+        CHECK(records.back().pc == 5);
+
+        SECTION("Saved traces load back the same")
+        {
+                std::stringstream file;
+                trace.save(file);
+                auto const loaded = Emulator::load_trace(file);
+                REQUIRE(loaded.size() == 4);
+                for (std::size_t i = 0; i < loaded.size(); ++i) {
+                        CHECK(loaded[i].cycles == records[i].cycles);
+                        CHECK(loaded[i].pc == records[i].pc);
+                        CHECK(loaded[i].bytes == records[i].bytes);
+                        CHECK(loaded[i].p == records[i].p);
+                        CHECK(loaded[i].sp == records[i].sp);
+                }
+        }
+
+        SECTION("Anything else doesn't load")
+        {
+                std::stringstream file("NESTRAC");
+                CHECK_THROWS_AS(Emulator::load_trace(file), Emulator::InvalidTrace);
+        }
+
+        SECTION("Clearing empties the buffer")
+        {
+                trace.clear();
+                CHECK(trace.records().empty());
+        }
+}
+
+TEST_CASE("Traces are written like nestest.log")
+{
+        CHECK(Emulator::nestest_line({7, 0xC000, {0x4C, 0xF5, 0xC5}, 0x00, 0x00, 0x00, 0x24, 0xFD}) ==
+              "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7");
+        CHECK(Emulator::nestest_line({26, 0xC72D, {0xB0, 0x04, 0x00}, 0x00, 0x00, 0x00, 0x27, 0xFB}) ==
+              "C72D  B0 04     BCS $C733                       A:00 X:00 Y:00 P:27 SP:FB PPU:  0, 78 CYC:26");
+        CHECK(Emulator::nestest_line({14575, 0xC5F5, {0xEA, 0x00, 0x00}, 0x00, 0x00, 0x00, 0x24, 0xFD}) ==
+              "C5F5  EA        NOP                             A:00 X:00 Y:00 P:24 SP:FD PPU:128, 77 CYC:14575");
+}